@@ -0,0 +1,201 @@
+/* TransportBench.cpp */
+
+#include <cstdlib> // std::atol, std::atof
+#include <cstring> // std::strcmp, std::strchr
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h> // getrusage
+#include <boost/mpi.hpp>
+#include "repast_hpc/RepastProcess.h"
+
+#include "Model.h"
+
+namespace {
+
+/* One scaling experiment, translated into model property overrides */
+struct BenchSettings
+{
+    std::string preset; // strong, weak or empty for explicit settings
+    long agents; // per rank, or in total for the strong preset
+    int degree; // mean number of agentNetwork neighbours
+    int ticks;
+    int threads;
+    std::string json; // written by rank 0, stdout when empty
+    std::vector<std::string> overrides; // further key=value properties, passed to the model as given
+
+    BenchSettings(): agents(0), degree(6), ticks(100), threads(1){ }
+};
+
+void usage()
+{
+    std::cerr << "usage: mpirun -np N transport_bench <config.props> <model.props> [--preset strong|weak] [--agents N] [--degree D]"
+              << " [--ticks T] [--threads K] [--json file] [key=value ...]" << std::endl;
+}
+
+bool parseArguments(int argc, char** argv, BenchSettings& settings)
+{
+    for(int a = 3; a < argc; a++)
+    {
+        std::string arg = argv[a];
+        bool hasValue = a + 1 < argc;
+        if(arg == "--preset" && hasValue) settings.preset = argv[++a];
+        else if(arg == "--agents" && hasValue) settings.agents = std::atol(argv[++a]);
+        else if(arg == "--degree" && hasValue) settings.degree = std::atoi(argv[++a]);
+        else if(arg == "--ticks" && hasValue) settings.ticks = std::atoi(argv[++a]);
+        else if(arg == "--threads" && hasValue) settings.threads = std::atoi(argv[++a]);
+        else if(arg == "--json" && hasValue) settings.json = argv[++a];
+        else if(std::strchr(argv[a], '=') != 0) settings.overrides.push_back(arg);
+        else return false;
+    }
+    if(!settings.preset.empty() && settings.preset != "strong" && settings.preset != "weak") return false;
+    return settings.degree > 0 && settings.ticks > 0 && settings.threads > 0 && settings.agents >= 0;
+}
+
+/* Strong scaling keeps the total population fixed as ranks are added, weak scaling keeps the population per rank fixed */
+long agentsPerRank(const BenchSettings& settings, int worldSize)
+{
+    if(settings.preset == "strong")
+    {
+        long total = settings.agents > 0 ? settings.agents : 1000000;
+        return (total + worldSize - 1) / worldSize;
+    }
+    if(settings.agents > 0) return settings.agents;
+    return 100000;
+}
+
+long peakResidentKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for(size_t i = 0; i < text.size(); i++)
+    {
+        if(text[i] == '"' || text[i] == '\\') quoted += '\\';
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+}
+
+/* Runs the model once with the requested scale and reports where the time went as json */
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        usage();
+        return 1;
+    }
+    std::string configFile = argv[1];
+    std::string propsFile  = argv[2];
+    boost::mpi::communicator world;
+    boost::mpi::environment env(argc, argv);
+
+    BenchSettings settings;
+    if(!parseArguments(argc, argv, settings))
+    {
+        if(world.rank() == 0) usage();
+        return 1;
+    }
+    long perRank = agentsPerRank(settings, world.size());
+
+    std::vector<std::string> properties; // later assignments win, so explicit key=value arguments override the flags
+    std::ostringstream value;
+    value << "count.of.agents=" << perRank; properties.push_back(value.str()); value.str("");
+    value << "network.neighbours=" << settings.degree; properties.push_back(value.str()); value.str("");
+    value << "network.edges.per.agent=" << (settings.degree / 2 > 0 ? settings.degree / 2 : 1); properties.push_back(value.str()); value.str(""); // scale free edges count at both ends
+    value << "stop.at=" << settings.ticks + 1; properties.push_back(value.str()); value.str(""); // doSomething runs from tick 2
+    value << "threads.per.rank=" << settings.threads; properties.push_back(value.str()); value.str("");
+    properties.insert(properties.end(), settings.overrides.begin(), settings.overrides.end());
+
+    std::vector<char*> modelArgv;
+    modelArgv.push_back(argv[0]);
+    modelArgv.push_back(argv[1]);
+    modelArgv.push_back(argv[2]);
+    for(size_t p = 0; p < properties.size(); p++) modelArgv.push_back(const_cast<char*>(properties[p].c_str()));
+    modelArgv.push_back(0);
+    int modelArgc = (int)modelArgv.size() - 1;
+
+    repast::RepastProcess::init(configFile);
+    RepastHPCModel* model = new RepastHPCModel(propsFile, modelArgc, &modelArgv[0], &world);
+    repast::ScheduleRunner& runner = repast::RepastProcess::instance()->getScheduleRunner();
+
+    world.barrier();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    model->init();
+    model->initSchedule(runner);
+    runner.run();
+    world.barrier();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const PhaseTimes& phases = model->getPhaseTimes();
+    std::vector<double> maxSeconds(PhaseTimes::PHASE_COUNT), sumSeconds(PhaseTimes::PHASE_COUNT);
+    boost::mpi::all_reduce(world, phases.seconds, PhaseTimes::PHASE_COUNT, &maxSeconds[0], boost::mpi::maximum<double>());
+    boost::mpi::all_reduce(world, phases.seconds, PhaseTimes::PHASE_COUNT, &sumSeconds[0], std::plus<double>());
+    std::vector<boost::uint64_t> sumAllocations(PhaseTimes::PHASE_COUNT), sumSlabs(PhaseTimes::PHASE_COUNT);
+    boost::mpi::all_reduce(world, phases.allocations, PhaseTimes::PHASE_COUNT, &sumAllocations[0], std::plus<boost::uint64_t>());
+    boost::mpi::all_reduce(world, phases.slabs, PhaseTimes::PHASE_COUNT, &sumSlabs[0], std::plus<boost::uint64_t>());
+    long agents = model->getLocalAgentCount(), totalAgents = 0;
+    long edgeEnds = model->getLocalEdgeEnds(), totalEdgeEnds = 0;
+    long rss = peakResidentKb(), maxRss = 0, sumRss = 0;
+    boost::mpi::all_reduce(world, agents, totalAgents, std::plus<long>());
+    boost::mpi::all_reduce(world, edgeEnds, totalEdgeEnds, std::plus<long>());
+    boost::mpi::all_reduce(world, rss, maxRss, boost::mpi::maximum<long>());
+    boost::mpi::all_reduce(world, rss, sumRss, std::plus<long>());
+
+    double tickSeconds = maxSeconds[PhaseTimes::TICK]; // the slowest rank sets the pace
+    long ticks = phases.ticks;
+    double ticksPerSecond = tickSeconds > 0 ? ticks / tickSeconds : 0;
+
+    if(world.rank() == 0)
+    {
+        std::ostringstream json;
+        json.precision(9);
+        json << "{\n";
+        json << "  \"preset\": " << jsonString(settings.preset.empty() ? "custom" : settings.preset) << ",\n";
+        json << "  \"ranks\": " << world.size() << ",\n";
+        json << "  \"threadsPerRank\": " << settings.threads << ",\n";
+        json << "  \"agentsPerRank\": " << perRank << ",\n";
+        json << "  \"agents\": " << totalAgents << ",\n";
+        json << "  \"meanDegree\": " << (totalAgents > 0 ? (double)totalEdgeEnds / totalAgents : 0) << ",\n";
+        json << "  \"ticks\": " << ticks << ",\n";
+        json << "  \"wallSeconds\": " << wall << ",\n";
+        json << "  \"tickSeconds\": " << tickSeconds << ",\n";
+        json << "  \"ticksPerSecond\": " << ticksPerSecond << ",\n";
+        json << "  \"agentUpdatesPerSecond\": " << ticksPerSecond * totalAgents << ",\n";
+        json << "  \"peakRssKbMax\": " << maxRss << ",\n";
+        json << "  \"peakRssKbTotal\": " << sumRss << ",\n";
+        json << "  \"phases\": {\n";
+        for(int p = 0; p < PhaseTimes::PHASE_COUNT; p++)
+        {
+            json << "    " << jsonString(PhaseTimes::name(p)) << ": { \"maxSeconds\": " << maxSeconds[p]
+                 << ", \"meanSeconds\": " << sumSeconds[p] / world.size() << ", \"allocations\": " << sumAllocations[p] << ", \"slabs\": " << sumSlabs[p] << " }" << (p + 1 < PhaseTimes::PHASE_COUNT ? "," : "") << "\n";
+        }
+        json << "  },\n";
+        json << "  \"properties\": [";
+        for(size_t p = 0; p < properties.size(); p++) json << (p > 0 ? ", " : "") << jsonString(properties[p]);
+        json << "]\n";
+        json << "}\n";
+
+        if(settings.json.empty()) std::cout << json.str();
+        else
+        {
+            std::ofstream out(settings.json.c_str());
+            out << json.str();
+            if(!out) std::cerr << "Cannot write " << settings.json << std::endl;
+        }
+    }
+
+    delete model;
+    repast::RepastProcess::instance()->done();
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Checkpoint and restart: a run restarted from its last checkpoint must write, for every later tick, exactly the
+# output of the same run left uninterrupted. Checked for both norm modes; extra properties are passed to every run.
+# usage: bench/checkpoint_restart.sh [ranks] [checkpoint interval] [ticks] [property=value ...]
+# Run from TransportABM with transport_abm and output_export built into ./build; files go to ./output/restart.
+RANKS=${1:-2}
+INTERVAL=${2:-4}
+TICKS=${3:-10}
+[ $# -ge 3 ] && shift 3 || shift $#
+ABM=${ABM:-./build/transport_abm}
+EXPORT=${EXPORT:-./build/output_export}
+DIR=./output/restart
+if [ "$INTERVAL" -ge "$TICKS" ]; then
+    echo "the checkpoint interval must be below the number of ticks" >&2
+    exit 1
+fi
+RESUMED_AT=$(( (TICKS - 1) / INTERVAL * INTERVAL )) # the last checkpoint the uninterrupted run writes, at tick + 0.9
+mkdir -p "$DIR"
+
+binaries() # per rank binary files of a run, in rank order
+{
+    r=0
+    while [ "$r" -lt "$RANKS" ]; do
+        printf '%s ' "$DIR/$1.$r.bin"
+        r=$((r + 1))
+    done
+}
+
+status=0
+for mode in full incremental; do
+    rm -f "$DIR"/*
+    mpirun -np "$RANKS" "$ABM" props/config.props props/model.props stop.at="$TICKS" norms.mode="$mode" output.format=binary \
+        checkpoint.interval="$INTERVAL" checkpoint.file="$DIR/checkpoint" output.file="$DIR/uninterrupted" "$@" > "$DIR/uninterrupted.log" || exit 1
+    mpirun -np "$RANKS" "$ABM" props/config.props props/model.props stop.at="$TICKS" norms.mode="$mode" output.format=binary \
+        checkpoint.interval="$INTERVAL" checkpoint.file="$DIR/resumed_checkpoint" checkpoint.restart="$DIR/checkpoint" \
+        output.file="$DIR/resumed" "$@" > "$DIR/resumed.log" || exit 1
+    "$EXPORT" "$DIR/uninterrupted.csv" $(binaries uninterrupted) || exit 1
+    "$EXPORT" "$DIR/resumed.csv" $(binaries resumed) || exit 1
+
+    # The header and every tick after the checkpoint, printed at full precision by output_export
+    awk -F, -v after="$RESUMED_AT" 'NR == 1 || $1 > after' "$DIR/uninterrupted.csv" > "$DIR/uninterrupted.after.csv"
+    awk -F, -v after="$RESUMED_AT" 'NR == 1 || $1 > after' "$DIR/resumed.csv" > "$DIR/resumed.after.csv"
+    if [ "$(wc -l < "$DIR/uninterrupted.after.csv")" -le 1 ]; then
+        echo "norms.mode=$mode: no output after tick $RESUMED_AT" >&2
+        status=1
+    elif cmp -s "$DIR/uninterrupted.after.csv" "$DIR/resumed.after.csv"; then
+        echo "norms.mode=$mode: restart from tick $RESUMED_AT matches the uninterrupted run to tick $TICKS"
+    else
+        echo "norms.mode=$mode: restart from tick $RESUMED_AT differs from the uninterrupted run" >&2
+        diff "$DIR/uninterrupted.after.csv" "$DIR/resumed.after.csv" | head -n 10 >&2
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Strong scaling: the same population on 1, 2, 4 ... MAX_RANKS ranks.
+# usage: bench/strong_scaling.sh [max ranks] [total agents] [ticks] [threads per rank]
+# Run from TransportABM with transport_bench built into ./build; results go to ./output/bench.
+MAX_RANKS=${1:-4}
+AGENTS=${2:-1000000}
+TICKS=${3:-100}
+THREADS=${4:-1}
+BENCH=${BENCH:-./build/transport_bench}
+mkdir -p ./output/bench
+np=1
+while [ "$np" -le "$MAX_RANKS" ]; do
+    mpirun -np "$np" "$BENCH" props/config.props props/model.props --preset strong --agents "$AGENTS" --ticks "$TICKS" \
+        --threads "$THREADS" --json "./output/bench/strong_np${np}_t${THREADS}.json" output.format=binary || exit 1
+    np=$((np * 2))
+done
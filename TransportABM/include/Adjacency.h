@@ -0,0 +1,69 @@
+/* Adjacency.h */
+
+#ifndef ADJACENCY
+#define ADJACENCY
+
+#include <vector>
+#include "repast_hpc/SharedNetwork.h"
+#include "Network.h"
+#include "AgentStore.h"
+
+class RepastHPCAgent;
+
+typedef repast::SharedNetwork<RepastHPCAgent,
+                              ModelCustomEdge<RepastHPCAgent>,
+                              ModelCustomEdgeContent<RepastHPCAgent>,
+                              ModelCustomEdgeContentManager<RepastHPCAgent> > AgentNetwork;
+
+/* Compressed Sparse Row Adjacency */
+// Snapshot of agentNetwork indexed by store row. Row i holds the store indices of agent i's neighbours together
+// with the edge weight and confidence, so the play kernel scans one contiguous range per agent instead of calling
+// successors() and findEdge(). Rows are ordered by neighbour AgentId, independent of hash map iteration order.
+// The snapshot is tied to the store layout it was built against and must be rebuilt when edges change, unless
+// the change goes through insert() and erase(): built with slack, every row keeps that many free entries after
+// its neighbours, and follow() replays the store's row journal so ghosts can come and go without a rebuild.
+class AgentAdjacency
+{
+
+private:
+    bool valid; // false until built and after invalidate()
+    unsigned long builtLayout; // store layout version the row indices refer to
+    unsigned long builds; // build() calls, so derived per row data can tell when it is stale
+    unsigned long edits; // insert() and erase() calls
+    int slack; // free entries left after each row by build()
+    int gaps; // entries of removed rows, reclaimed by the next build()
+    std::vector<int> touched; // scratch for follow()
+
+    void swapRows(int a, int b); // exchanges two rows and the references to them
+
+public:
+    std::vector<int>    offsets; // row i spans [offsets[i], ends[i]) and may grow up to limits[i]
+    std::vector<int>    ends;
+    std::vector<int>    limits;
+    std::vector<int>    neighbour; // store index of the neighbour
+    std::vector<double> weight; // edge weight
+    std::vector<int>    confidence; // edge confidence
+
+    AgentAdjacency();
+
+    void build(AgentNetwork* network, const AgentStateStore& store);
+    void invalidate(){ valid = false; } // called whenever edges are added or removed other than by insert() and erase()
+    bool isCurrent(const AgentStateStore& store) const { return valid && builtLayout == store.layoutVersion(); }
+    void setSlack(int entries){ slack = entries; } // for the next build()
+
+    /* Incremental changes, for both ends of an edge; false when the row is full and the snapshot must be rebuilt */
+    bool insert(const AgentStateStore& store, int row, int other, double edgeWeight, int edgeConfidence);
+    bool erase(int row, int other);
+    bool follow(const AgentStateStore& store); // replays the store's row journal, false if it cannot be followed
+
+    unsigned long buildCount() const { return builds; }
+    unsigned long editCount() const { return edits; }
+    int rows() const { return (int)ends.size(); }
+    int edges() const { return (int)neighbour.size(); } // entries, the free ones included
+    int begin(int row) const { return offsets[row]; }
+    int end(int row) const { return ends[row]; }
+    long degreeSum(int first, int last) const; // neighbours of rows [first, last), summed
+
+};
+
+#endif
@@ -7,40 +7,36 @@
 #include "repast_hpc/SharedContext.h"
 #include "repast_hpc/SharedNetwork.h"
 #include "Network.h"
+#include "AgentStore.h"
+#include "Adjacency.h"
+#include "CounterRandom.h"
+#include "SlabPool.h"
 #include "repast_hpc/initialize_random.h"
 
 /* Agents */
+// Thin handle onto a row of the AgentStateStore; the agent state itself lives in the store's columns.
 class RepastHPCAgent
 {
 
+    friend class AgentStateStore; // the store keeps index_ up to date when rows move
+
 private:
     repast::AgentId id_;
-    double c;
-    double total;
-    
-    int age; // Age of the agent expressed as an integer
-    double commuteDist; // Distance agent must commute to work
-    double socNorm; // The societal normality of cycling as perceived by the agent
-    string region; // The region in which the agent resides. Four regions are modelled.
-
-    double des_age; // The desire to cycle based on the age of the agent
-    double des_commuteDist; // The desire to cycle based on the distance of commute
-    double des_socNorm; // The desire to cycle based on the cycle state of agents neighbours
-    double des_region; // The desire to cycle based on the region the agent
-    double des_popHealth; // The desire to cycle based on the health of the populous in which the agent resides. Value between 0 and 1
-    double des_popSafety; // The desire to cycle based on the safety of cycling as perceived as the populous. Value between 0 and 1
-
-    bool cycles; // Agent binary state output - whether agent cycles
-    
+    AgentStateStore* store_; // columnar store holding this agent's state
+    int index_; // row of this agent in store_
 
 public:
     // Agent constructors
-    RepastHPCAgent(repast::AgentId id);
-    RepastHPCAgent(){}
-    RepastHPCAgent(repast::AgentId id, double newC, double newTotal);
+    RepastHPCAgent(repast::AgentId id, AgentStateStore* store);
+    RepastHPCAgent(): store_(0), index_(-1){}
+    RepastHPCAgent(repast::AgentId id, AgentStateStore* store, double newC, double newTotal);
 
     ~RepastHPCAgent(); //agent destructor
 
+    /* Handles come from a slab pool, see SlabPool::trimAll() */
+    static void* operator new(size_t size);
+    static void operator delete(void* block, size_t size);
+
     /* Required Getters */
     virtual repast::AgentId& getId()
     {
@@ -51,41 +47,52 @@ public:
         return id_;
     }
 
+    int getStoreIndex() const
+    {
+        return index_;
+    }
+
     /* Agent state variable getters  */
     double getC()
     {
-        return c;
+        return store_->c[index_];
     }
     double getTotal()
     {
-        return total;
+        return store_->total[index_];
     }
     int getAge()
     {
-        return age;
+        return store_->age[index_];
     }
     double getcommuteDist()
     {
-         return commuteDist;
+         return store_->commuteDist[index_];
     }
     double getSocNorm()
     {
-         return socNorm;
+         return store_->socNorm[index_];
+    }
+    int getRegionId()
+    {
+         return store_->regionId[index_];
     }
     string getRegion()
     {
-         return region;
+         return store_->regionName(store_->regionId[index_]);
+    }
+    bool getCycles()
+    {
+         return store_->cycles[index_] != 0;
     }
 
     /* Setter */
     void set(int currentRank, double newC, double newTotal);
+    void initAgent(int newAge, double newCommuteDist, double newSocNorm, int newRegionId, bool newCycles); // sets the initial state variable values
 
     /* Actions */
-    bool cooperate(); // Will indicate whether the agent cooperates or not; probability determined by = c / total
-    void play(repast::SharedNetwork<RepastHPCAgent,
-              ModelCustomEdge<RepastHPCAgent>,
-              ModelCustomEdgeContent<RepastHPCAgent>,
-              ModelCustomEdgeContentManager<RepastHPCAgent> > *network);
+    bool cooperate(double draw); // Will indicate whether the agent cooperates or not given a uniform draw; probability determined by = c / total
+    void play(const AgentAdjacency& adjacency, const CounterRandom& random, long tick, std::vector<double>& draws); // plays every neighbour in this agent's adjacency row into the next buffers, draws is scratch space
 
 };
 
@@ -100,6 +107,11 @@ public:
     int    currentRank;
     double c;
     double total;
+    int    age;
+    double commuteDist;
+    double socNorm;
+    int    regionId;
+    bool   cycles;
 
     /* Constructors */
     RepastHPCAgentPackage(); // For serialization
@@ -115,6 +127,11 @@ public:
         ar & currentRank;
         ar & c;
         ar & total;
+        ar & age;
+        ar & commuteDist;
+        ar & socNorm;
+        ar & regionId;
+        ar & cycles;
     }
 
 };
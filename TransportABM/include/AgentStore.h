@@ -0,0 +1,100 @@
+/* AgentStore.h */
+
+#ifndef AGENTSTORE
+#define AGENTSTORE
+
+#include <string>
+#include <vector>
+#include "Aggregates.h"
+
+class RepastHPCAgent;
+
+/* Columnar Agent State Store */
+// Holds the state of every agent in the context as contiguous columns indexed by a dense store index.
+// Local agents are kept in [0, localCount()) and non-local (imported) agents in [localCount(), size()),
+// so per tick sweeps stream over the local range only. RepastHPCAgent objects are thin handles onto a row.
+class AgentStateStore
+{
+
+public:
+    /* A row change recorded while the journal is on, so cached row indices can follow it instead of being rebuilt */
+    struct RowMove
+    {
+        enum Kind { ADDED, SWAPPED, REMOVED };
+        int kind;
+        int a; // the row added or removed, or the first of the two swapped
+        int b; // the second swapped row
+    };
+
+private:
+    int rank; // process rank, an agent is local when its current rank matches
+    int localAgents; // number of local agents held at the front of the columns
+    unsigned long layout; // incremented whenever rows are added, removed or moved so cached indices can be refreshed
+    std::vector<std::string> regionNames; // interned region names, position is the region id
+    std::vector<RowMove> journal; // row changes since startJournal()
+    bool journaling; // false until startJournal(), and once the journal overflows or rows are permuted
+    size_t journalLimit;
+    unsigned long journalLayout; // layout and local count when the journal started
+    int journalLocal;
+
+    void record(int kind, int a, int b);
+
+    void pushRow(RepastHPCAgent* agent);
+    void popRow();
+    void swapRows(int a, int b); // swaps two rows and updates the handles that point at them
+
+public:
+    std::vector<RepastHPCAgent*> owner; // handle that currently owns each row
+
+    std::vector<double> c;
+    std::vector<double> total;
+    std::vector<double> cNext; // c and total written during a tick, so neighbour reads within the tick are race free
+    std::vector<double> totalNext;
+
+    std::vector<int>    age; // Age of the agent expressed as an integer
+    std::vector<double> commuteDist; // Distance agent must commute to work
+    std::vector<double> socNorm; // The societal normality of cycling as perceived by the agent
+    std::vector<int>    regionId; // Interned id of the region in which the agent resides, -1 when unset
+
+    std::vector<double> des_age; // The desire to cycle based on the age of the agent
+    std::vector<double> des_commuteDist; // The desire to cycle based on the distance of commute
+    std::vector<double> des_socNorm; // The desire to cycle based on the cycle state of agents neighbours
+    std::vector<double> des_region; // The desire to cycle based on the region the agent
+    std::vector<double> des_popHealth; // The desire to cycle based on the health of the populous. Value between 0 and 1
+    std::vector<double> des_popSafety; // The desire to cycle based on the perceived safety of cycling. Value between 0 and 1
+
+    std::vector<unsigned char> cycles; // Agent binary state output - whether agent cycles
+
+    AgentAggregates aggregates; // observables over the local rows, kept current as rows and their state change
+
+    AgentStateStore(int processRank);
+
+    int allocate(RepastHPCAgent* agent, bool local); // adds a row for the agent and returns its index
+    void release(int index); // removes a row, the last row of the same partition is moved into its place
+    void setLocal(int index, bool local); // moves a row between the local and non-local partitions
+    void refreshLocality(); // re-partitions every row from its owner's current rank, used after agent migration
+    void permute(const std::vector<int>& order); // row r takes old row order[r]; local rows must stay in front
+    void commitLocal(int first, int last, int worker = 0); // copies the next buffers of local rows [first, last) into the current state
+
+    int getRank() const { return rank; }
+    int localCount() const { return localAgents; }
+    int size() const { return (int)owner.size(); }
+    bool isLocal(int index) const { return index < localAgents; }
+    unsigned long layoutVersion() const { return layout; }
+    void reserve(size_t rows);
+
+    /* Row journal */
+    void startJournal(size_t limit); // records row changes from now on, giving up after limit of them
+    bool journalComplete() const { return journaling; } // every change since startJournal() is in the journal
+    unsigned long journalStart() const { return journalLayout; }
+    int journalLocalCount() const { return journalLocal; }
+    const std::vector<RowMove>& rowJournal() const { return journal; }
+
+    /* Region interning */
+    int internRegion(const std::string& name); // returns the id of the region, adding it if new
+    const std::string& regionName(int id) const;
+    int regionCount() const { return (int)regionNames.size(); }
+
+};
+
+#endif
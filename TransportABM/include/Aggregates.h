@@ -0,0 +1,109 @@
+/* Aggregates.h */
+
+#ifndef AGGREGATES
+#define AGGREGATES
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+class AgentStateStore;
+
+/* Running sum with Neumaier compensation, so adding and removing many small deltas does not drift */
+class CompensatedSum
+{
+
+private:
+    double sum;
+    double compensation; // low order bits lost by sum
+
+public:
+    CompensatedSum(): sum(0), compensation(0){ }
+    CompensatedSum(double s, double c): sum(s), compensation(c){ }
+
+    void add(double value);
+    void add(const CompensatedSum& other);
+    double value() const { return sum + compensation; }
+    double sumPart() const { return sum; } // the two parts, for checkpoints
+    double compensationPart() const { return compensation; }
+
+};
+
+/* Contribution of a set of local agents to the observables */
+struct AggregatePartial
+{
+    CompensatedSum c;
+    CompensatedSum total;
+    boost::int64_t agents;
+    boost::int64_t cyclists;
+    std::vector<boost::int64_t> regionAgents; // slot 0 for agents without a region, region r at r + 1
+    std::vector<boost::int64_t> regionCyclists;
+    std::vector<boost::int64_t> bandAgents;
+    std::vector<boost::int64_t> bandCyclists;
+    char padding[64]; // partials of different workers do not share a cache line
+
+    AggregatePartial(): agents(0), cyclists(0){ }
+};
+
+/* Incrementally Maintained Observables */
+// Sums of c and total, agent and cyclist counts, and their breakdown by region and age band over the local agents.
+// The store adds and removes a row's contribution as rows enter or leave the local partition, and writers of local
+// state bracket their writes with remove() and add(). Updates made during a parallel sweep go to the partial of the
+// worker making them; settle() folds the partials into the totals, so reading an observable never scans the agents.
+class AgentAggregates
+{
+
+private:
+    AggregatePartial totals;
+    std::vector<AggregatePartial> pending; // per worker changes not yet folded into totals
+    int bandWidth; // years per age band
+    int bands; // the last band is open ended
+
+    static void grow(std::vector<boost::int64_t>& counts, size_t slot);
+    static boost::int64_t count(const std::vector<boost::int64_t>& counts, size_t slot);
+    void countAgent(AggregatePartial& partial, int age, int region, int agents, int cyclists) const;
+
+public:
+    AgentAggregates();
+
+    void configure(int ageBandWidth, int ageBands, int workers); // call before agents are added, or rebuild() afterwards
+    void rebuild(const AgentStateStore& store); // recounts every local row, e.g. after a restart
+
+    /* Row contributions; rows that are not local are ignored */
+    void add(const AgentStateStore& store, int row, int worker = 0);
+    void remove(const AgentStateStore& store, int row, int worker = 0);
+
+    /* Changes from parallel sweeps over local rows */
+    void stateChanged(int worker, double oldC, double newC, double oldTotal, double newTotal)
+    {
+        AggregatePartial& partial = pending[worker];
+        partial.c.add(newC);
+        partial.c.add(-oldC);
+        partial.total.add(newTotal);
+        partial.total.add(-oldTotal);
+    }
+    void cyclesChanged(int worker, int age, int region, int change) // change is +1 or -1
+    {
+        countAgent(pending[worker], age, region, 0, change);
+    }
+
+    void settle(); // folds the per worker changes into the totals, not while a sweep is running
+    const AggregatePartial& settled() const { return totals; } // as of the last settle(), for checkpoints
+    void restore(const AggregatePartial& saved); // replaces the totals, dropping unsettled changes
+
+    /* Observables, current as of the last settle() */
+    double sumC() const { return totals.c.value(); }
+    double sumTotal() const { return totals.total.value(); }
+    boost::int64_t agents() const { return totals.agents; }
+    boost::int64_t cyclists() const { return totals.cyclists; }
+    boost::int64_t regionAgents(int region) const { return count(totals.regionAgents, region + 1); } // region -1 for agents without one
+    boost::int64_t regionCyclists(int region) const { return count(totals.regionCyclists, region + 1); }
+    boost::int64_t bandAgents(int band) const { return count(totals.bandAgents, band); }
+    boost::int64_t bandCyclists(int band) const { return count(totals.bandCyclists, band); }
+
+    int ageBand(int age) const;
+    int bandCount() const { return bands; }
+    int bandFirstAge(int band) const { return band * bandWidth; }
+
+};
+
+#endif
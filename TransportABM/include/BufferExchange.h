@@ -0,0 +1,49 @@
+/* BufferExchange.h */
+
+#ifndef BUFFEREXCHANGE
+#define BUFFEREXCHANGE
+
+#include <vector>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+
+/* Sparse Buffer Exchange */
+// Ships send[r] to rank r for every rank with something to send and fills receive[r] with what rank r sent.
+// Message sizes are agreed with one all_to_all of counts; the payloads then go point to point, so ranks that
+// share nothing exchange nothing. Records are fixed layout structs appended and read back with memcpy.
+void exchangeBuffers(boost::mpi::communicator& comm, const std::vector<std::vector<char> >& send, std::vector<std::vector<char> >& receive, int tag);
+
+/* Point to point messages and payload bytes this rank has sent through the model's own exchanges */
+struct ExchangeTraffic
+{
+    boost::uint64_t messages;
+    boost::uint64_t bytes;
+};
+
+const ExchangeTraffic& exchangeTraffic();
+void countMessage(size_t bytes); // for exchanges that send without exchangeBuffers
+
+template<typename Record>
+void appendRecord(std::vector<char>& buffer, const Record& record)
+{
+    size_t at = buffer.size();
+    buffer.resize(at + sizeof(Record));
+    std::memcpy(&buffer[at], &record, sizeof(Record));
+}
+
+template<typename Record>
+size_t recordCount(const std::vector<char>& buffer)
+{
+    return buffer.size() / sizeof(Record);
+}
+
+template<typename Record>
+Record readRecord(const std::vector<char>& buffer, size_t index)
+{
+    Record record;
+    std::memcpy(&record, &buffer[index * sizeof(Record)], sizeof(Record));
+    return record;
+}
+
+#endif
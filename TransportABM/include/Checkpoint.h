@@ -0,0 +1,99 @@
+/* Checkpoint.h */
+
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include "AgentStore.h"
+#include "Adjacency.h"
+
+/* Per rank checkpoint layout: header, region name table, agent records (local rows first), edges, aggregates */
+struct CheckpointHeader
+{
+    char            magic[8]; // "TABMCKP1"
+    boost::uint32_t version;
+    boost::uint32_t rank;
+    boost::uint32_t worldSize; // a checkpoint can only be restarted on the same number of ranks
+    boost::uint32_t seed; // random.seed of the run, the counter based streams need nothing else
+    double          tick; // last tick whose update is contained in the checkpoint
+    boost::uint64_t localRows;
+    boost::uint64_t ghostRows; // ghost registrations, re-requested from their owners on restart
+    boost::uint64_t edgeCount;
+    boost::uint32_t regionCount;
+    boost::uint32_t regionSlots; // per region aggregate slots
+    boost::uint32_t bandSlots; // per age band aggregate slots
+    boost::uint32_t padding;
+    boost::uint64_t regionTableOffset; // regionCount names of REGION_NAME_LENGTH bytes, zero padded
+    boost::uint64_t agentsOffset; // localRows + ghostRows CheckpointAgents
+    boost::uint64_t edgesOffset; // edgeCount CheckpointEdges
+    boost::uint64_t aggregatesOffset; // CheckpointAggregates, then (agents, cyclists) per region slot and per band slot
+};
+
+struct CheckpointAgent
+{
+    boost::int32_t  id;
+    boost::int32_t  startingRank;
+    boost::int32_t  type;
+    boost::int32_t  currentRank;
+    double          c;
+    double          total;
+    double          commuteDist;
+    double          socNorm;
+    boost::int32_t  age;
+    boost::int32_t  regionId;
+    boost::uint8_t  cycles;
+    boost::uint8_t  padding[7];
+};
+
+struct CheckpointEdge
+{
+    boost::int32_t  source; // positions in the agent records
+    boost::int32_t  target;
+    double          weight;
+    boost::int32_t  confidence;
+    boost::int32_t  padding;
+};
+
+struct CheckpointAggregates
+{
+    double          cSum; // both parts of the compensated sums, so they continue exactly
+    double          cCompensation;
+    double          totalSum;
+    double          totalCompensation;
+    boost::int64_t  agents;
+    boost::int64_t  cyclists;
+};
+
+/* Memory Mapped Checkpoint */
+// One file per rank holding everything a run needs to continue: the local agents, the ids of the ghosts this rank
+// had registered, every agentNetwork edge this rank held with its weight and confidence, and the settled aggregates.
+// Per agent random numbers are keyed by (seed, tick), so the seed and the tick are the whole random state.
+class CheckpointFile
+{
+
+private:
+    int fd;
+    size_t length;
+    const char* base; // start of the mapping
+    const CheckpointHeader* header;
+
+public:
+    static const int REGION_NAME_LENGTH = 32;
+
+    CheckpointFile(const std::string& path); // throws std::runtime_error if the file cannot be mapped or is not a checkpoint
+    ~CheckpointFile();
+
+    const CheckpointHeader& getHeader() const { return *header; }
+    std::string regionName(int region) const;
+    const CheckpointAgent* agents() const { return (const CheckpointAgent*)(base + header->agentsOffset); }
+    const CheckpointEdge* edges() const { return (const CheckpointEdge*)(base + header->edgesOffset); }
+    void aggregates(AggregatePartial& saved) const;
+
+    /* Writes the checkpoint of one rank; the store's aggregates must be settled and the adjacency current */
+    static void write(const std::string& path, int rank, int worldSize, boost::uint32_t seed, double tick,
+                      const AgentStateStore& store, const AgentAdjacency& adjacency);
+
+};
+
+#endif
@@ -0,0 +1,38 @@
+/* CounterRandom.h */
+
+#ifndef COUNTERRANDOM
+#define COUNTERRANDOM
+
+#include <boost/cstdint.hpp>
+#include "repast_hpc/AgentId.h"
+
+/* Counter Based Random Streams */
+// Philox4x32-10 generator. Every draw is a pure function of (seed, stream, agent id, tick, draw index), so agents
+// can draw in any order and on any thread or process and still see exactly the same numbers. Streams separate
+// independent uses (playing, decisions, network generation) that would otherwise share counters.
+class CounterRandom
+{
+
+private:
+    boost::uint32_t seed;
+    boost::uint32_t stream;
+
+public:
+    enum Stream { PLAY_STREAM = 1, DECISION_STREAM = 2, NETWORK_STREAM = 3, ENSEMBLE_STREAM = 4, REWIRE_STREAM = 5 };
+
+    CounterRandom(): seed(0), stream(0){}
+    CounterRandom(boost::uint32_t seed, boost::uint32_t stream): seed(seed), stream(stream){}
+
+    /* Raw block: four 32 bit words for counter (c0, c1, c2, c3) */
+    void block(boost::uint32_t c0, boost::uint32_t c1, boost::uint32_t c2, boost::uint32_t c3, boost::uint32_t out[4]) const;
+
+    /* Uniform doubles in [0, 1) */
+    double uniform(const repast::AgentId& id, long tick, boost::uint32_t draw) const;
+    void fill(const repast::AgentId& id, long tick, boost::uint32_t firstDraw, double* out, int count) const; // draws firstDraw .. firstDraw + count - 1
+    double uniform(boost::uint32_t a, boost::uint32_t b, boost::uint32_t c, boost::uint32_t draw) const; // for keys that are not agents
+
+    boost::uint32_t getSeed() const { return seed; }
+
+};
+
+#endif
@@ -0,0 +1,65 @@
+/* DesireKernel.h */
+
+#ifndef DESIREKERNEL
+#define DESIREKERNEL
+
+#include <vector>
+#include "AgentStore.h"
+#include "Adjacency.h"
+
+/* Weights and scales of the cycling decision, read from model.props */
+struct DesireWeights
+{
+    double age; // weight of each desire term in the cycling utility
+    double commuteDist;
+    double socNorm;
+    double region;
+    double popHealth;
+    double popSafety;
+
+    double ageScale; // des_age = max(0, 1 - age / ageScale)
+    double distanceScale; // des_commuteDist = 1 / (1 + commuteDist / distanceScale)
+    double threshold; // an agent cycles when its utility reaches the threshold
+
+    double populationHealth; // population level inputs, values between 0 and 1
+    double populationSafety;
+
+    double regionNorm; // mean field: share of socNorm taken from the cycling share of the agent's region, 0 for edges only
+
+    DesireWeights();
+};
+
+/* Cycling Desire And Decision Kernel */
+// Evaluates the desire terms and the resulting cycles decision for a block of consecutive store rows at a time,
+// straight from the store columns. Blocks of 8 (AVX-512) or 4 (AVX2) rows are evaluated in vector registers when
+// the build targets those instruction sets, and the remainder, or everything on other targets, in scalar code.
+class DesireKernel
+{
+
+private:
+    DesireWeights weights;
+    std::vector<double> regionDesire; // des_region per region, slot 0 for agents without a region, region r at r + 1
+    std::vector<double> regionShare; // mean field: cycling share of every region over all ranks, slots as regionDesire
+    std::vector<std::vector<int> >* flipLog; // per worker rows whose cycles flipped, 0 when nobody listens
+
+    void evaluateScalar(AgentStateStore& store, int first, int last, int worker) const;
+    void decide(AgentStateStore& store, int row, bool cycles, int worker) const; // writes the decision and records flips in the aggregates and flipLog
+
+public:
+    DesireKernel();
+
+    void setWeights(const DesireWeights& w){ weights = w; }
+    const DesireWeights& getWeights() const { return weights; }
+    void setRegionDesire(const std::vector<double>& desire, double unset); // desire[r] for region id r
+    void setFlipLog(std::vector<std::vector<int> >* log){ flipLog = log; } // one vector per worker
+    void setMeanField(const std::vector<double>& share, double health, double safety); // share per region slot and the population inputs, once per tick
+
+    void updateSocialNorms(const AgentAdjacency& adjacency, AgentStateStore& store, int first, int last) const; // weighted share of neighbours that cycle, blended with the region's share
+    void evaluate(AgentStateStore& store, int first, int last, int worker = 0) const; // des_* and cycles for rows [first, last)
+    void evaluateRows(AgentStateStore& store, const int* rows, int count, int worker = 0) const; // the same for a scattered list of rows
+
+    static const char* instructionSet(); // the vector path compiled in, for the run log
+
+};
+
+#endif
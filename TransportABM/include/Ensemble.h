@@ -0,0 +1,60 @@
+/* Ensemble.h */
+
+#ifndef ENSEMBLE
+#define ENSEMBLE
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+#include "repast_hpc/Properties.h"
+#include "NetworkGenerator.h"
+
+/* One model run of an ensemble: a point of the parameter sweep and a seed */
+struct Replicate
+{
+    int index;
+    int point; // position in the sweep, replicates of the same point differ only in their seed
+    boost::uint32_t seed;
+    std::vector<std::pair<std::string, std::string> > parameters; // swept properties and their values at this point
+};
+
+/* Ensemble Runner */
+// Runs every replicate of a sweep from one launch. The world is split into ensemble.groups sub-communicators that
+// work through the replicates concurrently, each running its share one after another with a fresh RepastProcess on
+// the group communicator, so props are read and MPI is started once. A group keeps the networks it generates in a
+// NetworkCache: with ensemble.shared.network the network seed is fixed, and replicates whose network parameters
+// match build the topology once. Population files are memory mapped and shared through the page cache. Every
+// replicate writes binary output into ensemble.parts; rank 0 then merges them into the single csv ensemble.output.
+class EnsembleRunner
+{
+
+private:
+    boost::mpi::communicator& world;
+    boost::mpi::communicator group; // the ranks running one replicate together
+    int groups;
+    int groupIndex;
+    std::vector<int> groupSizes;
+    boost::uint32_t baseSeed; // ensemble.seed, or random.seed
+    std::string configFile;
+    std::string propsFile;
+    repast::Properties* props;
+    std::vector<std::string> arguments; // key=value arguments of the launch, given to every replicate before the ensemble's own
+    std::vector<Replicate> replicates;
+    NetworkCache networks;
+
+    std::string property(const std::string& key, const std::string& fallback) const;
+    void planReplicates();
+    std::string partPath(int replicate) const; // output prefix of one replicate
+    void runReplicate(const Replicate& replicate);
+    void mergeOutput() const; // rank 0 of world only
+
+public:
+    EnsembleRunner(const std::string& configFile, const std::string& propsFile, int argc, char** argv, boost::mpi::communicator& world);
+    ~EnsembleRunner();
+
+    void run(); // collective over world
+
+};
+
+#endif
@@ -0,0 +1,44 @@
+/* ExpectedPlay.h */
+
+#ifndef EXPECTEDPLAY
+#define EXPECTEDPLAY
+
+#include <vector>
+#include "AgentStore.h"
+#include "Adjacency.h"
+
+/* Expected Payoff Engine */
+// Deterministic alternative to RepastHPCAgent::play() that adds the expected game payoffs instead of sampling two
+// draws per edge. With p the agent's cooperation probability c / total, q_k a neighbour's and a_k the edge's
+// coefficient weight * confidence^2, the payoff table of play() gives
+//     cPayoff     = p * (A + 6 Q)
+//     totalPayoff = cPayoff + (1 - p) * (3 A + 7 Q),    A = sum a_k, Q = sum a_k q_k
+// so a tick is one sparse matrix-vector product Q = C q over the adjacency. The coefficients and A are computed once
+// per adjacency build; q is taken from the current state of every row, ghosts included, at the start of the tick.
+// Rows are reduced 8 (AVX-512) or 4 (AVX2) neighbours at a time with gathers when the build targets those
+// instruction sets, and in scalar code otherwise.
+class ExpectedPlay
+{
+
+private:
+    std::vector<double> coefficient; // per adjacency entry
+    std::vector<double> rowWeight; // A per row
+    std::vector<double> probability; // q per store row
+    unsigned long builtFor; // adjacency build the coefficients refer to
+    bool built;
+
+    double neighbourSum(const AgentAdjacency& adjacency, int row) const; // Q of a row
+
+public:
+    ExpectedPlay();
+
+    void refresh(const AgentAdjacency& adjacency, const AgentStateStore& store); // from the main thread each tick, recomputes the coefficients after the snapshot changes
+    void refreshRows(const AgentAdjacency& adjacency, const std::vector<int>& rows); // after edges of the rows were inserted or erased
+    void updateProbabilities(const AgentStateStore& store, int first, int last); // q of rows [first, last), after refresh() and before any row plays
+    void play(const AgentAdjacency& adjacency, AgentStateStore& store, const int* rows, int count) const; // writes the next buffers of the rows
+
+    static const char* instructionSet();
+
+};
+
+#endif
@@ -0,0 +1,91 @@
+/* GhostExchange.h */
+
+#ifndef GHOSTEXCHANGE
+#define GHOSTEXCHANGE
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+#include "repast_hpc/AgentId.h"
+#include "repast_hpc/SharedContext.h"
+#include "AgentStore.h"
+
+class RepastHPCAgent;
+
+/* Flat state record for one ghosted agent, copied to and from the wire with memcpy */
+struct GhostStateRecord
+{
+    boost::uint32_t slot; // position of the agent in the registration agreed with the receiving rank
+    boost::int32_t  regionId;
+    double c;
+    double total;
+    double socNorm;
+    boost::uint8_t  cycles;
+    boost::uint8_t  padding[7];
+};
+
+/* Delta Encoded Ghost State Exchange */
+// Replaces synchronizeAgentStates for per tick updates. When the ghost set changes, every rank sends the owners
+// of its non-local agents the (id, rank, type) keys once; both sides then refer to an agent by its slot in that
+// list. Each exchange ships only the agents whose exported state changed since they were last sent to that rank,
+// as GhostStateRecords in a single message per neighbouring rank. beginExchange() packs and posts the messages
+// without waiting and finishExchange() applies what arrived, so a tick can update agents that read no ghost in
+// between. Exports are packed from the next buffers: the state play() produced, before or after it is committed.
+// When only a few ghosts come and go, registerChanges() ships just the added and cancelled keys: both sides drop
+// the cancelled slots, keeping the order of the rest, and append the new ones, so surviving slots keep their delta
+// state and are not sent again.
+class GhostExchange
+{
+
+private:
+    struct Peer // registrations shared with one other rank
+    {
+        int rank;
+        std::vector<repast::AgentId> keys; // agreed order, slot i refers to keys[i]
+        std::vector<int> rows; // store row of each slot, refreshed when the store layout changes
+        std::vector<GhostStateRecord> lastSent; // exports only: state last shipped for each slot
+        std::vector<unsigned char> sent; // exports only: whether lastSent holds anything yet
+    };
+
+    boost::mpi::communicator* comm;
+    std::vector<Peer> exports; // ranks holding ghosts of our local agents
+    std::vector<Peer> imports; // ranks owning our ghosts
+    unsigned long resolvedLayout; // store layout version rows were resolved against
+    unsigned long registrations; // registerGhosts() calls and registerChanges() that changed the exports, so callers can tell
+    bool registered;
+    bool inFlight; // between beginExchange() and finishExchange()
+
+    std::vector<std::vector<char> > sendBuffers;
+    std::vector<std::vector<char> > receiveBuffers; // one per import peer, sized for every slot changing
+    std::vector<boost::mpi::request> sendRequests;
+    std::vector<boost::mpi::request> receiveRequests;
+    std::vector<int> changedCycles; // ghost rows whose cycles the last finishExchange() changed
+
+    unsigned long messages; // totals for reporting
+    unsigned long bytes;
+
+    void resolveRows(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store);
+    void packRecord(const AgentStateStore& store, int row, boost::uint32_t slot, GhostStateRecord& record) const;
+    bool applyChanges(std::vector<Peer>& peers, int peerRank, int ownerRank, const std::vector<char>& changes, bool exporting); // false if there were none
+
+public:
+    GhostExchange(boost::mpi::communicator* comm);
+
+    void registerGhosts(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store); // collective, call whenever the ghost set changes
+    void registerChanges(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store); // collective, the same by differences to the last registration
+    void beginExchange(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store); // posts the receives and sends the changed exports
+    void finishExchange(AgentStateStore& store); // waits for the owners' messages and applies them to the ghosts
+    void exchange(repast::SharedContext<RepastHPCAgent>& context, AgentStateStore& store){ beginExchange(context, store); finishExchange(store); }
+
+    void markExported(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store, std::vector<unsigned char>& flags); // flags[row] = 1 for every exported row
+    unsigned long registrationCount() const { return registrations; }
+    const std::vector<int>& cyclesChanged() const { return changedCycles; } // for the event driven norms
+
+    int exportCount() const;
+    int importCount() const;
+    unsigned long messageCount() const { return messages; }
+    unsigned long byteCount() const { return bytes; }
+
+};
+
+#endif
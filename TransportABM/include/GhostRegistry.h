@@ -0,0 +1,49 @@
+/* GhostRegistry.h */
+
+#ifndef GHOSTREGISTRY
+#define GHOSTREGISTRY
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include "repast_hpc/AgentId.h"
+#include "repast_hpc/AgentRequest.h"
+#include "AgentStore.h"
+#include "Adjacency.h"
+
+/* Edge Driven Ghost Registry */
+// Counts, for every remote agent, the cross-rank agentNetwork edges from this rank's local agents to it, which are
+// the only remote agents play() reads. An agent is imported while its count is positive: the first edge to it queues
+// a request and an imported agent no edge references any more queues a cancellation, so registrations change by
+// differences rather than being re-requested after every change to the edges or the partition.
+class GhostRegistry
+{
+
+private:
+    struct Entry
+    {
+        repast::AgentId id; // current rank is the owner requests are sent to
+        int edges;
+        bool imported;
+    };
+
+    typedef boost::unordered_map<boost::uint64_t, Entry> EntryMap;
+    EntryMap entries;
+
+public:
+    static boost::uint64_t key(const repast::AgentId& id);
+
+    /* Edges about to be added to or just removed from agentNetwork, by their remote endpoint */
+    void addEdge(const repast::AgentId& remote);
+    void removeEdge(const repast::AgentId& remote);
+
+    void rebuild(const AgentStateStore& store, const AgentAdjacency& adjacency); // recounts the imported agents from the ghost rows, after migration or a restart
+
+    int takeRequests(repast::AgentRequest& request); // adds the wanted agents not yet imported, which are then taken as imported
+    int takeCancellations(repast::AgentRequest& request); // adds the imported agents no edge references, which are forgotten
+
+    int importCount() const;
+    int edgeCount(const repast::AgentId& remote) const;
+
+};
+
+#endif
@@ -0,0 +1,47 @@
+/* GraphPartitioner.h */
+
+#ifndef GRAPHPARTITIONER
+#define GRAPHPARTITIONER
+
+#include <vector>
+
+/* Undirected graph in CSR form; every edge is listed from both endpoints */
+struct PartitionGraph
+{
+    std::vector<int> offsets; // vertex v spans [offsets[v], offsets[v + 1])
+    std::vector<int> adjacency;
+    std::vector<int> edgeWeights;
+    std::vector<int> vertexWeights;
+
+    int vertices() const { return offsets.empty() ? 0 : (int)offsets.size() - 1; }
+};
+
+/* Multilevel K-way Graph Partitioner */
+// Coarsens the graph by heavy edge matching, splits the coarsest graph into k parts of equal weight along a
+// breadth first ordering and then projects the partition back level by level, applying greedy boundary
+// refinement at each level to reduce the edge cut within the allowed imbalance.
+class GraphPartitioner
+{
+
+private:
+    int parts;
+    double imbalance; // allowed part weight above the mean, e.g. 0.03 for 3%
+    unsigned int seed; // fixes the matching order so every run partitions alike
+
+    void coarsen(const PartitionGraph& fine, PartitionGraph& coarse, std::vector<int>& coarseOf, int maxVertexWeight) const;
+    void initialPartition(const PartitionGraph& graph, std::vector<int>& part) const;
+    void refine(const PartitionGraph& graph, std::vector<int>& part, int passes) const;
+
+public:
+    GraphPartitioner(int parts, double imbalance, unsigned int seed);
+
+    std::vector<int> partition(const PartitionGraph& graph) const;
+
+    /* Quality measures */
+    static long edgeCut(const PartitionGraph& graph, const std::vector<int>& part); // total weight of edges between parts
+    static long ghostCount(const PartitionGraph& graph, const std::vector<int>& part, int parts); // distinct (vertex, foreign part) pairs
+    static double balance(const PartitionGraph& graph, const std::vector<int>& part, int parts); // heaviest part over the mean
+
+};
+
+#endif
@@ -0,0 +1,121 @@
+/* Instrumentation.h */
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+#if defined(TRANSPORT_INSTRUMENTATION) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h> // __rdtsc
+#endif
+#include "BufferExchange.h"
+
+/* Counter values at the start of a phase */
+struct PhaseCounters
+{
+    boost::uint64_t cycles;
+    boost::uint64_t messages;
+    boost::uint64_t bytes;
+};
+
+/* One timed phase on this rank */
+struct PhaseSample
+{
+    double          tick;
+    boost::uint64_t cycles;
+    boost::uint64_t bytes; // sent by this rank during the phase
+    boost::uint32_t messages;
+    boost::uint32_t phase;
+    boost::int32_t  agents; // local agents and ghosts at the end of the phase
+    boost::int32_t  ghosts;
+};
+
+#ifdef TRANSPORT_INSTRUMENTATION
+
+/* Tick Instrumentation */
+// Times phases with the cycle counter and records each one, with the messages and bytes this rank sent and its
+// agent and ghost counts, in a fixed size ring, so a long run keeps its most recent samples in constant memory.
+// Per phase totals cover the whole run. report() reduces them across ranks into min/mean/max per phase, and turns
+// the tick samples still in the ring into a load imbalance per tick: the busiest rank's time over the mean, where
+// busy excludes the wait phase, in which a rank only waits for the others.
+// Without TRANSPORT_INSTRUMENTATION the class is empty and every call compiles away.
+class TickInstrumentation
+{
+
+private:
+    std::vector<PhaseSample> ring;
+    boost::uint64_t recorded; // samples ever recorded, the next goes to recorded % ring.size()
+    std::vector<boost::uint64_t> phaseCycles; // whole run totals per phase
+    std::vector<boost::uint64_t> phaseCalls;
+    std::vector<boost::uint64_t> phaseMessages;
+    std::vector<boost::uint64_t> phaseBytes;
+    int tickPhase; // the phase spanning a whole tick
+    int waitPhase; // the phase inside a tick spent exchanging with other ranks
+    boost::uint64_t startCycles; // calibrates the counter against the wall clock
+    std::chrono::steady_clock::time_point startTime;
+
+    double secondsPerCycle() const;
+
+public:
+    TickInstrumentation();
+
+    void configure(int phases, int tickPhase, int waitPhase, size_t samples);
+
+    static boost::uint64_t cycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    PhaseCounters start() const
+    {
+        const ExchangeTraffic& traffic = exchangeTraffic();
+        PhaseCounters counters = { cycles(), traffic.messages, traffic.bytes };
+        return counters;
+    }
+
+    void finish(int phase, double tick, const PhaseCounters& start, int agents, int ghosts)
+    {
+        const ExchangeTraffic& traffic = exchangeTraffic();
+        PhaseSample& sample = ring[recorded % ring.size()];
+        sample.tick     = tick;
+        sample.cycles   = cycles() - start.cycles;
+        sample.bytes    = traffic.bytes - start.bytes;
+        sample.messages = (boost::uint32_t)(traffic.messages - start.messages);
+        sample.phase    = (boost::uint32_t)phase;
+        sample.agents   = agents;
+        sample.ghosts   = ghosts;
+        recorded++;
+        phaseCycles[phase]   += sample.cycles;
+        phaseCalls[phase]++;
+        phaseMessages[phase] += sample.messages;
+        phaseBytes[phase]    += sample.bytes;
+    }
+
+    /* Collective; rank 0 prints the phase table and, if path is not empty, writes the imbalance of each tick there as csv */
+    void report(boost::mpi::communicator& comm, const std::vector<std::string>& phaseNames, const std::string& path) const;
+
+};
+
+#else
+
+class TickInstrumentation
+{
+
+public:
+    void configure(int, int, int, size_t){ }
+    PhaseCounters start() const { PhaseCounters none = { 0, 0, 0 }; return none; }
+    void finish(int, double, const PhaseCounters&, int, int){ }
+    void report(boost::mpi::communicator&, const std::vector<std::string>&, const std::string&) const { }
+
+};
+
+#endif
+
+#endif
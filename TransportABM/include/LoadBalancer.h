@@ -0,0 +1,41 @@
+/* LoadBalancer.h */
+
+#ifndef LOADBALANCER
+#define LOADBALANCER
+
+#include <vector>
+
+/* Dynamic Load Balancer */
+// Decides, from the compute time every rank measured over the last interval, whether work should move and how
+// much from which rank to which. Loads are smoothed over intervals, a rebalance starts only when the heaviest rank
+// exceeds the mean by the threshold and then moves work until the heaviest ranks are back near the mean, and
+// after a rebalance the next cooldown checks are skipped, so noise and the measurement lag of a move cannot make
+// agents move back and forth. Work is counted in units, 1 + degree per agent, the cost of its play and decision.
+// Every rank is given the same inputs and so arrives at the same plan without further communication.
+class LoadBalancer
+{
+
+private:
+    double threshold; // heaviest over mean that starts a rebalance, e.g. 1.10
+    double target; // ranks above this over the mean shed work down to the mean, below threshold
+    double smoothing; // weight of the newest measurement in the smoothed load
+    double maxFraction; // most of a rank's units moved in one rebalance
+    int cooldown; // checks skipped after a rebalance
+    int waiting;
+    std::vector<double> smoothed; // seconds per tick of every rank
+
+public:
+    LoadBalancer(double threshold, double target, double smoothing, double maxFraction, int cooldown);
+
+    bool observe(const std::vector<double>& seconds); // smooths the new measurement in, true when a rebalance is due
+    double imbalance() const { return imbalanceOf(smoothed); }
+
+    /* transfer[source][destination] in units; predicted receives the expected seconds per tick after the moves */
+    std::vector<std::vector<double> > plan(const std::vector<double>& units, std::vector<double>& predicted);
+    void moved(const std::vector<double>& predicted); // starts the cooldown from the loads the moves should give
+
+    static double imbalanceOf(const std::vector<double>& seconds); // heaviest over the mean
+
+};
+
+#endif
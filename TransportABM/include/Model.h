@@ -3,6 +3,7 @@
 #ifndef MODEL
 #define MODEL
 
+#include <chrono>
 #include <boost/mpi.hpp> // include boost mpi wrapper
 #include "repast_hpc/Schedule.h"
 #include "repast_hpc/Properties.h"
@@ -10,10 +11,24 @@
 #include "repast_hpc/AgentRequest.h"
 #include "repast_hpc/TDataSource.h"
 #include "repast_hpc/SVDataSet.h"
+#include "repast_hpc/SVDataSetBuilder.h"
 #include "repast_hpc/SharedNetwork.h"
 
 #include "Network.h"
 #include "Agent.h"
+#include "ThreadPool.h"
+#include "GhostExchange.h"
+#include "GhostRegistry.h"
+#include "DesireKernel.h"
+#include "NormEngine.h"
+#include "ExpectedPlay.h"
+#include "OutputWriter.h"
+#include "Instrumentation.h"
+#include "Trace.h"
+#include "NetworkGenerator.h"
+#include "SlabPool.h"
+#include "LoadBalancer.h"
+#include "Rewiring.h"
 
 
 /* Agent Package Provider */
@@ -22,6 +37,7 @@ class RepastHPCAgentPackageProvider
 
     private:
         repast::SharedContext<RepastHPCAgent>* agents; // agent shared context object 'agents'
+        std::vector<std::pair<int, RepastHPCAgent*> > requested; // (store index, agent) so packages are read in store order, reused across requests
 
     public:
 
@@ -29,7 +45,7 @@ class RepastHPCAgentPackageProvider
 
         void providePackage(RepastHPCAgent * agent, std::vector<RepastHPCAgentPackage>& out);
 
-        void provideContent(repast::AgentRequest req, std::vector<RepastHPCAgentPackage>& out);
+        void provideContent(const repast::AgentRequest& req, std::vector<RepastHPCAgentPackage>& out);
 
 };
 
@@ -39,38 +55,100 @@ class RepastHPCAgentPackageReceiver
 
     private:
         repast::SharedContext<RepastHPCAgent>* agents;
+        AgentStateStore* store; // store that received agents are allocated into
 
     public:
 
-        RepastHPCAgentPackageReceiver(repast::SharedContext<RepastHPCAgent>* agentPtr);
+        RepastHPCAgentPackageReceiver(repast::SharedContext<RepastHPCAgent>* agentPtr, AgentStateStore* storePtr);
 
-        RepastHPCAgent * createAgent(RepastHPCAgentPackage package);
+        void applyPackage(RepastHPCAgent * agent, const RepastHPCAgentPackage& package); // copies the packaged attributes into the store
 
-        void updateAgent(RepastHPCAgentPackage package);
+        RepastHPCAgent * createAgent(const RepastHPCAgentPackage& package);
+
+        void updateAgent(const RepastHPCAgentPackage& package);
 
 };
 
 
 /* Data Collection */
-class DataSource_AgentTotals : public repast::TDataSource<int>
+// Each source reads an observable kept by the store's AgentAggregates, so a record costs the same for any number of agents.
+class DataSource_AgentTotals : public repast::TDataSource<double>
+{
+    private:
+        AgentStateStore* store;
+
+    public:
+        DataSource_AgentTotals(AgentStateStore* s);
+        double getData();
+};
+
+
+class DataSource_AgentCTotals : public repast::TDataSource<double>
 {
     private:
-        repast::SharedContext<RepastHPCAgent>* context;
+        AgentStateStore* store;
 
     public:
-        DataSource_AgentTotals(repast::SharedContext<RepastHPCAgent>* c);
-        int getData();
+        DataSource_AgentCTotals(AgentStateStore* s);
+        double getData();
 };
 
+class DataSource_Cyclists : public repast::TDataSource<boost::int64_t>
+{
+    private:
+        AgentStateStore* store;
+
+    public:
+        DataSource_Cyclists(AgentStateStore* s);
+        boost::int64_t getData();
+};
 
-class DataSource_AgentCTotals : public repast::TDataSource<int>
+class DataSource_RegionCyclists : public repast::TDataSource<boost::int64_t>
 {
     private:
-        repast::SharedContext<RepastHPCAgent>* context;
+        AgentStateStore* store;
+        int region;
 
     public:
-        DataSource_AgentCTotals(repast::SharedContext<RepastHPCAgent>* c);
-        int getData();
+        DataSource_RegionCyclists(AgentStateStore* s, int r);
+        boost::int64_t getData();
+};
+
+class DataSource_AgeBandCyclists : public repast::TDataSource<boost::int64_t>
+{
+    private:
+        AgentStateStore* store;
+        int band;
+
+    public:
+        DataSource_AgeBandCyclists(AgentStateStore* s, int b);
+        boost::int64_t getData();
+};
+
+/* Wall clock seconds spent in each phase on this rank, accumulated over the run */
+// REFRESH to TRACING are the parts of a TICK, and REQUEST (updateGhosts) is a part of the CONNECT, PLACE or BALANCE
+// event that runs it: like TICK, those rows include the time and allocations of their parts. The others are whole
+// scheduled events.
+struct PhaseTimes
+{
+    enum Phase { INIT, REQUEST, CONNECT, PLACE, RENUMBER, REFRESH, PLAY, COMMIT, EXCHANGE, NORMS, DESIRES, TRACING, TICK, RECORD, OUTPUT, REWIRE, BALANCE, SAVE, PHASE_COUNT };
+
+    double seconds[PHASE_COUNT];
+    boost::uint64_t allocations[PHASE_COUNT]; // slab pool allocations made during the phase
+    boost::uint64_t slabs[PHASE_COUNT]; // slabs the pools took from the system during the phase
+    long ticks; // doSomething() calls
+
+    PhaseTimes();
+    static const char* name(int phase);
+    void addAllocations(int phase, const PoolTraffic& since); // pool traffic from since until now
+};
+
+/* Start of the phase in progress inside a scheduled event */
+struct PhaseMark
+{
+    std::chrono::steady_clock::time_point time;
+    PhaseCounters counters;
+    PoolTraffic pool;
 };
 
 class RepastHPCModel
@@ -79,6 +157,7 @@ class RepastHPCModel
 	int countOfAgents; // holds the number of agents in the model
 
 	repast::Properties* props; //properties object
+	AgentStateStore agentStore; // columnar agent state, declared before the context so it outlives the agents
 	repast::SharedContext<RepastHPCAgent> context;
 
 	RepastHPCAgentPackageProvider* provider;
@@ -87,20 +166,110 @@ class RepastHPCModel
     	ModelCustomEdgeContentManager<RepastHPCAgent> edgeContentManager;
 
 	repast::SVDataSet* agentValues;
+	BinaryDataSet* binaryValues; // used instead of agentValues when output.format is binary
 	repast::SharedNetwork<RepastHPCAgent, ModelCustomEdge<RepastHPCAgent>, ModelCustomEdgeContent<RepastHPCAgent>, ModelCustomEdgeContentManager<RepastHPCAgent> >* agentNetwork;
+	AgentAdjacency adjacency; // CSR snapshot of agentNetwork read by play()
+	GhostExchange* ghostExchange; // per tick delta exchange of ghost agent state
+	GhostRegistry ghostRegistry; // the remote endpoints of cross-rank edges, which are all this rank imports
+	CounterRandom playRandom; // per agent random streams used by play()
+	ExpectedPlay expectedPlay; // expected payoffs as one sparse product per tick, used when expectedPayoffs
+	bool expectedPayoffs; // play.mode expected: the deterministic expected trajectory instead of sampled games
+	TickThreadPool* threadPool; // workers for the per agent update, sized by threads.per.rank
+	std::vector<std::vector<double> > playDraws; // scratch buffer for a single agent's draws, one per worker
+	std::vector<int> boundaryRows; // local rows with a ghost neighbour or ghosted elsewhere, played before the exchange starts
+	std::vector<int> interiorRows; // the other local rows, played while the exchange is in flight
+	unsigned long classifiedBuild; // adjacency build and ghost registration the rows were classified against
+	unsigned long classifiedRegistration;
+	std::vector<unsigned char> boundaryRow; // 1 for the rows in boundaryRows
+	bool classifiedStale; // an edge change gave an interior row a ghost neighbour
+	bool overlapExchange; // exchange.overlap: start the exchange between the boundary and interior play
+	bool meanField; // meanfield.enabled: region and population terms come from per region counts reduced once per tick
+	double populationHealth; // population.health and population.safety before the mean field moves them
+	double populationSafety;
+	double healthGain; // meanfield.health.gain: population health rises by this times the population's cycling share
+	double safetyGain;
+	std::vector<boost::int64_t> regionCounts; // agents then cyclists per region slot on this rank
+	std::vector<boost::int64_t> regionTotals; // the same over all ranks
+	DesireKernel desireKernel; // batch evaluation of the cycling desires and decision
+	NormEngine normEngine; // cached neighbour counts updated by the flips, used when incrementalNorms
+	bool incrementalNorms; // norms.mode incremental: only agents whose inputs changed are evaluated each tick
+
+	PhaseTimes phaseTimes; // read by the benchmark
+	TickInstrumentation instrumentation; // compiled out unless TRANSPORT_INSTRUMENTATION is defined
+	TraceWriter* trace; // binary agent trace, 0 unless trace.enabled
+	NetworkCache* networkCache; // generated networks kept across ensemble replicates, not owned
+	int traceEvery; // agents whose id is a multiple of this are traced
+	int traceInterval; // ticks between state samples
+	double resumeTick; // tick a restarted run continues after, 0 for a fresh run
+
+	std::vector<std::pair<repast::AgentId, int> > pendingMoves; // (agent, destination rank) migrated together by moveAgents()
+	LoadBalancer* loadBalancer; // 0 unless balance.interval is set
+	double balancedSeconds; // compute seconds and ticks at the last balance check
+	long balancedTicks;
+	bool balanceMoved; // the last check moved agents, so the next one reports the measured result
+	EdgeUpdateBatch* edgeUpdates; // edge changes queued during a tick, 0 unless rewire.enabled
+	CounterRandom rewireRandom; // draws of the built in rewiring
+	double rewireFraction; // rewire.fraction: share of edges each tick moved to a neighbour's neighbour
+	std::vector<int> rewiredRows; // local rows whose edges the last rewiring changed
+	long long edgesAdded; // totals for reporting
+	long long edgesRemoved;
+
+	int intProperty(const std::string& key, int fallback); // property value, or fallback when it is not set
+	double doubleProperty(const std::string& key, double fallback);
+	std::string stringProperty(const std::string& key, const std::string& fallback);
+
+	void createAgents(); // a fresh population, from population.file if set
+	void restoreCheckpoint(const std::string& path); // agents, ghosts, edges and aggregates of a saved run
+	std::string checkpointPath(const std::string& base); // this rank's checkpoint file
+	double firstEventTick(double start, double interval); // first occurrence of a repeating event that is still due after a restart
+	void buildDataSet(); // data collection columns, including one per region and age band
+	void addDataColumn(repast::SVDataSetBuilder* builder, const std::string& name, repast::TDataSource<double>* source); // to the binary data set if there is one, else to builder
+	void addDataColumn(repast::SVDataSetBuilder* builder, const std::string& name, repast::TDataSource<boost::int64_t>* source);
+	void loadDesireWeights(); // reads the desire.* properties into desireKernel once the regions are known
+	void generateAgentNetwork(const std::string& generator); // builds agentNetwork with one of the parallel generators
+	void dropCrossRegionEdges(const NetworkGenerator& network, const std::vector<RepastHPCAgent*>& localAgents, std::vector<NetworkEdge>& edges); // the mean field stands in for them
+	void updateMeanField(); // reduces the region counts and hands the shares to the desire kernel, inside a tick
+	bool traced(const repast::AgentId& id) const { return trace != 0 && id.id() % traceEvery == 0; }
+	void traceAgent(TraceEvent event, const repast::AgentId& id, int type); // from the main thread, with the agent's state if it is in the context
+	void importCandidates(); // the random construction's partners on other ranks: 5 agents from each
+	void refreshAdjacency(); // rebuilds the CSR snapshot if edges or the store layout changed
+	void selectMoves(const std::vector<double>& quota); // queues local agents worth quota[r] units for each rank r, those with neighbours there first
+	void proposeRewiring(); // queues rewire.fraction of the edges between local agents this rank decides, each replaced by one to a neighbour's neighbour;
+	                        // edges across ranks are never moved, so which edges can be rewired depends on the decomposition
+	void editAdjacency(RepastHPCAgent* source, RepastHPCAgent* target, const EdgeUpdate& update); // mirrors an applied change in the snapshot, or invalidates it
+	void classifyAgents(); // splits the local rows into boundaryRows and interiorRows after the snapshot or the ghosts change
+	repast::Schedule::FunctorPtr timed(int phase, repast::Functor* functor); // schedules functor with its time counted against phase
+	PhaseMark startPhase();
+	void endPhase(int phase, PhaseMark& mark); // inside an event: records the phase begun at mark, and begins the next
+	long currentTick(); // integer tick used to key the counter based random streams
 
 public:
 	RepastHPCModel(std::string propsFile, int argc, char** argv, boost::mpi::communicator* comm); // model constructor that takes properties file filename and an mpi communicator object
 	~RepastHPCModel(); // model destructor - necessary as instantiated objects on heap must be destroyed once used to prevent memory leakage.
 	void init(); // initialises model and populates with agents.
-	void requestAgents();
+	bool requestAgents(); // imports the remote endpoints of new cross-rank edges, true if any rank imported
     void connectAgentNetwork();
-	void cancelAgentRequests();
+	bool cancelAgentRequests(); // drops the ghosts no edge references any more, true if any rank dropped one
+	void updateGhosts(); // after edges change or agents migrate: cancels and requests the differences, then re-registers
 	void removeLocalAgents();
-	void moveAgents();
+	void moveAgents(); // migrates every queued move with a single synchronizeAgentStatus round
+	void placeAgents(); // partitions the agent network across ranks and migrates agents accordingly
+	void renumberAgents(); // reorders the store rows by renumber.order so neighbours are read from nearby memory
+	void balanceAgents(); // every balance.interval ticks: migrates agents from ranks whose measured compute time is above the mean
 	void doSomething(); //runs model dynamics
+	void addEdge(const repast::AgentId& source, const repast::AgentId& target, double weight, int confidence); // source local, target with its current rank; applied by rewireAgentNetwork()
+	void removeEdge(const repast::AgentId& source, const repast::AgentId& target);
+	void rewireAgentNetwork(); // every tick when rewire.enabled: applies the queued edge changes on both ranks of each edge
 	void initSchedule(repast::ScheduleRunner& runner); //enables model to initialise a schedule
 	void recordResults();
+	const PhaseTimes& getPhaseTimes() const { return phaseTimes; }
+	void setNetworkCache(NetworkCache* cache){ networkCache = cache; } // before init()
+	int getLocalAgentCount() const { return agentStore.localCount(); }
+	long getLocalEdgeEnds() const { return adjacency.rows() > 0 ? adjacency.degreeSum(0, agentStore.localCount()) : 0; } // neighbours of local agents, summed
+	void closeOutput(); // drains the binary writer and reports its backlog
+	void closeTrace(); // flushes the trace rings, an end event
+	void reportInstrumentation(); // reduces the per phase timings across ranks, an end event
+	void writeCheckpoint(); // saves this rank's state to checkpoint.file, scheduled every checkpoint.interval ticks
 };
 
 #endif
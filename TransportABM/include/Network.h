@@ -5,6 +5,7 @@
 
 #include "repast_hpc/SharedContext.h"
 #include "repast_hpc/SharedNetwork.h"
+#include "SlabPool.h"
 
 
 /* Custom Network Components */
@@ -28,6 +29,18 @@ public:
     int getConfidence(){ return confidence; }
     void setConfidence(int con){ confidence = con; }
 
+    // Edges received from other ranks are created with new; the model's own use allocate_shared with a SlabAllocator
+    static void* operator new(size_t size)
+    {
+        if(size != sizeof(ModelCustomEdge)) return ::operator new(size);
+        return SlabAllocator<ModelCustomEdge>::pool().allocate();
+    }
+    static void operator delete(void* block, size_t size)
+    {
+        if(size != sizeof(ModelCustomEdge)) ::operator delete(block);
+        else SlabAllocator<ModelCustomEdge>::pool().release(block);
+    }
+
 };
 
 /* Custom Edge Content */
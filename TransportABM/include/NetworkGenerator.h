@@ -0,0 +1,80 @@
+/* NetworkGenerator.h */
+
+#ifndef NETWORKGENERATOR
+#define NETWORKGENERATOR
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+#include "repast_hpc/AgentId.h"
+#include "CounterRandom.h"
+
+/* Generated edge between two global vertex numbers, flat so it can be shipped with memcpy */
+struct NetworkEdge
+{
+    boost::int64_t source;
+    boost::int64_t target;
+    double         weight;
+    boost::int32_t confidence;
+    boost::int32_t padding;
+};
+
+/* Parallel Network Generators */
+// Every rank generates the edges of its own vertices, with all randomness drawn from counter based streams keyed
+// by the vertex and edge slot, so the network depends only on the seed and parameters, not on the rank count.
+// Vertices are numbered globally in rank order: vertex g lives on the rank whose range holds it and is agent
+// (g - first vertex of that rank, rank, 0). distribute() then hands each cross-rank edge to both endpoint ranks.
+class NetworkGenerator
+{
+
+private:
+    boost::mpi::communicator* comm;
+    std::vector<boost::int64_t> firstVertex; // first global vertex of each rank, plus the total at the end
+    CounterRandom random;
+    double minWeight;
+    double maxWeight;
+    int maxConfidence;
+
+    NetworkEdge makeEdge(boost::int64_t source, boost::int64_t target, boost::uint32_t slot) const; // draws weight and confidence
+    double draw(boost::int64_t vertex, boost::uint32_t slot, boost::uint32_t index) const;
+    boost::int64_t scaleFreeTarget(boost::int64_t edge, int edgesPerVertex) const;
+
+public:
+    NetworkGenerator(boost::mpi::communicator* comm, int localVertices, const CounterRandom& random, double minWeight, double maxWeight, int maxConfidence);
+
+    /* Generators: append the edges generated by this rank's vertices */
+    void smallWorld(int neighbours, double rewire, std::vector<NetworkEdge>& edges) const; // Watts-Strogatz ring of 'neighbours' with rewiring probability
+    void scaleFree(int edgesPerVertex, std::vector<NetworkEdge>& edges) const; // Barabasi-Albert, resolved by the communication free copy model
+    void spatial(const std::vector<int>& localRegion, const std::vector<double>& localCommuteDist, int edgesPerVertex,
+                 double sameRegion, double distanceScale, std::vector<NetworkEdge>& edges) const; // region and commute distance based
+
+    void distribute(std::vector<NetworkEdge>& edges) const; // leaves every distinct edge incident to a local vertex, once
+
+    /* Numbering */
+    boost::int64_t vertexCount() const { return firstVertex.back(); }
+    boost::int64_t localFirst() const { return firstVertex[comm->rank()]; }
+    int owner(boost::int64_t vertex) const;
+    repast::AgentId agentId(boost::int64_t vertex) const;
+    boost::int64_t vertex(const repast::AgentId& id) const { return firstVertex[id.startingRank()] + id.id(); }
+
+};
+
+/* Distributed edges of the networks generated in this process, by generator, seed and parameters */
+// An ensemble runs replicates one after another on the same ranks; those that would generate an identical network
+// take this rank's edges from here instead of generating and distributing them again.
+class NetworkCache
+{
+
+private:
+    std::map<std::string, std::vector<NetworkEdge> > networks;
+
+public:
+    const std::vector<NetworkEdge>* find(const std::string& key) const;
+    void store(const std::string& key, const std::vector<NetworkEdge>& edges){ networks[key] = edges; }
+    size_t size() const { return networks.size(); }
+
+};
+
+#endif
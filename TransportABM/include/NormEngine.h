@@ -0,0 +1,63 @@
+/* NormEngine.h */
+
+#ifndef NORMENGINE
+#define NORMENGINE
+
+#include <vector>
+#include "AgentStore.h"
+#include "Adjacency.h"
+
+/* Event Driven Social Norms */
+// Keeps, for every local row, the weighted count of neighbours that cycle and the total neighbour weight. When a
+// local agent or a ghost flips cycles, the change is pushed along the flipped row's adjacency into the counts of
+// its local neighbours, and only those are marked dirty: their socNorm is recomputed from the counts and only they
+// have their desires and decision evaluated again, so a tick costs in proportion to the flips, not the population.
+// The counts are rebuilt from scratch when the adjacency snapshot changes, on every tick that is a multiple of the
+// resync interval, so rounding in the running sums cannot build up, and after a checkpoint. The last two keep a
+// restarted run, which starts from a fresh count, in step with the uninterrupted one.
+class NormEngine
+{
+
+private:
+    std::vector<double> cycling; // per local row
+    std::vector<double> weight; // per local row
+    std::vector<unsigned char> propagated; // per row, local and ghost: the cycles value the counts include
+    std::vector<unsigned char> dirty; // per local row
+    std::vector<int> dirtyRows;
+    std::vector<std::vector<int> > flips; // per worker, local rows whose decision flipped since the last propagate()
+    unsigned long builtFor; // adjacency build the counts refer to
+    int resyncInterval; // ticks, counts are rebuilt on every multiple of it
+    bool built;
+
+    unsigned long long evaluatedRows; // totals for reporting
+    unsigned long long localRows;
+
+    void push(const AgentAdjacency& adjacency, const AgentStateStore& store, int row);
+    void pushFlips(const AgentAdjacency& adjacency, const AgentStateStore& store); // the logged local flips
+
+public:
+    NormEngine();
+
+    void configure(int workers, int resync);
+    std::vector<std::vector<int> >* flipLog(){ return &flips; } // handed to the desire kernel
+
+    /* Call once per tick before the norms: rebuilds the counts if they are stale and returns true, then every row must be evaluated */
+    bool refresh(const AgentAdjacency& adjacency, AgentStateStore& store, long tick);
+    void invalidate(){ built = false; } // the next refresh() rebuilds, called when a checkpoint is written
+
+    /* Pushes the logged local flips and the given ghost rows, then recomputes socNorm of the rows whose counts changed */
+    void propagate(const AgentAdjacency& adjacency, AgentStateStore& store, const std::vector<int>& changedGhosts);
+
+    /* After edges were inserted or erased: recounts the given local rows and takes the ghost rows as they are now */
+    void edgesChanged(const AgentAdjacency& adjacency, const AgentStateStore& store, const std::vector<int>& rows);
+
+    const std::vector<int>& dirtyList() const { return dirtyRows; } // rows to evaluate this tick, after propagate()
+    void clearDirty(); // once they are evaluated
+
+    void countTick(int evaluated, int local){ evaluatedRows += evaluated; localRows += local; }
+    unsigned long long evaluatedCount() const { return evaluatedRows; }
+    unsigned long long localCount() const { return localRows; }
+
+};
+
+#endif
@@ -0,0 +1,150 @@
+/* OutputWriter.h */
+
+#ifndef OUTPUTWRITER
+#define OUTPUTWRITER
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <boost/cstdint.hpp>
+#include "repast_hpc/TDataSource.h"
+
+/* Binary output layout: file header, column descriptors, then blocks of rows stored column by column */
+struct OutputFileHeader
+{
+    char            magic[8]; // "TABMOUT1"
+    boost::uint32_t version;
+    boost::uint32_t rank; // each rank writes its own file, the export tool sums them
+    boost::uint32_t worldSize;
+    boost::uint32_t columns; // data columns, not counting the leading tick column
+};
+
+struct OutputColumn
+{
+    char            name[48]; // zero padded
+    boost::uint32_t type; // OUTPUT_DOUBLE or OUTPUT_INT64
+    boost::uint32_t padding;
+};
+
+struct OutputBlockHeader
+{
+    boost::uint32_t rows;
+    boost::uint32_t compressed; // 1 when the payload is zlib compressed
+    boost::uint64_t storedBytes; // payload bytes that follow in the file
+    boost::uint64_t rawBytes; // (1 + columns) * rows * 8 once decompressed: ticks, then each column in turn
+};
+
+enum OutputColumnType { OUTPUT_DOUBLE = 0, OUTPUT_INT64 = 1 };
+
+/* One recorded value, 8 bytes whichever the column type */
+union OutputValue
+{
+    double d;
+    boost::int64_t i;
+};
+
+/* Every row of one rank's binary output file, as read back by the export tool and the ensemble merge */
+struct BinaryOutput
+{
+    std::vector<OutputColumn> columns;
+    std::vector<double> ticks;
+    std::vector<OutputValue> values; // row major
+};
+
+void readBinaryOutput(const std::string& path, BinaryOutput& output); // throws std::runtime_error
+void sumBinaryOutputs(const std::vector<BinaryOutput>& ranks, BinaryOutput& sum); // column by column over the ranks of one run; throws if they differ in layout
+
+/* Asynchronous Block Writer */
+// Owns the output file and a writer thread. Rows recorded on the simulation thread are collected into blocks and
+// handed over through a bounded queue; the writer thread transposes each block into columns, optionally compresses
+// it and writes it. push() only waits when the queue is full, so the tick loop does not wait for the disk otherwise.
+class AsyncOutputWriter
+{
+
+private:
+    struct Block
+    {
+        double firstTick;
+        std::vector<double> ticks;
+        std::vector<OutputValue> values; // row major, as recorded
+    };
+
+    FILE* file;
+    std::vector<OutputColumn> columns;
+    bool compress;
+    size_t capacity; // blocks that may wait in the queue
+
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable queued; // wakes the writer
+    std::condition_variable drained; // wakes a push waiting for space
+    std::deque<Block*> queue;
+    bool closing;
+    bool failed; // a write failed in the writer thread
+
+    /* Backlog statistics */
+    size_t peakBacklog;
+    unsigned long stalls; // pushes that had to wait for space
+    unsigned long blocksWritten;
+    boost::uint64_t bytesWritten;
+
+    Block* current; // block being filled on the simulation thread
+    size_t blockRows;
+
+    void writerLoop();
+    bool writeBlock(const Block& block, std::vector<char>& raw, std::vector<char>& packed);
+
+public:
+    AsyncOutputWriter(const std::string& path, int rank, int worldSize, size_t rowsPerBlock, size_t queueBlocks, bool compressBlocks); // throws std::runtime_error
+    ~AsyncOutputWriter();
+
+    int addColumn(const std::string& name, OutputColumnType type); // only before the first row
+    void appendRow(double tick, const std::vector<OutputValue>& row);
+    void flush(); // hands the partly filled block to the writer
+    void close(); // writes everything still queued and stops the writer; throws std::runtime_error if any write failed
+
+    size_t backlog(); // blocks waiting for the writer
+    size_t getPeakBacklog() const { return peakBacklog; }
+    unsigned long getStalls() const { return stalls; }
+    unsigned long getBlocksWritten() const { return blocksWritten; }
+    boost::uint64_t getBytesWritten() const { return bytesWritten; }
+    bool isCompressed() const { return compress; }
+
+    static bool compressionAvailable(); // built with TRANSPORT_HAVE_ZLIB
+
+};
+
+/* Binary Data Set */
+// Drop in for the SVDataSet of the model: the same data sources, record() samples every source into a row, write()
+// hands the collected rows to the writer thread instead of formatting and flushing them on the simulation thread.
+class BinaryDataSet
+{
+
+private:
+    AsyncOutputWriter writer;
+    std::vector<repast::TDataSource<double>*> doubleSources;
+    std::vector<repast::TDataSource<boost::int64_t>*> intSources;
+    std::vector<std::pair<OutputColumnType, size_t> > order; // column order over the two source lists
+    std::vector<OutputValue> row;
+    double (*tickNow)(); // current simulation tick
+
+public:
+    BinaryDataSet(const std::string& path, int rank, int worldSize, size_t rowsPerBlock, size_t queueBlocks, bool compressBlocks, double (*tick)());
+    ~BinaryDataSet(); // deletes the data sources
+
+    void addDataSource(const std::string& name, repast::TDataSource<double>* source);
+    void addDataSource(const std::string& name, repast::TDataSource<boost::int64_t>* source);
+
+    void record();
+    void write();
+    void close();
+
+    AsyncOutputWriter& getWriter(){ return writer; }
+
+};
+
+#endif
@@ -0,0 +1,62 @@
+/* Population.h */
+
+#ifndef POPULATION
+#define POPULATION
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+/* Columnar population file layout: header, region name table, then one array per attribute, 8 byte aligned */
+struct PopulationHeader
+{
+    char            magic[8]; // "TABMPOP1"
+    boost::uint32_t version;
+    boost::uint32_t regionCount;
+    boost::uint64_t rowCount;
+    boost::uint64_t regionTableOffset; // regionCount names of REGION_NAME_LENGTH bytes, zero padded
+    boost::uint64_t ageOffset; // int32 per row
+    boost::uint64_t commuteDistOffset; // double per row
+    boost::uint64_t socNormOffset; // double per row
+    boost::uint64_t regionOffset; // int32 region id per row
+    boost::uint64_t cyclesOffset; // uint8 per row
+};
+
+/* Memory Mapped Synthetic Population */
+// Maps a columnar population file read only. Nothing is parsed: the attribute columns are used in place, and
+// each rank only touches the pages of its own slice of rows, so start up cost does not grow with the total
+// population held by other ranks.
+class PopulationFile
+{
+
+private:
+    int fd;
+    size_t length;
+    const char* base; // start of the mapping
+    const PopulationHeader* header;
+
+public:
+    static const int REGION_NAME_LENGTH = 32;
+
+    PopulationFile(const std::string& path); // throws std::runtime_error if the file cannot be mapped or is not a population file
+    ~PopulationFile();
+
+    boost::uint64_t rows() const { return header->rowCount; }
+    int regionCount() const { return (int)header->regionCount; }
+    std::string regionName(int region) const;
+
+    /* Columns, indexed by global row */
+    const boost::int32_t* age() const { return (const boost::int32_t*)(base + header->ageOffset); }
+    const double* commuteDist() const { return (const double*)(base + header->commuteDistOffset); }
+    const double* socNorm() const { return (const double*)(base + header->socNormOffset); }
+    const boost::int32_t* region() const { return (const boost::int32_t*)(base + header->regionOffset); }
+    const boost::uint8_t* cycles() const { return (const boost::uint8_t*)(base + header->cyclesOffset); }
+
+    void slice(int rank, int worldSize, boost::uint64_t& first, boost::uint64_t& count) const; // contiguous share of the rows for a rank
+    void prefetch(boost::uint64_t first, boost::uint64_t count) const; // asks the kernel to read the slice's pages ahead
+
+    /* Converts a CSV file with the header age,commuteDist,socNorm,region[,cycles] into a population file */
+    static boost::uint64_t convertCsv(const std::string& csvPath, const std::string& populationPath);
+
+};
+
+#endif
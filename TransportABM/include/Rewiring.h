@@ -0,0 +1,46 @@
+/* Rewiring.h */
+
+#ifndef REWIRING
+#define REWIRING
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/mpi.hpp>
+#include "repast_hpc/AgentId.h"
+
+/* Addition or removal of one agentNetwork edge, flat so it is shipped with memcpy rather than a boost archive */
+struct EdgeUpdate
+{
+    boost::int32_t source[4]; // id, starting rank, type, current rank
+    boost::int32_t target[4];
+    double         weight; // the edge content, for additions
+    boost::int32_t confidence;
+    boost::int32_t remove; // 1 removes the edge
+};
+
+/* Batched Edge Updates */
+// Collects the edge changes made during a tick. A change between two local agents stays on this rank; one to a
+// remote agent is kept for this rank's copy of the edge and also queued for the rank owning the other end, so
+// exchange() sends at most one message to each rank, holding every change the two ranks share. Every rank lists
+// the changes by the rank that queued them, in queuing order, so conflicting changes to an edge shared by two ranks
+// (two additions with different content, or an addition and a removal) are resolved the same way on both.
+class EdgeUpdateBatch
+{
+
+private:
+    std::vector<EdgeUpdate> own; // applied on this rank, in the order they were queued
+    std::vector<std::vector<char> > outgoing; // per rank
+
+public:
+    EdgeUpdateBatch(int ranks);
+
+    static EdgeUpdate make(const repast::AgentId& source, const repast::AgentId& target, double weight, int confidence, bool remove);
+    static repast::AgentId agentId(const boost::int32_t fields[4]);
+
+    void queue(const EdgeUpdate& update, int rank); // rank owns the target, this rank the source
+    void exchange(boost::mpi::communicator& comm, std::vector<EdgeUpdate>& updates); // collective: every update to apply here, ordered by queuing rank
+    size_t pending() const { return own.size(); }
+
+};
+
+#endif
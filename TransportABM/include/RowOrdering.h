@@ -0,0 +1,39 @@
+/* RowOrdering.h */
+
+#ifndef ROWORDERING
+#define ROWORDERING
+
+#include <string>
+#include <vector>
+#include "Adjacency.h"
+
+/* Locality of a store layout, over the neighbour reads of the local rows */
+struct OrderingStats
+{
+    long   bandwidth; // largest distance between two neighbouring local rows
+    double meanDistance; // mean distance between neighbouring local rows
+    double linesPerRow; // distinct 64 byte lines of a double column touched by one row's neighbour reads, ghosts included, on average
+    double farReads; // fraction of reads of local neighbours more than a 4 KiB page of doubles away from the reading row
+};
+
+/* Locality Ordering */
+// Orders the store rows so that neighbours sit close together: a breadth first sweep of the graph between local
+// rows, visiting neighbours by increasing degree (Cuthill-McKee), started from a pseudo peripheral row of each
+// component; RCM reverses it, which usually narrows the profile further. Ghost rows follow the local ones in the
+// order their first reader was placed. AgentIds are not touched, only store rows move.
+class RowOrdering
+{
+
+public:
+    enum Method { NONE, BFS, RCM };
+
+    static Method parse(const std::string& name); // none, bfs or rcm; throws std::runtime_error otherwise
+
+    /* New position to old row for every row of the store; the first localRows entries are the local rows */
+    static std::vector<int> order(const AgentAdjacency& adjacency, int localRows, int rows, Method method);
+
+    static OrderingStats measure(const AgentAdjacency& adjacency, int localRows);
+
+};
+
+#endif
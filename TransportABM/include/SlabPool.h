@@ -0,0 +1,115 @@
+/* SlabPool.h */
+
+#ifndef SLABPOOL
+#define SLABPOOL
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+/* Pool allocations and slabs taken from and returned to the system by every SlabPool of this rank */
+struct PoolTraffic
+{
+    boost::uint64_t allocations;
+    boost::uint64_t releases;
+    boost::uint64_t slabsAllocated;
+    boost::uint64_t slabsReleased;
+};
+
+const PoolTraffic& poolTraffic();
+
+/* Slab Pool */
+// Fixed size blocks carved from 64 KiB slabs aligned to their size, so the slab of a block is found by masking its
+// address. Each slab keeps its own free list and live count; slabs with free blocks are kept on a list, and
+// allocation takes the first of them, so blocks of long lived objects stay packed. Releasing a block never returns
+// memory; trim() hands every empty slab back in one pass, after a migration or cancellation freed many objects,
+// and trimAll() does so for every pool of the rank.
+// Blocks too large for a slab fall through to operator new. Not thread safe: agents and edges are created and
+// destroyed on the main thread of a rank only.
+class SlabPool
+{
+
+private:
+    struct Slab
+    {
+        Slab* next; // on the list of slabs with free blocks
+        Slab* previous;
+        void* free; // released blocks of this slab
+        char* unused; // blocks past this have never been handed out
+        int live;
+        bool listed;
+    };
+
+    size_t blockSize;
+    int blocksPerSlab;
+    SlabPool* nextPool; // every pool of the rank, for trimAll()
+    Slab* available; // slabs with a free block, most recently used first
+    size_t slabCount;
+    size_t liveBlocks;
+
+    Slab* newSlab();
+    void link(Slab* slab);
+    void unlink(Slab* slab);
+    Slab* slabOf(void* block) const;
+
+public:
+    static const size_t SLAB_BYTES = 64 * 1024;
+
+    explicit SlabPool(size_t objectSize);
+    ~SlabPool(); // releases every slab, blocks must not be used afterwards
+
+    void* allocate();
+    void release(void* block);
+    void trim(); // returns the empty slabs to the system
+    static void trimAll();
+
+    size_t slabs() const { return slabCount; }
+    size_t live() const { return liveBlocks; }
+
+};
+
+/* Standard allocator over one SlabPool per size, for boost::allocate_shared of objects and their control block */
+template<typename T>
+class SlabAllocator
+{
+
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    template<typename U> struct rebind { typedef SlabAllocator<U> other; };
+
+    SlabAllocator(){ }
+    template<typename U> SlabAllocator(const SlabAllocator<U>&){ }
+
+    static SlabPool& pool()
+    {
+        static SlabPool instance(sizeof(T));
+        return instance;
+    }
+
+    T* allocate(size_t n)
+    {
+        if(n == 1) return static_cast<T*>(pool().allocate());
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if(n == 1) pool().release(p);
+        else ::operator delete(p);
+    }
+
+    template<typename U, typename... Args> void construct(U* p, Args&&... args){ ::new((void*)p) U(static_cast<Args&&>(args)...); }
+    template<typename U> void destroy(U* p){ p->~U(); }
+    size_t max_size() const { return size_t(-1) / sizeof(T); }
+
+};
+
+template<typename T, typename U> bool operator==(const SlabAllocator<T>&, const SlabAllocator<U>&){ return true; }
+template<typename T, typename U> bool operator!=(const SlabAllocator<T>&, const SlabAllocator<U>&){ return false; }
+
+#endif
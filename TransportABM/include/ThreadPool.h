@@ -0,0 +1,61 @@
+/* ThreadPool.h */
+
+#ifndef THREADPOOL
+#define THREADPOOL
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+/* Work executed by the pool; run() is called with a chunk [first, last) and the id of the worker running it */
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask(){}
+    virtual void run(int first, int last, int worker) = 0;
+};
+
+/* Work Stealing Thread Pool */
+// Persistent workers used for the intra-rank part of a tick. parallelFor() splits the range evenly across the workers;
+// each worker claims chunks from the front of its own slice and, once that is empty, steals chunks from the other
+// slices, so uneven per agent cost (e.g. degree) is balanced without a shared queue. The calling thread is worker 0.
+class TickThreadPool
+{
+
+private:
+    struct Slice // one worker's share of the range, padded to a cache line and allocated on line boundaries so workers do not share one
+    {
+        std::atomic<int> next;
+        int end;
+        char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+    };
+
+    int workers;
+    std::vector<std::thread> helpers;
+    Slice* slices;
+
+    std::mutex lock;
+    std::condition_variable wake; // helpers wait for a new generation
+    std::condition_variable finished; // caller waits for all helpers to finish
+    unsigned long generation;
+    int running; // helpers still working on the current generation
+    bool stopping;
+
+    ParallelTask* task;
+    int grain;
+
+    void helperLoop(int worker);
+    void work(int worker); // claims and runs chunks until every slice is empty
+
+public:
+    TickThreadPool(int threads);
+    ~TickThreadPool();
+
+    int size() const { return workers; }
+    void parallelFor(int begin, int end, int grainSize, ParallelTask& body); // returns once every chunk has run
+
+};
+
+#endif
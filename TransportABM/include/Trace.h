@@ -0,0 +1,137 @@
+/* Trace.h */
+
+#ifndef TRACE
+#define TRACE
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <boost/cstdint.hpp>
+
+/* Per rank trace file layout: TraceFileHeader, then TraceRecords in the order the flusher drained them */
+struct TraceFileHeader
+{
+    char            magic[8]; // "TABMTRC1"
+    boost::uint32_t version;
+    boost::uint32_t rank;
+    boost::uint32_t worldSize;
+    boost::uint32_t recordSize; // sizeof(TraceRecord)
+};
+
+enum TraceEvent
+{
+    TRACE_STATE = 0, // sampled state of a local agent after a tick
+    TRACE_IMPORT = 1, // a remote agent was requested as a ghost
+    TRACE_CANCEL = 2, // a ghost was cancelled
+    TRACE_REMOVE = 3, // a local agent was removed
+    TRACE_MIGRATE = 4 // a local agent was sent to another rank, type holds the destination
+};
+
+struct TraceRecord
+{
+    double          tick;
+    double          c;
+    double          total;
+    boost::int32_t  id;
+    boost::int32_t  startingRank;
+    boost::int32_t  type; // agent type, or the destination rank of TRACE_MIGRATE
+    boost::uint8_t  cycles;
+    boost::uint8_t  event;
+    boost::uint8_t  padding[2];
+};
+
+/* Single Producer Single Consumer Ring */
+// One thread appends and the flusher thread drains. A full ring drops the record and counts it, so a slow disk
+// never stalls the tick loop.
+class TraceRing
+{
+
+private:
+    std::vector<TraceRecord> records; // capacity is a power of two
+    size_t mask;
+    std::atomic<size_t> head; // next write, moved by the producer only
+    char padding[64];
+    std::atomic<size_t> tail; // next read, moved by the consumer only
+    std::atomic<unsigned long> dropped;
+
+public:
+    TraceRing();
+
+    void configure(size_t capacity); // before the first push
+
+    bool push(const TraceRecord& record)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) > mask)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        records[h & mask] = record;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t drain(std::vector<TraceRecord>& out); // appends everything pushed so far
+    unsigned long droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+};
+
+/* Background Trace Writer */
+// Owns one ring per worker of the tick thread pool and a flusher thread that drains them into the rank's trace file
+// every few milliseconds. Recording is a copy into the worker's own ring; nothing on the tick loop formats text,
+// locks or touches the file. trace_decode turns the files into text.
+class TraceWriter
+{
+
+private:
+    FILE* file;
+    TraceRing* rings;
+    int ringCount;
+    int flushMillis;
+
+    std::thread flusher;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool closing;
+    bool failed;
+    boost::uint64_t written; // records in the file
+
+    std::vector<TraceRecord> batch; // flusher thread only
+
+    void flushLoop();
+    bool drainAll();
+
+public:
+    TraceWriter(const std::string& path, int rank, int worldSize, int workers, size_t ringRecords, int flushInterval); // throws std::runtime_error
+    ~TraceWriter();
+
+    void record(int worker, TraceEvent event, double tick, boost::int32_t id, boost::int32_t startingRank, boost::int32_t type,
+                double c, double total, bool cycles)
+    {
+        TraceRecord r;
+        r.tick         = tick;
+        r.c            = c;
+        r.total        = total;
+        r.id           = id;
+        r.startingRank = startingRank;
+        r.type         = type;
+        r.cycles       = cycles ? 1 : 0;
+        r.event        = (boost::uint8_t)event;
+        r.padding[0]   = 0;
+        r.padding[1]   = 0;
+        rings[worker].push(r);
+    }
+
+    void close(); // drains the rings and stops the flusher; throws std::runtime_error if a write failed
+
+    unsigned long getDropped() const;
+    boost::uint64_t getWritten() const { return written; } // after close()
+
+};
+
+#endif
@@ -0,0 +1,169 @@
+/* Adjacency.cpp */
+
+#include <algorithm> // std::sort, std::unique, std::max
+#include "Adjacency.h"
+#include "Agent.h"
+
+namespace {
+
+const int NEW_ROW_CAPACITY = 4; // free entries of a row added by follow(), enough for a ghost's first edges
+
+bool idBefore(const repast::AgentId& x, const repast::AgentId& y)
+{
+    if(x.startingRank() != y.startingRank()) return x.startingRank() < y.startingRank();
+    if(x.id() != y.id()) return x.id() < y.id();
+    return x.agentType() < y.agentType();
+}
+
+/* Orders neighbours by their global id so rows do not depend on hash map iteration order */
+struct NeighbourOrder
+{
+    bool operator()(const RepastHPCAgent* a, const RepastHPCAgent* b) const
+    {
+        return idBefore(a->getId(), b->getId());
+    }
+};
+
+}
+
+AgentAdjacency::AgentAdjacency(): valid(false), builtLayout(0), builds(0), edits(0), slack(0), gaps(0){ }
+
+void AgentAdjacency::build(AgentNetwork* network, const AgentStateStore& store)
+{
+    int rowCount = store.size();
+    offsets.resize(rowCount);
+    ends.resize(rowCount);
+    limits.resize(rowCount);
+    neighbour.clear();
+    weight.clear();
+    confidence.clear();
+
+    std::vector<RepastHPCAgent*> successors; // reused for every row
+    for(int i = 0; i < rowCount; i++)
+    {
+        RepastHPCAgent* agent = store.owner[i];
+        successors.clear();
+        offsets[i] = (int)neighbour.size();
+        network->successors(agent, successors);
+        std::sort(successors.begin(), successors.end(), NeighbourOrder());
+        for(size_t j = 0; j < successors.size(); j++)
+        {
+            boost::shared_ptr<ModelCustomEdge<RepastHPCAgent> > edge = network->findEdge(agent, successors[j]);
+            neighbour.push_back(successors[j]->getStoreIndex());
+            weight.push_back(edge->weight());
+            confidence.push_back(edge->getConfidence());
+        }
+        ends[i] = (int)neighbour.size();
+        neighbour.resize(ends[i] + slack, -1);
+        weight.resize(ends[i] + slack, 0);
+        confidence.resize(ends[i] + slack, 0);
+        limits[i] = (int)neighbour.size();
+    }
+
+    gaps = 0;
+    builtLayout = store.layoutVersion();
+    builds++;
+    valid = true;
+}
+
+long AgentAdjacency::degreeSum(int first, int last) const
+{
+    long sum = 0;
+    for(int i = first; i < last; i++) sum += ends[i] - offsets[i];
+    return sum;
+}
+
+bool AgentAdjacency::insert(const AgentStateStore& store, int row, int other, double edgeWeight, int edgeConfidence)
+{
+    if(ends[row] == limits[row]) return false;
+    const repast::AgentId& id = store.owner[other]->getId();
+    int k = ends[row];
+    for(; k > offsets[row] && idBefore(id, store.owner[neighbour[k - 1]]->getId()); k--) // keeps the row in id order
+    {
+        neighbour[k]  = neighbour[k - 1];
+        weight[k]     = weight[k - 1];
+        confidence[k] = confidence[k - 1];
+    }
+    neighbour[k]  = other;
+    weight[k]     = edgeWeight;
+    confidence[k] = edgeConfidence;
+    ends[row]++;
+    edits++;
+    return true;
+}
+
+bool AgentAdjacency::erase(int row, int other)
+{
+    int k = offsets[row];
+    while(k < ends[row] && neighbour[k] != other) k++;
+    if(k == ends[row]) return false;
+    for(ends[row]--; k < ends[row]; k++)
+    {
+        neighbour[k]  = neighbour[k + 1];
+        weight[k]     = weight[k + 1];
+        confidence[k] = confidence[k + 1];
+    }
+    edits++;
+    return true;
+}
+
+void AgentAdjacency::swapRows(int a, int b)
+{
+    // Every row referring to either is listed by one of them, since each edge is held by both of its ends
+    touched.clear();
+    for(int k = offsets[a]; k < ends[a]; k++) touched.push_back(neighbour[k]);
+    for(int k = offsets[b]; k < ends[b]; k++) touched.push_back(neighbour[k]);
+    std::swap(offsets[a], offsets[b]);
+    std::swap(ends[a], ends[b]);
+    std::swap(limits[a], limits[b]);
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for(size_t t = 0; t < touched.size(); t++)
+    {
+        int n = touched[t]; // when a and b are neighbours both are listed, and both have swapped
+        for(int k = offsets[n]; k < ends[n]; k++)
+        {
+            if(neighbour[k] == a) neighbour[k] = b;
+            else if(neighbour[k] == b) neighbour[k] = a;
+        }
+    }
+}
+
+bool AgentAdjacency::follow(const AgentStateStore& store)
+{
+    if(!valid || !store.journalComplete() || store.journalStart() != builtLayout || store.journalLocalCount() != store.localCount()) return false;
+    const std::vector<AgentStateStore::RowMove>& journal = store.rowJournal();
+    int local = store.localCount();
+    for(size_t m = 0; m < journal.size(); m++)
+    {
+        const AgentStateStore::RowMove& move = journal[m];
+        if(move.kind == AgentStateStore::RowMove::ADDED)
+        {
+            if(move.a != rows()) return false;
+            int at = (int)neighbour.size();
+            int capacity = std::max(slack, NEW_ROW_CAPACITY);
+            offsets.push_back(at);
+            ends.push_back(at);
+            limits.push_back(at + capacity);
+            neighbour.resize(at + capacity, -1);
+            weight.resize(at + capacity, 0);
+            confidence.resize(at + capacity, 0);
+        }
+        else if(move.kind == AgentStateStore::RowMove::SWAPPED)
+        {
+            if(move.a < local || move.b < local) return false; // local rows index other per row data as well
+            swapRows(move.a, move.b);
+        }
+        else
+        {
+            if(move.a != rows() - 1 || ends[move.a] != offsets[move.a]) return false; // a removed row has no edges left
+            gaps += limits[move.a] - offsets[move.a];
+            offsets.pop_back();
+            ends.pop_back();
+            limits.pop_back();
+        }
+    }
+    if(gaps > (int)neighbour.size() / 4) return false; // time to compact
+    builtLayout = store.layoutVersion();
+    return true;
+}
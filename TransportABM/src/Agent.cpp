@@ -2,71 +2,110 @@
 
 #include "Agent.h" // include agent header file
 
-RepastHPCAgent::RepastHPCAgent(repast::AgentId id): id_(id), c(100), total(200){ }
-
-RepastHPCAgent::RepastHPCAgent(repast::AgentId id, double newC, double newTotal): id_(id), c(newC), total(newTotal){ }
+RepastHPCAgent::RepastHPCAgent(repast::AgentId id, AgentStateStore* store): id_(id), store_(store)
+{
+    index_ = store_->allocate(this, id_.currentRank() == store_->getRank());
+    store_->aggregates.remove(*store_, index_);
+    store_->c[index_]     = 100;
+    store_->total[index_] = 200;
+    store_->aggregates.add(*store_, index_);
+}
 
-RepastHPCAgent::~RepastHPCAgent(){ } //Agent destructor 
+RepastHPCAgent::RepastHPCAgent(repast::AgentId id, AgentStateStore* store, double newC, double newTotal): id_(id), store_(store)
+{
+    index_ = store_->allocate(this, id_.currentRank() == store_->getRank());
+    store_->aggregates.remove(*store_, index_);
+    store_->c[index_]     = newC;
+    store_->total[index_] = newTotal;
+    store_->aggregates.add(*store_, index_);
+}
 
+RepastHPCAgent::~RepastHPCAgent() //Agent destructor - frees the agent's row in the store
+{
+    if(store_ != 0) store_->release(index_);
+}
 
-void RepastHPCAgent::set(int currentRank, double newC, double newTotal)
+static SlabPool& agentPool()
 {
-    id_.currentRank(currentRank);
-    c     = newC;
-    total = newTotal;
+    static SlabPool pool(sizeof(RepastHPCAgent));
+    return pool;
 }
 
-void initAgent() // Function to set initial state variable values
+void* RepastHPCAgent::operator new(size_t size)
 {
-    // Set age
-    
-    // Set commuting distance
+    if(size != sizeof(RepastHPCAgent)) return ::operator new(size);
+    return agentPool().allocate();
+}
 
-    // Set societal normality 
+void RepastHPCAgent::operator delete(void* block, size_t size)
+{
+    if(size != sizeof(RepastHPCAgent)) ::operator delete(block);
+    else agentPool().release(block);
+}
 
-    // Set agent region
 
+void RepastHPCAgent::set(int currentRank, double newC, double newTotal)
+{
+    id_.currentRank(currentRank);
+    store_->setLocal(index_, currentRank == store_->getRank()); // may move this agent's row
+    store_->aggregates.remove(*store_, index_);
+    store_->c[index_]     = newC;
+    store_->total[index_] = newTotal;
+    store_->aggregates.add(*store_, index_);
 }
 
-void updateDesires() // Function to update the agent desires based on current state variable values
+void RepastHPCAgent::initAgent(int newAge, double newCommuteDist, double newSocNorm, int newRegionId, bool newCycles) // Function to set initial state variable values
 {
-    
+    store_->aggregates.remove(*store_, index_);
+    store_->age[index_]         = newAge; // Set age
+    store_->commuteDist[index_] = newCommuteDist; // Set commuting distance
+    store_->socNorm[index_]     = newSocNorm; // Set societal normality
+    store_->regionId[index_]    = newRegionId; // Set agent region
+    store_->cycles[index_]      = newCycles ? 1 : 0;
+    store_->aggregates.add(*store_, index_);
+}
 
+static bool cooperates(const AgentStateStore* store, int index, double draw) // cooperation decision for any row of the store
+{
+	return draw < store->c[index]/store->total[index];
 }
 
-bool RepastHPCAgent::cooperate()
+bool RepastHPCAgent::cooperate(double draw)
 {
-	return repast::Random::instance()->nextDouble() < c/total;
+	return cooperates(store_, index_, draw);
 }
 
-void RepastHPCAgent::play(repast::SharedNetwork<RepastHPCAgent,
-                              ModelCustomEdge<RepastHPCAgent>,
-                              ModelCustomEdgeContent<RepastHPCAgent>,
-                              ModelCustomEdgeContentManager<RepastHPCAgent> > *network)
+void RepastHPCAgent::play(const AgentAdjacency& adjacency, const CounterRandom& random, long tick, std::vector<double>& draws)
 {
-    std::vector<RepastHPCAgent*> agentsToPlay; // vector to hold agent objects, <> specifies vector type
-    network->successors(this, agentsToPlay);
+    int first = adjacency.begin(index_);
+    int degree = adjacency.end(index_) - first;
+    store_->cNext[index_]     = store_->c[index_]; // results go to the next buffers, the current state is read only during a tick
+    store_->totalNext[index_] = store_->total[index_];
+    if(degree == 0) return;
+
+    // Two draws per neighbour from this agent's own stream: mine and my opponent's for that game.
+    // Rows are sorted by neighbour id, so the draws do not depend on the sweep order or decomposition.
+    draws.resize(2 * degree);
+    random.fill(id_, tick, 0, &draws[0], 2 * degree);
 
     double cPayoff = 0;
     double totalPayoff = 0;
-    std::vector<RepastHPCAgent*>::iterator agentToPlay = agentsToPlay.begin(); // declare and initialise an iterator 'agentToPlay' that holds value of iterator position in agentsToPlay vector
-    while(agentToPlay != agentsToPlay.end()) // iterates through each agent
+    for(int k = 0; k < degree; k++) // one sequential scan over this agent's neighbours
     {
-        boost::shared_ptr<ModelCustomEdge<RepastHPCAgent> > edge = network->findEdge(this, *agentToPlay);
-        double edgeWeight = edge->weight();
-        int confidence = edge->getConfidence();
+        int opponent = adjacency.neighbour[first + k];
+        double edgeWeight = adjacency.weight[first + k];
+        int confidence = adjacency.confidence[first + k];
 
-        bool iCooperated = cooperate(); // Do I cooperate?
+        bool iCooperated = cooperate(draws[2 * k]); // Do I cooperate?
+        bool opponentCooperated = cooperates(store_, opponent, draws[2 * k + 1]);
         double payoff = (iCooperated ?
-						 ((*agentToPlay)->cooperate() ?  7 : 1) :  // If I cooperated, did my opponent?
-						 ((*agentToPlay)->cooperate() ? 10 : 3));  // If I didn't cooperate, did my opponent?
+						 (opponentCooperated ?  7 : 1) :  // If I cooperated, did my opponent?
+						 (opponentCooperated ? 10 : 3));  // If I didn't cooperate, did my opponent?
         if(iCooperated) cPayoff += payoff * confidence * confidence * edgeWeight;
         totalPayoff             += payoff * confidence * confidence * edgeWeight;
-
-        agentToPlay++;
     }
-    c += cPayoff;
-    total += totalPayoff;
+    store_->cNext[index_]     += cPayoff;
+    store_->totalNext[index_] += totalPayoff;
 
 }
 
@@ -76,4 +115,4 @@ void RepastHPCAgent::play(repast::SharedNetwork<RepastHPCAgent,
 RepastHPCAgentPackage::RepastHPCAgentPackage(){ }
 
 RepastHPCAgentPackage::RepastHPCAgentPackage(int _id, int _rank, int _type, int _currentRank, double _c, double _total):
-id(_id), rank(_rank), type(_type), currentRank(_currentRank), c(_c), total(_total){ }
+id(_id), rank(_rank), type(_type), currentRank(_currentRank), c(_c), total(_total), age(0), commuteDist(0), socNorm(0), regionId(-1), cycles(false){ }
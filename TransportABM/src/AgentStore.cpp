@@ -0,0 +1,241 @@
+/* AgentStore.cpp */
+
+#include <algorithm> // std::swap
+#include "AgentStore.h"
+#include "Agent.h"
+
+namespace {
+
+template<typename T>
+void gather(std::vector<T>& column, const std::vector<int>& order)
+{
+    std::vector<T> moved(column.size());
+    for(size_t r = 0; r < order.size(); r++) moved[r] = column[order[r]];
+    column.swap(moved);
+}
+
+}
+
+AgentStateStore::AgentStateStore(int processRank): rank(processRank), localAgents(0), layout(0), journaling(false), journalLimit(0), journalLayout(0), journalLocal(0){ }
+
+void AgentStateStore::reserve(size_t rows)
+{
+    owner.reserve(rows);
+    c.reserve(rows);
+    total.reserve(rows);
+    cNext.reserve(rows);
+    totalNext.reserve(rows);
+    age.reserve(rows);
+    commuteDist.reserve(rows);
+    socNorm.reserve(rows);
+    regionId.reserve(rows);
+    des_age.reserve(rows);
+    des_commuteDist.reserve(rows);
+    des_socNorm.reserve(rows);
+    des_region.reserve(rows);
+    des_popHealth.reserve(rows);
+    des_popSafety.reserve(rows);
+    cycles.reserve(rows);
+}
+
+void AgentStateStore::startJournal(size_t limit)
+{
+    journal.clear();
+    journaling = true;
+    journalLimit = limit;
+    journalLayout = layout;
+    journalLocal = localAgents;
+}
+
+void AgentStateStore::record(int kind, int a, int b)
+{
+    if(!journaling) return;
+    if(journal.size() >= journalLimit) // cheaper to rebuild what depends on the rows than to follow this many changes
+    {
+        journaling = false;
+        journal.clear();
+        return;
+    }
+    RowMove move = { kind, a, b };
+    journal.push_back(move);
+}
+
+void AgentStateStore::pushRow(RepastHPCAgent* agent) // appends a row holding default state values
+{
+    record(RowMove::ADDED, size(), -1);
+    owner.push_back(agent);
+    c.push_back(0);
+    total.push_back(0);
+    cNext.push_back(0);
+    totalNext.push_back(0);
+    age.push_back(0);
+    commuteDist.push_back(0);
+    socNorm.push_back(0);
+    regionId.push_back(-1);
+    des_age.push_back(0);
+    des_commuteDist.push_back(0);
+    des_socNorm.push_back(0);
+    des_region.push_back(0);
+    des_popHealth.push_back(0);
+    des_popSafety.push_back(0);
+    cycles.push_back(0);
+}
+
+void AgentStateStore::popRow()
+{
+    record(RowMove::REMOVED, size() - 1, -1);
+    owner.pop_back();
+    c.pop_back();
+    total.pop_back();
+    cNext.pop_back();
+    totalNext.pop_back();
+    age.pop_back();
+    commuteDist.pop_back();
+    socNorm.pop_back();
+    regionId.pop_back();
+    des_age.pop_back();
+    des_commuteDist.pop_back();
+    des_socNorm.pop_back();
+    des_region.pop_back();
+    des_popHealth.pop_back();
+    des_popSafety.pop_back();
+    cycles.pop_back();
+}
+
+void AgentStateStore::swapRows(int a, int b)
+{
+    if(a == b) return;
+    record(RowMove::SWAPPED, a, b);
+    std::swap(owner[a], owner[b]);
+    std::swap(c[a], c[b]);
+    std::swap(total[a], total[b]);
+    std::swap(cNext[a], cNext[b]);
+    std::swap(totalNext[a], totalNext[b]);
+    std::swap(age[a], age[b]);
+    std::swap(commuteDist[a], commuteDist[b]);
+    std::swap(socNorm[a], socNorm[b]);
+    std::swap(regionId[a], regionId[b]);
+    std::swap(des_age[a], des_age[b]);
+    std::swap(des_commuteDist[a], des_commuteDist[b]);
+    std::swap(des_socNorm[a], des_socNorm[b]);
+    std::swap(des_region[a], des_region[b]);
+    std::swap(des_popHealth[a], des_popHealth[b]);
+    std::swap(des_popSafety[a], des_popSafety[b]);
+    std::swap(cycles[a], cycles[b]);
+    owner[a]->index_ = a; // handles follow their rows
+    owner[b]->index_ = b;
+}
+
+int AgentStateStore::allocate(RepastHPCAgent* agent, bool local)
+{
+    int index = size();
+    pushRow(agent);
+    agent->index_ = index;
+    if(local) // local rows are kept in front of the non-local ones
+    {
+        swapRows(index, localAgents);
+        index = localAgents;
+        localAgents++;
+        aggregates.add(*this, index);
+    }
+    layout++;
+    return index;
+}
+
+void AgentStateStore::release(int index)
+{
+    aggregates.remove(*this, index);
+    if(index < localAgents) // close the gap in the local partition first
+    {
+        swapRows(index, localAgents - 1);
+        index = localAgents - 1;
+        localAgents--;
+    }
+    swapRows(index, size() - 1);
+    popRow();
+    layout++;
+}
+
+void AgentStateStore::setLocal(int index, bool local)
+{
+    if(local == isLocal(index)) return;
+    if(local)
+    {
+        swapRows(index, localAgents);
+        localAgents++;
+        aggregates.add(*this, localAgents - 1);
+    }
+    else
+    {
+        aggregates.remove(*this, index);
+        swapRows(index, localAgents - 1);
+        localAgents--;
+    }
+    layout++;
+}
+
+void AgentStateStore::refreshLocality()
+{
+    int i = 0;
+    while(i < size())
+    {
+        bool local = (owner[i]->getId().currentRank() == rank);
+        if(local != isLocal(i))
+        {
+            setLocal(i, local); // the row swapped into position i has not been checked yet
+            continue;
+        }
+        i++;
+    }
+}
+
+void AgentStateStore::permute(const std::vector<int>& order)
+{
+    journaling = false; // every row may move
+    journal.clear();
+    gather(owner, order);
+    gather(c, order);
+    gather(total, order);
+    gather(cNext, order);
+    gather(totalNext, order);
+    gather(age, order);
+    gather(commuteDist, order);
+    gather(socNorm, order);
+    gather(regionId, order);
+    gather(des_age, order);
+    gather(des_commuteDist, order);
+    gather(des_socNorm, order);
+    gather(des_region, order);
+    gather(des_popHealth, order);
+    gather(des_popSafety, order);
+    gather(cycles, order);
+    for(int r = 0; r < size(); r++) owner[r]->index_ = r;
+    layout++;
+}
+
+void AgentStateStore::commitLocal(int first, int last, int worker)
+{
+    for(int i = first; i < last; i++)
+    {
+        aggregates.stateChanged(worker, c[i], cNext[i], total[i], totalNext[i]);
+        c[i]     = cNext[i];
+        total[i] = totalNext[i];
+    }
+}
+
+int AgentStateStore::internRegion(const std::string& name)
+{
+    for(size_t i = 0; i < regionNames.size(); i++)
+    {
+        if(regionNames[i] == name) return (int)i;
+    }
+    regionNames.push_back(name);
+    return (int)regionNames.size() - 1;
+}
+
+const std::string& AgentStateStore::regionName(int id) const
+{
+    static const std::string none;
+    if(id < 0 || id >= (int)regionNames.size()) return none;
+    return regionNames[id];
+}
@@ -0,0 +1,126 @@
+/* Aggregates.cpp */
+
+#include <cmath> // std::fabs
+#include "Aggregates.h"
+#include "AgentStore.h"
+
+void CompensatedSum::add(double value)
+{
+    double next = sum + value;
+    if(std::fabs(sum) >= std::fabs(value)) compensation += (sum - next) + value;
+    else compensation += (value - next) + sum;
+    sum = next;
+}
+
+void CompensatedSum::add(const CompensatedSum& other)
+{
+    add(other.sum);
+    add(other.compensation);
+}
+
+AgentAggregates::AgentAggregates(): pending(1), bandWidth(10), bands(10){ }
+
+void AgentAggregates::configure(int ageBandWidth, int ageBands, int workers)
+{
+    bandWidth = (ageBandWidth > 0) ? ageBandWidth : 10;
+    bands     = (ageBands > 0) ? ageBands : 1;
+    pending.assign(workers > 0 ? workers : 1, AggregatePartial());
+}
+
+void AgentAggregates::rebuild(const AgentStateStore& store)
+{
+    totals = AggregatePartial();
+    pending.assign(pending.size(), AggregatePartial());
+    for(int i = 0; i < store.localCount(); i++) add(store, i);
+    settle();
+}
+
+void AgentAggregates::restore(const AggregatePartial& saved)
+{
+    totals = saved;
+    pending.assign(pending.size(), AggregatePartial());
+}
+
+void AgentAggregates::grow(std::vector<boost::int64_t>& counts, size_t slot)
+{
+    if(slot >= counts.size()) counts.resize(slot + 1, 0);
+}
+
+boost::int64_t AgentAggregates::count(const std::vector<boost::int64_t>& counts, size_t slot)
+{
+    return (slot < counts.size()) ? counts[slot] : 0;
+}
+
+int AgentAggregates::ageBand(int age) const
+{
+    int band = (age > 0) ? age / bandWidth : 0;
+    return (band < bands) ? band : bands - 1;
+}
+
+void AgentAggregates::countAgent(AggregatePartial& partial, int age, int region, int agents, int cyclists) const
+{
+    size_t regionSlot = (region >= 0) ? (size_t)region + 1 : 0;
+    size_t band = (size_t)ageBand(age);
+    grow(partial.regionAgents, regionSlot);
+    grow(partial.regionCyclists, regionSlot);
+    grow(partial.bandAgents, band);
+    grow(partial.bandCyclists, band);
+    partial.agents                     += agents;
+    partial.cyclists                   += cyclists;
+    partial.regionAgents[regionSlot]   += agents;
+    partial.regionCyclists[regionSlot] += cyclists;
+    partial.bandAgents[band]           += agents;
+    partial.bandCyclists[band]         += cyclists;
+}
+
+void AgentAggregates::add(const AgentStateStore& store, int row, int worker)
+{
+    if(!store.isLocal(row)) return;
+    AggregatePartial& partial = pending[worker];
+    partial.c.add(store.c[row]);
+    partial.total.add(store.total[row]);
+    countAgent(partial, store.age[row], store.regionId[row], 1, store.cycles[row] ? 1 : 0);
+}
+
+void AgentAggregates::remove(const AgentStateStore& store, int row, int worker)
+{
+    if(!store.isLocal(row)) return;
+    AggregatePartial& partial = pending[worker];
+    partial.c.add(-store.c[row]);
+    partial.total.add(-store.total[row]);
+    countAgent(partial, store.age[row], store.regionId[row], -1, store.cycles[row] ? -1 : 0);
+}
+
+void AgentAggregates::settle()
+{
+    for(size_t w = 0; w < pending.size(); w++)
+    {
+        AggregatePartial& partial = pending[w];
+        totals.c.add(partial.c);
+        totals.total.add(partial.total);
+        totals.agents   += partial.agents;
+        totals.cyclists += partial.cyclists;
+        for(size_t s = 0; s < partial.regionAgents.size(); s++)
+        {
+            grow(totals.regionAgents, s);
+            grow(totals.regionCyclists, s);
+            totals.regionAgents[s]   += partial.regionAgents[s];
+            totals.regionCyclists[s] += partial.regionCyclists[s];
+        }
+        for(size_t b = 0; b < partial.bandAgents.size(); b++)
+        {
+            grow(totals.bandAgents, b);
+            grow(totals.bandCyclists, b);
+            totals.bandAgents[b]   += partial.bandAgents[b];
+            totals.bandCyclists[b] += partial.bandCyclists[b];
+        }
+        partial.c        = CompensatedSum();
+        partial.total    = CompensatedSum();
+        partial.agents   = 0;
+        partial.cyclists = 0;
+        partial.regionAgents.assign(partial.regionAgents.size(), 0); // keep the slots so steady state settles do not allocate
+        partial.regionCyclists.assign(partial.regionCyclists.size(), 0);
+        partial.bandAgents.assign(partial.bandAgents.size(), 0);
+        partial.bandCyclists.assign(partial.bandCyclists.size(), 0);
+    }
+}
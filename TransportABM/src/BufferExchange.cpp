@@ -0,0 +1,43 @@
+/* BufferExchange.cpp */
+
+#include "BufferExchange.h"
+
+namespace {
+
+ExchangeTraffic traffic = { 0, 0 }; // only the main thread of a rank communicates
+
+}
+
+const ExchangeTraffic& exchangeTraffic()
+{
+    return traffic;
+}
+
+void countMessage(size_t bytes)
+{
+    traffic.messages++;
+    traffic.bytes += bytes;
+}
+
+void exchangeBuffers(boost::mpi::communicator& comm, const std::vector<std::vector<char> >& send, std::vector<std::vector<char> >& receive, int tag)
+{
+    int worldSize = comm.size();
+    std::vector<int> sendSizes(worldSize), receiveSizes(worldSize);
+    for(int r = 0; r < worldSize; r++) sendSizes[r] = (int)send[r].size();
+    boost::mpi::all_to_all(comm, sendSizes, receiveSizes);
+
+    receive.resize(worldSize);
+    std::vector<boost::mpi::request> requests;
+    for(int r = 0; r < worldSize; r++)
+    {
+        receive[r].resize(receiveSizes[r]);
+        if(receiveSizes[r] > 0) requests.push_back(comm.irecv(r, tag, receive[r].data(), receiveSizes[r]));
+    }
+    for(int r = 0; r < worldSize; r++)
+    {
+        if(sendSizes[r] == 0) continue;
+        requests.push_back(comm.isend(r, tag, send[r].data(), sendSizes[r]));
+        countMessage(sendSizes[r]);
+    }
+    boost::mpi::wait_all(requests.begin(), requests.end());
+}
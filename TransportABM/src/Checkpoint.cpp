@@ -0,0 +1,218 @@
+/* Checkpoint.cpp */
+
+#include <cstdio> // std::rename
+#include <cstring> // std::memcmp, std::memcpy, std::memset, std::strncpy
+#include <fstream>
+#include <vector>
+#include <stdexcept>
+#include <sys/mman.h> // mmap
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Checkpoint.h"
+#include "Agent.h"
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = { 'T', 'A', 'B', 'M', 'C', 'K', 'P', '1' };
+
+boost::uint64_t align8(boost::uint64_t offset)
+{
+    return (offset + 7) & ~(boost::uint64_t)7;
+}
+
+size_t slotCount(const std::vector<boost::int64_t>& a, const std::vector<boost::int64_t>& b)
+{
+    return a.size() > b.size() ? a.size() : b.size();
+}
+
+boost::int64_t slot(const std::vector<boost::int64_t>& counts, size_t s)
+{
+    return s < counts.size() ? counts[s] : 0;
+}
+
+}
+
+CheckpointFile::CheckpointFile(const std::string& path): fd(-1), length(0), base(0), header(0)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("Cannot open checkpoint " + path);
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Checkpoint " + path + " is too short");
+    }
+    length = (size_t)info.st_size;
+    void* mapping = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot map checkpoint " + path);
+    }
+    base = (const char*)mapping;
+    header = (const CheckpointHeader*)base;
+
+    boost::uint64_t rows = header->localRows + header->ghostRows;
+    boost::uint64_t slots = header->regionSlots + header->bandSlots;
+    if(std::memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header->version != 1 ||
+       header->regionTableOffset + (boost::uint64_t)header->regionCount * REGION_NAME_LENGTH > length ||
+       header->agentsOffset + rows * sizeof(CheckpointAgent) > length || header->edgesOffset + header->edgeCount * sizeof(CheckpointEdge) > length ||
+       header->aggregatesOffset + sizeof(CheckpointAggregates) + slots * 2 * sizeof(boost::int64_t) > length)
+    {
+        munmap(mapping, length);
+        close(fd);
+        throw std::runtime_error(path + " is not a version 1 checkpoint");
+    }
+}
+
+CheckpointFile::~CheckpointFile()
+{
+    munmap((void*)base, length);
+    close(fd);
+}
+
+std::string CheckpointFile::regionName(int region) const
+{
+    const char* name = base + header->regionTableOffset + (size_t)region * REGION_NAME_LENGTH;
+    size_t size = 0;
+    while(size < (size_t)REGION_NAME_LENGTH && name[size] != 0) size++;
+    return std::string(name, size);
+}
+
+void CheckpointFile::aggregates(AggregatePartial& saved) const
+{
+    CheckpointAggregates totals;
+    std::memcpy(&totals, base + header->aggregatesOffset, sizeof(totals));
+    saved.c        = CompensatedSum(totals.cSum, totals.cCompensation);
+    saved.total    = CompensatedSum(totals.totalSum, totals.totalCompensation);
+    saved.agents   = totals.agents;
+    saved.cyclists = totals.cyclists;
+
+    const boost::int64_t* counts = (const boost::int64_t*)(base + header->aggregatesOffset + sizeof(CheckpointAggregates));
+    saved.regionAgents.resize(header->regionSlots);
+    saved.regionCyclists.resize(header->regionSlots);
+    for(size_t s = 0; s < header->regionSlots; s++, counts += 2)
+    {
+        saved.regionAgents[s]   = counts[0];
+        saved.regionCyclists[s] = counts[1];
+    }
+    saved.bandAgents.resize(header->bandSlots);
+    saved.bandCyclists.resize(header->bandSlots);
+    for(size_t s = 0; s < header->bandSlots; s++, counts += 2)
+    {
+        saved.bandAgents[s]   = counts[0];
+        saved.bandCyclists[s] = counts[1];
+    }
+}
+
+void CheckpointFile::write(const std::string& path, int rank, int worldSize, boost::uint32_t seed, double tick,
+                           const AgentStateStore& store, const AgentAdjacency& adjacency)
+{
+    std::vector<CheckpointAgent> agents(store.size());
+    for(int i = 0; i < store.size(); i++) // local rows come first, so restart reproduces the local order
+    {
+        CheckpointAgent& agent = agents[i];
+        std::memset(&agent, 0, sizeof(agent));
+        const repast::AgentId& id = store.owner[i]->getId();
+        agent.id           = id.id();
+        agent.startingRank = id.startingRank();
+        agent.type         = id.agentType();
+        agent.currentRank  = id.currentRank();
+        agent.c            = store.c[i];
+        agent.total        = store.total[i];
+        agent.commuteDist  = store.commuteDist[i];
+        agent.socNorm      = store.socNorm[i];
+        agent.age          = store.age[i];
+        agent.regionId     = store.regionId[i];
+        agent.cycles       = store.cycles[i];
+    }
+
+    std::vector<CheckpointEdge> edges;
+    edges.reserve(adjacency.edges() / 2);
+    for(int i = 0; i < adjacency.rows(); i++)
+    {
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            if(adjacency.neighbour[k] < i) continue; // undirected: each edge is listed by both of its ends
+            CheckpointEdge edge;
+            std::memset(&edge, 0, sizeof(edge));
+            edge.source     = i;
+            edge.target     = adjacency.neighbour[k];
+            edge.weight     = adjacency.weight[k];
+            edge.confidence = adjacency.confidence[k];
+            edges.push_back(edge);
+        }
+    }
+
+    const AggregatePartial& settled = store.aggregates.settled();
+    CheckpointAggregates totals;
+    std::memset(&totals, 0, sizeof(totals));
+    totals.cSum              = settled.c.sumPart();
+    totals.cCompensation     = settled.c.compensationPart();
+    totals.totalSum          = settled.total.sumPart();
+    totals.totalCompensation = settled.total.compensationPart();
+    totals.agents            = settled.agents;
+    totals.cyclists          = settled.cyclists;
+    std::vector<boost::int64_t> counts;
+    size_t regionSlots = slotCount(settled.regionAgents, settled.regionCyclists);
+    size_t bandSlots   = slotCount(settled.bandAgents, settled.bandCyclists);
+    for(size_t s = 0; s < regionSlots; s++)
+    {
+        counts.push_back(slot(settled.regionAgents, s));
+        counts.push_back(slot(settled.regionCyclists, s));
+    }
+    for(size_t s = 0; s < bandSlots; s++)
+    {
+        counts.push_back(slot(settled.bandAgents, s));
+        counts.push_back(slot(settled.bandCyclists, s));
+    }
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version           = 1;
+    header.rank              = (boost::uint32_t)rank;
+    header.worldSize         = (boost::uint32_t)worldSize;
+    header.seed              = seed;
+    header.tick              = tick;
+    header.localRows         = store.localCount();
+    header.ghostRows         = store.size() - store.localCount();
+    header.edgeCount         = edges.size();
+    header.regionCount       = (boost::uint32_t)store.regionCount();
+    header.regionSlots       = (boost::uint32_t)regionSlots;
+    header.bandSlots         = (boost::uint32_t)bandSlots;
+    header.regionTableOffset = align8(sizeof(CheckpointHeader));
+    header.agentsOffset      = align8(header.regionTableOffset + (boost::uint64_t)header.regionCount * REGION_NAME_LENGTH);
+    header.edgesOffset       = align8(header.agentsOffset + agents.size() * sizeof(CheckpointAgent));
+    header.aggregatesOffset  = align8(header.edgesOffset + edges.size() * sizeof(CheckpointEdge));
+
+    for(int r = 0; r < store.regionCount(); r++) // a cut name could intern as another region on restart
+    {
+        if(store.regionName(r).size() > (size_t)REGION_NAME_LENGTH) throw std::runtime_error("Region name " + store.regionName(r) + " is too long to checkpoint");
+    }
+
+    std::string partial = path + ".tmp"; // a crash while writing leaves the previous checkpoint intact
+    {
+        std::ofstream out(partial.c_str(), std::ios::binary | std::ios::trunc);
+        if(!out) throw std::runtime_error("Cannot write " + partial);
+        out.write((const char*)&header, sizeof(header));
+        for(int r = 0; r < store.regionCount(); r++)
+        {
+            char name[REGION_NAME_LENGTH];
+            std::memset(name, 0, sizeof(name));
+            std::strncpy(name, store.regionName(r).c_str(), REGION_NAME_LENGTH);
+            out.seekp(header.regionTableOffset + (boost::uint64_t)r * REGION_NAME_LENGTH);
+            out.write(name, REGION_NAME_LENGTH);
+        }
+        out.seekp(header.agentsOffset);
+        if(!agents.empty()) out.write((const char*)&agents[0], agents.size() * sizeof(CheckpointAgent));
+        out.seekp(header.edgesOffset);
+        if(!edges.empty()) out.write((const char*)&edges[0], edges.size() * sizeof(CheckpointEdge));
+        out.seekp(header.aggregatesOffset);
+        out.write((const char*)&totals, sizeof(totals));
+        if(!counts.empty()) out.write((const char*)&counts[0], counts.size() * sizeof(boost::int64_t));
+        if(!out) throw std::runtime_error("Failed writing " + partial);
+    }
+    if(std::rename(partial.c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot replace " + path);
+}
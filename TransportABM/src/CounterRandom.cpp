@@ -0,0 +1,83 @@
+/* CounterRandom.cpp */
+
+#include "CounterRandom.h"
+
+namespace {
+
+const boost::uint32_t PHILOX_M0 = 0xD2511F53;
+const boost::uint32_t PHILOX_M1 = 0xCD9E8D57;
+const boost::uint32_t PHILOX_W0 = 0x9E3779B9; // golden ratio
+const boost::uint32_t PHILOX_W1 = 0xBB67AE85; // sqrt(3) - 1
+
+inline void philoxRound(boost::uint32_t ctr[4], boost::uint32_t key[2])
+{
+    boost::uint64_t p0 = (boost::uint64_t)PHILOX_M0 * ctr[0];
+    boost::uint64_t p1 = (boost::uint64_t)PHILOX_M1 * ctr[2];
+    boost::uint32_t hi0 = (boost::uint32_t)(p0 >> 32), lo0 = (boost::uint32_t)p0;
+    boost::uint32_t hi1 = (boost::uint32_t)(p1 >> 32), lo1 = (boost::uint32_t)p1;
+    ctr[0] = hi1 ^ ctr[1] ^ key[0];
+    ctr[1] = lo1;
+    ctr[2] = hi0 ^ ctr[3] ^ key[1];
+    ctr[3] = lo0;
+}
+
+inline double toUnit(boost::uint32_t a, boost::uint32_t b) // 53 random bits mapped onto [0, 1)
+{
+    return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+}
+
+void CounterRandom::block(boost::uint32_t c0, boost::uint32_t c1, boost::uint32_t c2, boost::uint32_t c3, boost::uint32_t out[4]) const
+{
+    boost::uint32_t key[2] = { seed, stream };
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+    for(int round = 0; round < 10; round++)
+    {
+        philoxRound(out, key);
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+}
+
+double CounterRandom::uniform(boost::uint32_t a, boost::uint32_t b, boost::uint32_t c, boost::uint32_t draw) const
+{
+    boost::uint32_t out[4];
+    block(a, b, c, draw >> 1, out); // each block yields two doubles
+    return (draw & 1) ? toUnit(out[2], out[3]) : toUnit(out[0], out[1]);
+}
+
+double CounterRandom::uniform(const repast::AgentId& id, long tick, boost::uint32_t draw) const
+{
+    boost::uint32_t agent = (boost::uint32_t)id.startingRank() | ((boost::uint32_t)id.agentType() << 24);
+    return uniform((boost::uint32_t)id.id(), agent, (boost::uint32_t)tick, draw);
+}
+
+void CounterRandom::fill(const repast::AgentId& id, long tick, boost::uint32_t firstDraw, double* out, int count) const
+{
+    boost::uint32_t agent = (boost::uint32_t)id.startingRank() | ((boost::uint32_t)id.agentType() << 24);
+    boost::uint32_t words[4];
+    int n = 0;
+    boost::uint32_t draw = firstDraw;
+    if((draw & 1) && n < count) // leading odd draw uses the second half of its block
+    {
+        block((boost::uint32_t)id.id(), agent, (boost::uint32_t)tick, draw >> 1, words);
+        out[n++] = toUnit(words[2], words[3]);
+        draw++;
+    }
+    while(n + 1 < count) // whole blocks
+    {
+        block((boost::uint32_t)id.id(), agent, (boost::uint32_t)tick, draw >> 1, words);
+        out[n++] = toUnit(words[0], words[1]);
+        out[n++] = toUnit(words[2], words[3]);
+        draw += 2;
+    }
+    if(n < count)
+    {
+        block((boost::uint32_t)id.id(), agent, (boost::uint32_t)tick, draw >> 1, words);
+        out[n++] = toUnit(words[0], words[1]);
+    }
+}
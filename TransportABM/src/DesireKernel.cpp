@@ -0,0 +1,200 @@
+/* DesireKernel.cpp */
+
+#include <algorithm> // std::max, std::min
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "DesireKernel.h"
+
+DesireWeights::DesireWeights(): age(1), commuteDist(1), socNorm(1), region(1), popHealth(1), popSafety(1),
+    ageScale(80), distanceScale(10), threshold(3), populationHealth(0.5), populationSafety(0.5), regionNorm(0){ }
+
+DesireKernel::DesireKernel(): regionDesire(1, 0.5), flipLog(0){ }
+
+void DesireKernel::setRegionDesire(const std::vector<double>& desire, double unset)
+{
+    regionDesire.assign(1, unset);
+    regionDesire.insert(regionDesire.end(), desire.begin(), desire.end());
+}
+
+void DesireKernel::setMeanField(const std::vector<double>& share, double health, double safety)
+{
+    regionShare = share;
+    weights.populationHealth = health;
+    weights.populationSafety = safety;
+}
+
+const char* DesireKernel::instructionSet()
+{
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
+
+void DesireKernel::updateSocialNorms(const AgentAdjacency& adjacency, AgentStateStore& store, int first, int last) const
+{
+    const double field = regionShare.empty() ? 0 : weights.regionNorm;
+    const int maxRegion = (int)regionShare.size() - 1;
+    for(int i = first; i < last; i++)
+    {
+        double cycling = 0;
+        double all = 0;
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            double w = adjacency.weight[k];
+            cycling += w * store.cycles[adjacency.neighbour[k]];
+            all     += w;
+        }
+        double norm = (all > 0) ? cycling / all : 0;
+        if(field > 0) // agents without edges take their region's share alone
+        {
+            double share = regionShare[std::min(maxRegion, std::max(0, store.regionId[i] + 1))];
+            norm = (all > 0) ? (1 - field) * norm + field * share : share;
+        }
+        store.socNorm[i] = norm;
+    }
+}
+
+inline void DesireKernel::decide(AgentStateStore& store, int row, bool cycles, int worker) const
+{
+    unsigned char next = cycles ? 1 : 0;
+    if(store.cycles[row] == next) return;
+    store.aggregates.cyclesChanged(worker, store.age[row], store.regionId[row], cycles ? 1 : -1);
+    store.cycles[row] = next;
+    if(flipLog) (*flipLog)[worker].push_back(row);
+}
+
+void DesireKernel::evaluateScalar(AgentStateStore& store, int first, int last, int worker) const
+{
+    const double invAge  = 1.0 / weights.ageScale;
+    const double invDist = 1.0 / weights.distanceScale;
+    const int maxRegion  = (int)regionDesire.size() - 1;
+    const double health  = weights.populationHealth;
+    const double safety  = weights.populationSafety;
+    for(int i = first; i < last; i++)
+    {
+        double dAge    = std::max(0.0, 1.0 - store.age[i] * invAge);
+        double dDist   = 1.0 / (1.0 + store.commuteDist[i] * invDist);
+        double dNorm   = store.socNorm[i];
+        double dRegion = regionDesire[std::min(maxRegion, std::max(0, store.regionId[i] + 1))];
+
+        double utility = weights.age * dAge;
+        utility = utility + weights.commuteDist * dDist;
+        utility = utility + weights.socNorm * dNorm;
+        utility = utility + weights.region * dRegion;
+        utility = utility + weights.popHealth * health;
+        utility = utility + weights.popSafety * safety;
+
+        store.des_age[i]         = dAge;
+        store.des_commuteDist[i] = dDist;
+        store.des_socNorm[i]     = dNorm;
+        store.des_region[i]      = dRegion;
+        store.des_popHealth[i]   = health;
+        store.des_popSafety[i]   = safety;
+        decide(store, i, utility >= weights.threshold, worker);
+    }
+}
+
+void DesireKernel::evaluate(AgentStateStore& store, int first, int last, int worker) const
+{
+    int i = first;
+#if defined(__AVX512F__)
+    {
+        const __m512d one       = _mm512_set1_pd(1.0);
+        const __m512d zero      = _mm512_setzero_pd();
+        const __m512d invAge    = _mm512_set1_pd(1.0 / weights.ageScale);
+        const __m512d invDist   = _mm512_set1_pd(1.0 / weights.distanceScale);
+        const __m512d wAge      = _mm512_set1_pd(weights.age);
+        const __m512d wDist     = _mm512_set1_pd(weights.commuteDist);
+        const __m512d wNorm     = _mm512_set1_pd(weights.socNorm);
+        const __m512d wRegion   = _mm512_set1_pd(weights.region);
+        const __m512d health    = _mm512_set1_pd(weights.populationHealth);
+        const __m512d safety    = _mm512_set1_pd(weights.populationSafety);
+        const __m512d wHealth   = _mm512_set1_pd(weights.popHealth);
+        const __m512d wSafety   = _mm512_set1_pd(weights.popSafety);
+        const __m512d threshold = _mm512_set1_pd(weights.threshold);
+        const __m256i regionOne = _mm256_set1_epi32(1);
+        const __m256i regionMin = _mm256_setzero_si256();
+        const __m256i regionMax = _mm256_set1_epi32((int)regionDesire.size() - 1);
+        for(; i + 8 <= last; i += 8)
+        {
+            __m512d dAge  = _mm512_max_pd(zero, _mm512_sub_pd(one, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)&store.age[i])), invAge)));
+            __m512d dDist = _mm512_div_pd(one, _mm512_add_pd(one, _mm512_mul_pd(_mm512_loadu_pd(&store.commuteDist[i]), invDist)));
+            __m512d dNorm = _mm512_loadu_pd(&store.socNorm[i]);
+            __m256i slot  = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&store.regionId[i]), regionOne);
+            slot = _mm256_min_epi32(regionMax, _mm256_max_epi32(regionMin, slot));
+            __m512d dRegion = _mm512_i32gather_pd(slot, &regionDesire[0], 8);
+
+            __m512d utility = _mm512_mul_pd(wAge, dAge);
+            utility = _mm512_add_pd(utility, _mm512_mul_pd(wDist, dDist));
+            utility = _mm512_add_pd(utility, _mm512_mul_pd(wNorm, dNorm));
+            utility = _mm512_add_pd(utility, _mm512_mul_pd(wRegion, dRegion));
+            utility = _mm512_add_pd(utility, _mm512_mul_pd(wHealth, health));
+            utility = _mm512_add_pd(utility, _mm512_mul_pd(wSafety, safety));
+
+            _mm512_storeu_pd(&store.des_age[i], dAge);
+            _mm512_storeu_pd(&store.des_commuteDist[i], dDist);
+            _mm512_storeu_pd(&store.des_socNorm[i], dNorm);
+            _mm512_storeu_pd(&store.des_region[i], dRegion);
+            _mm512_storeu_pd(&store.des_popHealth[i], health);
+            _mm512_storeu_pd(&store.des_popSafety[i], safety);
+            __mmask8 cycling = _mm512_cmp_pd_mask(utility, threshold, _CMP_GE_OQ);
+            for(int k = 0; k < 8; k++) decide(store, i + k, (cycling >> k) & 1, worker);
+        }
+    }
+#elif defined(__AVX2__)
+    {
+        const __m256d one       = _mm256_set1_pd(1.0);
+        const __m256d zero      = _mm256_setzero_pd();
+        const __m256d invAge    = _mm256_set1_pd(1.0 / weights.ageScale);
+        const __m256d invDist   = _mm256_set1_pd(1.0 / weights.distanceScale);
+        const __m256d wAge      = _mm256_set1_pd(weights.age);
+        const __m256d wDist     = _mm256_set1_pd(weights.commuteDist);
+        const __m256d wNorm     = _mm256_set1_pd(weights.socNorm);
+        const __m256d wRegion   = _mm256_set1_pd(weights.region);
+        const __m256d health    = _mm256_set1_pd(weights.populationHealth);
+        const __m256d safety    = _mm256_set1_pd(weights.populationSafety);
+        const __m256d wHealth   = _mm256_set1_pd(weights.popHealth);
+        const __m256d wSafety   = _mm256_set1_pd(weights.popSafety);
+        const __m256d threshold = _mm256_set1_pd(weights.threshold);
+        const __m128i regionOne = _mm_set1_epi32(1);
+        const __m128i regionMin = _mm_setzero_si128();
+        const __m128i regionMax = _mm_set1_epi32((int)regionDesire.size() - 1);
+        for(; i + 4 <= last; i += 4)
+        {
+            __m256d dAge  = _mm256_max_pd(zero, _mm256_sub_pd(one, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)&store.age[i])), invAge)));
+            __m256d dDist = _mm256_div_pd(one, _mm256_add_pd(one, _mm256_mul_pd(_mm256_loadu_pd(&store.commuteDist[i]), invDist)));
+            __m256d dNorm = _mm256_loadu_pd(&store.socNorm[i]);
+            __m128i slot  = _mm_add_epi32(_mm_loadu_si128((const __m128i*)&store.regionId[i]), regionOne);
+            slot = _mm_min_epi32(regionMax, _mm_max_epi32(regionMin, slot));
+            __m256d dRegion = _mm256_i32gather_pd(&regionDesire[0], slot, 8);
+
+            __m256d utility = _mm256_mul_pd(wAge, dAge);
+            utility = _mm256_add_pd(utility, _mm256_mul_pd(wDist, dDist));
+            utility = _mm256_add_pd(utility, _mm256_mul_pd(wNorm, dNorm));
+            utility = _mm256_add_pd(utility, _mm256_mul_pd(wRegion, dRegion));
+            utility = _mm256_add_pd(utility, _mm256_mul_pd(wHealth, health));
+            utility = _mm256_add_pd(utility, _mm256_mul_pd(wSafety, safety));
+
+            _mm256_storeu_pd(&store.des_age[i], dAge);
+            _mm256_storeu_pd(&store.des_commuteDist[i], dDist);
+            _mm256_storeu_pd(&store.des_socNorm[i], dNorm);
+            _mm256_storeu_pd(&store.des_region[i], dRegion);
+            _mm256_storeu_pd(&store.des_popHealth[i], health);
+            _mm256_storeu_pd(&store.des_popSafety[i], safety);
+            int cycling = _mm256_movemask_pd(_mm256_cmp_pd(utility, threshold, _CMP_GE_OQ));
+            for(int k = 0; k < 4; k++) decide(store, i + k, (cycling >> k) & 1, worker);
+        }
+    }
+#endif
+    evaluateScalar(store, i, last, worker); // remainder
+}
+
+void DesireKernel::evaluateRows(AgentStateStore& store, const int* rows, int count, int worker) const
+{
+    for(int n = 0; n < count; n++) evaluateScalar(store, rows[n], rows[n] + 1, worker); // scattered rows gain nothing from the vector path
+}
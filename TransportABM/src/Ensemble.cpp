@@ -0,0 +1,226 @@
+/* Ensemble.cpp */
+
+#include <cstdio> // std::remove
+#include <cstring> // std::strchr, strnlen
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h> // mkdir
+#include "repast_hpc/RepastProcess.h"
+#include "repast_hpc/Utilities.h"
+#include "Ensemble.h"
+#include "Model.h"
+#include "CounterRandom.h"
+#include "OutputWriter.h"
+
+namespace {
+
+std::string trim(const std::string& text)
+{
+    size_t first = text.find_first_not_of(" \t");
+    if(first == std::string::npos) return "";
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+
+std::vector<std::string> split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    std::istringstream in(text);
+    std::string part;
+    while(std::getline(in, part, separator))
+    {
+        part = trim(part);
+        if(!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+}
+
+EnsembleRunner::EnsembleRunner(const std::string& config, const std::string& propsPath, int argc, char** argv, boost::mpi::communicator& worldComm):
+    world(worldComm), groups(1), groupIndex(0), baseSeed(1), configFile(config), propsFile(propsPath), props(0)
+{
+    props = new repast::Properties(propsFile, argc, argv, &world);
+    for(int a = 3; a < argc; a++) if(std::strchr(argv[a], '=') != 0) arguments.push_back(argv[a]);
+
+    groups = repast::strToInt(property("ensemble.groups", "1"));
+    if(groups < 1) groups = 1;
+    if(groups > world.size()) groups = world.size();
+    groupIndex = (int)((long)world.rank() * groups / world.size()); // contiguous blocks of ranks, so a group stays on few nodes
+    group = world.split(groupIndex);
+    groupSizes.assign(groups, 0);
+    for(int r = 0; r < world.size(); r++) groupSizes[(long)r * groups / world.size()]++;
+
+    baseSeed = repast::strToUInt(property("ensemble.seed", property("random.seed", "1")));
+    planReplicates();
+}
+
+EnsembleRunner::~EnsembleRunner()
+{
+    delete props;
+}
+
+std::string EnsembleRunner::property(const std::string& key, const std::string& fallback) const
+{
+    std::string value = props->getProperty(key);
+    return value.empty() ? fallback : value;
+}
+
+void EnsembleRunner::planReplicates()
+{
+    // ensemble.sweep = key:v1,v2,...;key:v1,v2,... and every combination of values is a point
+    std::vector<std::pair<std::string, std::vector<std::string> > > axes;
+    std::vector<std::string> items = split(property("ensemble.sweep", ""), ';');
+    int points = 1;
+    for(size_t a = 0; a < items.size(); a++)
+    {
+        size_t colon = items[a].find(':');
+        std::vector<std::string> values = (colon == std::string::npos) ? std::vector<std::string>() : split(items[a].substr(colon + 1), ',');
+        if(values.empty()) throw std::runtime_error("Malformed ensemble.sweep entry " + items[a]);
+        axes.push_back(std::make_pair(trim(items[a].substr(0, colon)), values));
+        points *= (int)values.size();
+    }
+
+    int perPoint = repast::strToInt(property("ensemble.replicates", "1"));
+    CounterRandom seeds(baseSeed, CounterRandom::ENSEMBLE_STREAM); // independent seeds that do not depend on the group layout
+    for(int p = 0; p < points; p++)
+    {
+        Replicate replicate;
+        replicate.point = p;
+        int rest = p;
+        for(int a = (int)axes.size() - 1; a >= 0; a--) // last axis varies fastest
+        {
+            const std::vector<std::string>& values = axes[a].second;
+            replicate.parameters.insert(replicate.parameters.begin(), std::make_pair(axes[a].first, values[rest % values.size()]));
+            rest /= (int)values.size();
+        }
+        for(int k = 0; k < perPoint; k++)
+        {
+            replicate.index = (int)replicates.size();
+            boost::uint32_t words[4];
+            seeds.block((boost::uint32_t)replicate.index, 0, 0, 0, words);
+            replicate.seed = words[0] != 0 ? words[0] : 1;
+            replicates.push_back(replicate);
+        }
+    }
+}
+
+std::string EnsembleRunner::partPath(int replicate) const
+{
+    std::ostringstream path;
+    path << property("ensemble.parts", "./output/ensemble") << "/rep" << replicate;
+    return path.str();
+}
+
+void EnsembleRunner::runReplicate(const Replicate& replicate)
+{
+    // The launch's own key=value arguments first, so the replicate's seed, sweep values and output paths win
+    std::vector<std::string> assignments(arguments);
+    std::ostringstream value;
+    value << "random.seed=" << replicate.seed; assignments.push_back(value.str()); value.str("");
+    if(property("ensemble.shared.network", "true") == "true")
+    {
+        value << "network.seed=" << property("network.seed", property("ensemble.seed", property("random.seed", "1")));
+        assignments.push_back(value.str());
+        value.str("");
+    }
+    for(size_t p = 0; p < replicate.parameters.size(); p++) assignments.push_back(replicate.parameters[p].first + "=" + replicate.parameters[p].second);
+    std::string part = partPath(replicate.index);
+    assignments.push_back("output.format=binary");
+    assignments.push_back("output.file=" + part);
+    assignments.push_back("output.record.file=" + part + ".record.csv");
+    assignments.push_back("output.results.file=" + part + ".results.csv");
+    assignments.push_back("instrumentation.file=" + part + ".instrumentation.csv");
+    assignments.push_back("trace.file=" + part + ".trace");
+    assignments.push_back("checkpoint.file=" + part + ".checkpoint");
+
+    std::vector<char*> modelArgv;
+    modelArgv.push_back(const_cast<char*>("transport_ensemble"));
+    modelArgv.push_back(const_cast<char*>(configFile.c_str()));
+    modelArgv.push_back(const_cast<char*>(propsFile.c_str()));
+    for(size_t a = 0; a < assignments.size(); a++) modelArgv.push_back(const_cast<char*>(assignments[a].c_str()));
+    modelArgv.push_back(0);
+
+    repast::RepastProcess::init(configFile, &group); // a fresh schedule and agent bookkeeping for every replicate
+    RepastHPCModel* model = new RepastHPCModel(propsFile, (int)modelArgv.size() - 1, &modelArgv[0], &group);
+    model->setNetworkCache(&networks);
+    repast::ScheduleRunner& runner = repast::RepastProcess::instance()->getScheduleRunner();
+    model->init();
+    model->initSchedule(runner);
+    runner.run();
+    delete model;
+    repast::RepastProcess::instance()->done();
+}
+
+void EnsembleRunner::run()
+{
+    if(world.rank() == 0) mkdir(property("ensemble.parts", "./output/ensemble").c_str(), 0755); // may exist already
+    world.barrier();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(size_t r = groupIndex; r < replicates.size(); r += groups) runReplicate(replicates[r]);
+
+    world.barrier();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(world.rank() != 0) return;
+    mergeOutput();
+    double perHour = seconds > 0 ? replicates.size() * 3600.0 / seconds : 0;
+    std::cout << "ENSEMBLE: " << replicates.size() << " replicates in " << seconds << " s on " << world.size() << " ranks in " << groups << " groups, "
+              << perHour << " replicates per hour, " << perHour / world.size() << " per rank hour, " << networks.size() << " networks generated by group 0" << std::endl;
+}
+
+void EnsembleRunner::mergeOutput() const
+{
+    std::string path = property("ensemble.output", "./output/ensemble.csv");
+    std::ofstream out(path.c_str());
+    if(!out) throw std::runtime_error("Cannot write " + path);
+    out.precision(std::numeric_limits<double>::digits10 + 2);
+    bool keepParts = property("ensemble.keep.parts", "false") == "true";
+
+    size_t width = 0;
+    for(size_t i = 0; i < replicates.size(); i++)
+    {
+        const Replicate& replicate = replicates[i];
+        int ranks = groupSizes[i % groups];
+        std::vector<BinaryOutput> parts(ranks);
+        std::vector<std::string> files(ranks);
+        for(int r = 0; r < ranks; r++)
+        {
+            std::ostringstream file;
+            file << partPath(replicate.index) << "." << r << ".bin";
+            files[r] = file.str();
+            readBinaryOutput(files[r], parts[r]);
+        }
+        BinaryOutput sum;
+        sumBinaryOutputs(parts, sum);
+
+        if(i == 0)
+        {
+            width = sum.columns.size();
+            out << "replicate,point,seed";
+            for(size_t p = 0; p < replicate.parameters.size(); p++) out << "," << replicate.parameters[p].first;
+            out << ",tick";
+            for(size_t c = 0; c < width; c++) out << "," << std::string(sum.columns[c].name, strnlen(sum.columns[c].name, sizeof(sum.columns[c].name)));
+            out << "\n";
+        }
+        if(sum.columns.size() != width) throw std::runtime_error(files[0] + " has different columns from the first replicate");
+
+        for(size_t row = 0; row < sum.ticks.size(); row++)
+        {
+            out << replicate.index << "," << replicate.point << "," << replicate.seed;
+            for(size_t p = 0; p < replicate.parameters.size(); p++) out << "," << replicate.parameters[p].second;
+            out << "," << sum.ticks[row];
+            for(size_t c = 0; c < width; c++)
+            {
+                if(sum.columns[c].type == OUTPUT_INT64) out << "," << (long long)sum.values[row * width + c].i;
+                else out << "," << sum.values[row * width + c].d;
+            }
+            out << "\n";
+        }
+        if(!keepParts) for(int r = 0; r < ranks; r++) std::remove(files[r].c_str());
+    }
+    if(!out) throw std::runtime_error("Failed writing " + path);
+}
@@ -0,0 +1,27 @@
+/* EnsembleMain.cpp */
+
+#include <iostream>
+#include <boost/mpi.hpp>
+
+#include "Ensemble.h"
+
+
+/* mpirun -np N transport_ensemble config.props model.props [key=value ...], see the ensemble.* properties */
+int main(int argc, char** argv)
+{
+	std::string configFile = argv[1]; // The name of the configuration file is Argument 1
+	std::string propsFile  = argv[2]; // The name of the properties file is Argument 2
+	boost::mpi::communicator world;
+	boost::mpi::environment env(argc, argv);
+
+	try
+	{
+		EnsembleRunner ensemble(configFile, propsFile, argc, argv, world); // each replicate starts its own RepastProcess on its group
+		ensemble.run();
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "ENSEMBLE: " << e.what() << std::endl;
+		world.abort(1);
+	}
+}
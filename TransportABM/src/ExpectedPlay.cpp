@@ -0,0 +1,115 @@
+/* ExpectedPlay.cpp */
+
+#include <algorithm> // std::min, std::max
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "ExpectedPlay.h"
+
+ExpectedPlay::ExpectedPlay(): builtFor(0), built(false){ }
+
+const char* ExpectedPlay::instructionSet()
+{
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
+
+void ExpectedPlay::refresh(const AgentAdjacency& adjacency, const AgentStateStore& store)
+{
+    probability.resize(store.size());
+    if(built && builtFor == adjacency.buildCount()) return;
+    coefficient.resize(adjacency.edges());
+    rowWeight.assign(adjacency.rows(), 0);
+    for(int i = 0; i < adjacency.rows(); i++)
+    {
+        double sum = 0;
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            double confidence = adjacency.confidence[k];
+            coefficient[k] = adjacency.weight[k] * confidence * confidence;
+            sum += coefficient[k];
+        }
+        rowWeight[i] = sum;
+    }
+    builtFor = adjacency.buildCount();
+    built = true;
+}
+
+void ExpectedPlay::refreshRows(const AgentAdjacency& adjacency, const std::vector<int>& rows)
+{
+    if(!built || builtFor != adjacency.buildCount()) return; // refresh() recomputes everything anyway
+    coefficient.resize(adjacency.edges());
+    rowWeight.resize(adjacency.rows(), 0);
+    for(size_t r = 0; r < rows.size(); r++)
+    {
+        int i = rows[r];
+        double sum = 0;
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            double confidence = adjacency.confidence[k];
+            coefficient[k] = adjacency.weight[k] * confidence * confidence;
+            sum += coefficient[k];
+        }
+        rowWeight[i] = sum;
+    }
+}
+
+void ExpectedPlay::updateProbabilities(const AgentStateStore& store, int first, int last)
+{
+    for(int i = first; i < last; i++) // as cooperates(): a draw below c / total, never for an empty total
+    {
+        double total = store.total[i];
+        probability[i] = (total > 0) ? std::min(1.0, std::max(0.0, store.c[i] / total)) : 0;
+    }
+}
+
+inline double ExpectedPlay::neighbourSum(const AgentAdjacency& adjacency, int row) const
+{
+    int k = adjacency.begin(row);
+    int end = adjacency.end(row);
+    const int* neighbour = adjacency.neighbour.empty() ? 0 : &adjacency.neighbour[0];
+    const double* a = coefficient.empty() ? 0 : &coefficient[0];
+    const double* q = probability.empty() ? 0 : &probability[0];
+    double sum = 0;
+#if defined(__AVX512F__)
+    __m512d lanes = _mm512_setzero_pd();
+    for(; k + 8 <= end; k += 8)
+    {
+        __m512d gathered = _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i*)&neighbour[k]), q, 8);
+        lanes = _mm512_fmadd_pd(_mm512_loadu_pd(&a[k]), gathered, lanes);
+    }
+    sum = _mm512_reduce_add_pd(lanes);
+#elif defined(__AVX2__)
+    __m256d lanes = _mm256_setzero_pd();
+    for(; k + 4 <= end; k += 4)
+    {
+        __m256d gathered = _mm256_i32gather_pd(q, _mm_loadu_si128((const __m128i*)&neighbour[k]), 8);
+        lanes = _mm256_add_pd(lanes, _mm256_mul_pd(_mm256_loadu_pd(&a[k]), gathered));
+    }
+    double partial[4];
+    _mm256_storeu_pd(partial, lanes);
+    sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+    for(; k < end; k++) sum += a[k] * q[neighbour[k]]; // remainder
+    return sum;
+}
+
+void ExpectedPlay::play(const AgentAdjacency& adjacency, AgentStateStore& store, const int* rows, int count) const
+{
+    for(int n = 0; n < count; n++)
+    {
+        int i = rows[n];
+        double p = probability[i];
+        double all = rowWeight[i];
+        double sum = neighbourSum(adjacency, i);
+        double cPayoff = p * (all + 6 * sum); // mutual cooperation 7, cooperating against defection 1
+        double totalPayoff = cPayoff + (1 - p) * (3 * all + 7 * sum); // mutual defection 3, defecting against cooperation 10
+        store.cNext[i]     = store.c[i] + cPayoff;
+        store.totalNext[i] = store.total[i] + totalPayoff;
+    }
+}
@@ -0,0 +1,346 @@
+/* GhostExchange.cpp */
+
+#include <algorithm> // std::sort, std::set_difference
+#include <iterator> // std::back_inserter
+#include <cstring> // std::memcpy
+#include "GhostExchange.h"
+#include "Agent.h"
+#include "BufferExchange.h" // countMessage, exchangeBuffers
+
+namespace {
+
+const int GHOST_KEYS_TAG  = 7101; // registration keys, importer to owner
+const int GHOST_STATE_TAG = 7102; // per exchange state records, owner to importer
+const int GHOST_CHANGES_TAG = 7103; // added and cancelled keys, importer to owner
+
+struct RegistrationChange // one key added to or cancelled from a registration
+{
+    boost::int32_t id;
+    boost::int32_t startingRank;
+    boost::int32_t type;
+    boost::int32_t cancelled;
+};
+
+struct KeyOrder
+{
+    bool operator()(const repast::AgentId& x, const repast::AgentId& y) const
+    {
+        if(x.startingRank() != y.startingRank()) return x.startingRank() < y.startingRank();
+        if(x.id() != y.id()) return x.id() < y.id();
+        return x.agentType() < y.agentType();
+    }
+};
+
+bool sameState(const GhostStateRecord& a, const GhostStateRecord& b)
+{
+    return a.c == b.c && a.total == b.total && a.socNorm == b.socNorm && a.regionId == b.regionId && a.cycles == b.cycles;
+}
+
+}
+
+GhostExchange::GhostExchange(boost::mpi::communicator* comm): comm(comm), resolvedLayout(0), registrations(0), registered(false), inFlight(false), messages(0), bytes(0){ }
+
+void GhostExchange::registerGhosts(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store)
+{
+    int worldSize = comm->size();
+    int rank = comm->rank();
+
+    // Group our ghosts by the rank that owns them
+    std::vector<std::vector<repast::AgentId> > byOwner(worldSize);
+    for(int i = store.localCount(); i < store.size(); i++)
+    {
+        const repast::AgentId& id = store.owner[i]->getId();
+        byOwner[id.currentRank()].push_back(id);
+    }
+    std::vector<int> sendCounts(worldSize), receiveCounts(worldSize);
+    for(int r = 0; r < worldSize; r++)
+    {
+        std::sort(byOwner[r].begin(), byOwner[r].end(), KeyOrder());
+        sendCounts[r] = (int)byOwner[r].size();
+    }
+    boost::mpi::all_to_all(*comm, sendCounts, receiveCounts); // owners learn who will register with them
+
+    // Ship each owner the keys once
+    imports.clear();
+    std::vector<std::vector<int> > flatKeys;
+    flatKeys.reserve(worldSize);
+    std::vector<boost::mpi::request> requests;
+    for(int r = 0; r < worldSize; r++)
+    {
+        if(sendCounts[r] == 0) continue;
+        Peer peer;
+        peer.rank = r;
+        peer.keys = byOwner[r];
+        imports.push_back(peer);
+
+        flatKeys.push_back(std::vector<int>());
+        std::vector<int>& flat = flatKeys.back();
+        flat.reserve(3 * peer.keys.size());
+        for(size_t k = 0; k < peer.keys.size(); k++)
+        {
+            flat.push_back(peer.keys[k].id());
+            flat.push_back(peer.keys[k].startingRank());
+            flat.push_back(peer.keys[k].agentType());
+        }
+        requests.push_back(comm->isend(r, GHOST_KEYS_TAG, &flat[0], (int)flat.size()));
+        countMessage(flat.size() * sizeof(int));
+    }
+
+    exports.clear();
+    std::vector<int> flat;
+    for(int r = 0; r < worldSize; r++)
+    {
+        if(receiveCounts[r] == 0) continue;
+        flat.resize(3 * receiveCounts[r]);
+        comm->recv(r, GHOST_KEYS_TAG, &flat[0], (int)flat.size());
+        Peer peer;
+        peer.rank = r;
+        for(int k = 0; k < receiveCounts[r]; k++) peer.keys.push_back(repast::AgentId(flat[3 * k], flat[3 * k + 1], flat[3 * k + 2], rank));
+        peer.lastSent.resize(peer.keys.size());
+        peer.sent.assign(peer.keys.size(), 0); // first exchange ships everything
+        exports.push_back(peer);
+    }
+    boost::mpi::wait_all(requests.begin(), requests.end());
+
+    sendBuffers.resize(exports.size());
+    receiveBuffers.resize(imports.size());
+    for(size_t p = 0; p < imports.size(); p++) receiveBuffers[p].resize(imports[p].keys.size() * sizeof(GhostStateRecord));
+    registered = true;
+    registrations++;
+    resolveRows(context, store);
+}
+
+void GhostExchange::registerChanges(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store)
+{
+    if(!registered)
+    {
+        registerGhosts(context, store);
+        return;
+    }
+    int worldSize = comm->size();
+    int rank = comm->rank();
+    KeyOrder order;
+
+    // Our ghosts and the keys registered for them, by owner
+    std::vector<std::vector<repast::AgentId> > current(worldSize), registeredKeys(worldSize);
+    for(int i = store.localCount(); i < store.size(); i++)
+    {
+        const repast::AgentId& id = store.owner[i]->getId();
+        current[id.currentRank()].push_back(id);
+    }
+    for(size_t p = 0; p < imports.size(); p++) registeredKeys[imports[p].rank] = imports[p].keys;
+
+    // Ship each owner the differences: cancelled keys first, then the added ones in the order they are appended
+    std::vector<std::vector<char> > send(worldSize), received;
+    for(int r = 0; r < worldSize; r++)
+    {
+        std::sort(current[r].begin(), current[r].end(), order);
+        std::sort(registeredKeys[r].begin(), registeredKeys[r].end(), order);
+        std::vector<repast::AgentId> cancelled, added;
+        std::set_difference(registeredKeys[r].begin(), registeredKeys[r].end(), current[r].begin(), current[r].end(), std::back_inserter(cancelled), order);
+        std::set_difference(current[r].begin(), current[r].end(), registeredKeys[r].begin(), registeredKeys[r].end(), std::back_inserter(added), order);
+        for(size_t k = 0; k < cancelled.size(); k++)
+        {
+            RegistrationChange change = { cancelled[k].id(), cancelled[k].startingRank(), cancelled[k].agentType(), 1 };
+            appendRecord(send[r], change);
+        }
+        for(size_t k = 0; k < added.size(); k++)
+        {
+            RegistrationChange change = { added[k].id(), added[k].startingRank(), added[k].agentType(), 0 };
+            appendRecord(send[r], change);
+        }
+    }
+    exchangeBuffers(*comm, send, received, GHOST_CHANGES_TAG);
+
+    bool exportsChanged = false;
+    for(int r = 0; r < worldSize; r++)
+    {
+        applyChanges(imports, r, r, send[r], false);
+        exportsChanged = applyChanges(exports, r, rank, received[r], true) || exportsChanged;
+    }
+
+    sendBuffers.resize(exports.size());
+    receiveBuffers.resize(imports.size());
+    for(size_t p = 0; p < imports.size(); p++) receiveBuffers[p].resize(imports[p].keys.size() * sizeof(GhostStateRecord));
+    if(exportsChanged) registrations++;
+    resolveRows(context, store);
+}
+
+bool GhostExchange::applyChanges(std::vector<Peer>& peers, int peerRank, int ownerRank, const std::vector<char>& changes, bool exporting)
+{
+    size_t count = recordCount<RegistrationChange>(changes);
+    if(count == 0) return false;
+    KeyOrder order;
+
+    // Peers stay in rank order, as registerGhosts() lists them
+    size_t p = 0;
+    while(p < peers.size() && peers[p].rank < peerRank) p++;
+    if(p == peers.size() || peers[p].rank != peerRank)
+    {
+        Peer peer;
+        peer.rank = peerRank;
+        peers.insert(peers.begin() + p, peer);
+    }
+    Peer& peer = peers[p];
+
+    std::vector<repast::AgentId> cancelled, added;
+    for(size_t c = 0; c < count; c++)
+    {
+        RegistrationChange change = readRecord<RegistrationChange>(changes, c);
+        repast::AgentId id(change.id, change.startingRank, change.type, ownerRank);
+        if(change.cancelled) cancelled.push_back(id);
+        else added.push_back(id);
+    }
+    std::sort(cancelled.begin(), cancelled.end(), order);
+
+    // Surviving slots keep their order and, on the exporting side, what was last sent for them
+    size_t kept = 0;
+    for(size_t k = 0; k < peer.keys.size(); k++)
+    {
+        if(std::binary_search(cancelled.begin(), cancelled.end(), peer.keys[k], order)) continue;
+        peer.keys[kept] = peer.keys[k];
+        if(exporting)
+        {
+            peer.lastSent[kept] = peer.lastSent[k];
+            peer.sent[kept]     = peer.sent[k];
+        }
+        kept++;
+    }
+    peer.keys.resize(kept);
+    peer.keys.insert(peer.keys.end(), added.begin(), added.end());
+    if(exporting)
+    {
+        peer.lastSent.resize(peer.keys.size());
+        peer.sent.resize(kept);
+        peer.sent.resize(peer.keys.size(), 0); // new slots ship their full state first
+    }
+    if(peer.keys.empty()) peers.erase(peers.begin() + p); // both sides drop the peer, so no empty messages are exchanged
+    return true;
+}
+
+void GhostExchange::resolveRows(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store)
+{
+    std::vector<Peer>* sides[2] = { &exports, &imports };
+    for(int s = 0; s < 2; s++)
+    {
+        std::vector<Peer>& peers = *sides[s];
+        for(size_t p = 0; p < peers.size(); p++)
+        {
+            Peer& peer = peers[p];
+            peer.rows.resize(peer.keys.size());
+            for(size_t k = 0; k < peer.keys.size(); k++)
+            {
+                RepastHPCAgent* agent = context.getAgent(peer.keys[k]);
+                peer.rows[k] = (agent == 0) ? -1 : agent->getStoreIndex(); // -1: removed since registration
+            }
+        }
+    }
+    resolvedLayout = store.layoutVersion();
+}
+
+void GhostExchange::packRecord(const AgentStateStore& store, int row, boost::uint32_t slot, GhostStateRecord& record) const
+{
+    std::memset(&record, 0, sizeof(record));
+    record.slot     = slot;
+    record.regionId = store.regionId[row];
+    record.c        = store.cNext[row];
+    record.total    = store.totalNext[row];
+    record.socNorm  = store.socNorm[row];
+    record.cycles   = store.cycles[row];
+}
+
+void GhostExchange::beginExchange(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store)
+{
+    if(!registered) return;
+    if(resolvedLayout != store.layoutVersion()) resolveRows(context, store);
+
+    // Post every receive first, an owner sends at most one record per slot
+    receiveRequests.clear();
+    for(size_t p = 0; p < imports.size(); p++)
+    {
+        std::vector<char>& buffer = receiveBuffers[p];
+        receiveRequests.push_back(comm->irecv(imports[p].rank, GHOST_STATE_TAG, buffer.data(), (int)buffer.size()));
+    }
+
+    // Pack and send the changed exports, one message per importing rank (possibly empty)
+    sendRequests.clear();
+    for(size_t p = 0; p < exports.size(); p++)
+    {
+        Peer& peer = exports[p];
+        std::vector<char>& buffer = sendBuffers[p];
+        buffer.clear();
+        GhostStateRecord record;
+        for(size_t k = 0; k < peer.keys.size(); k++)
+        {
+            if(peer.rows[k] < 0) continue;
+            packRecord(store, peer.rows[k], (boost::uint32_t)k, record);
+            if(peer.sent[k] && sameState(record, peer.lastSent[k])) continue;
+            peer.lastSent[k] = record;
+            peer.sent[k] = 1;
+            size_t at = buffer.size();
+            buffer.resize(at + sizeof(GhostStateRecord));
+            std::memcpy(&buffer[at], &record, sizeof(GhostStateRecord));
+        }
+        sendRequests.push_back(comm->isend(peer.rank, GHOST_STATE_TAG, buffer.data(), (int)buffer.size()));
+        messages++;
+        bytes += buffer.size();
+        countMessage(buffer.size());
+    }
+    inFlight = true;
+}
+
+void GhostExchange::finishExchange(AgentStateStore& store)
+{
+    if(!inFlight) return;
+    inFlight = false;
+    changedCycles.clear();
+
+    // Apply what the owners sent, in peer order so the result does not depend on arrival order
+    for(size_t p = 0; p < imports.size(); p++)
+    {
+        Peer& peer = imports[p];
+        boost::mpi::status status = receiveRequests[p].wait();
+        int size = status.count<char>() ? *status.count<char>() : 0;
+        const std::vector<char>& buffer = receiveBuffers[p];
+        GhostStateRecord record;
+        for(int at = 0; at + (int)sizeof(GhostStateRecord) <= size; at += sizeof(GhostStateRecord))
+        {
+            std::memcpy(&record, &buffer[at], sizeof(GhostStateRecord));
+            int row = peer.rows[record.slot];
+            if(row < 0) continue;
+            store.c[row]        = record.c;
+            store.total[row]    = record.total;
+            store.socNorm[row]  = record.socNorm;
+            store.regionId[row] = record.regionId;
+            if(store.cycles[row] != record.cycles) changedCycles.push_back(row);
+            store.cycles[row]   = record.cycles;
+        }
+    }
+    boost::mpi::wait_all(sendRequests.begin(), sendRequests.end());
+    std::sort(changedCycles.begin(), changedCycles.end()); // by row, not by registration slot, so incremental and fresh registrations push flips alike
+}
+
+void GhostExchange::markExported(repast::SharedContext<RepastHPCAgent>& context, const AgentStateStore& store, std::vector<unsigned char>& flags)
+{
+    if(!registered) return;
+    if(resolvedLayout != store.layoutVersion()) resolveRows(context, store);
+    for(size_t p = 0; p < exports.size(); p++)
+    {
+        const Peer& peer = exports[p];
+        for(size_t k = 0; k < peer.rows.size(); k++) if(peer.rows[k] >= 0) flags[peer.rows[k]] = 1;
+    }
+}
+
+int GhostExchange::exportCount() const
+{
+    int count = 0;
+    for(size_t p = 0; p < exports.size(); p++) count += (int)exports[p].keys.size();
+    return count;
+}
+
+int GhostExchange::importCount() const
+{
+    int count = 0;
+    for(size_t p = 0; p < imports.size(); p++) count += (int)imports[p].keys.size();
+    return count;
+}
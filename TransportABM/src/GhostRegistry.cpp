@@ -0,0 +1,99 @@
+/* GhostRegistry.cpp */
+
+#include "GhostRegistry.h"
+#include "Agent.h"
+
+boost::uint64_t GhostRegistry::key(const repast::AgentId& id)
+{
+    return ((boost::uint64_t)(boost::uint32_t)id.startingRank() << 40) | ((boost::uint64_t)(id.agentType() & 0xFF) << 32) | (boost::uint32_t)id.id();
+}
+
+void GhostRegistry::addEdge(const repast::AgentId& remote)
+{
+    EntryMap::iterator found = entries.find(key(remote));
+    if(found == entries.end())
+    {
+        Entry entry;
+        entry.id       = remote;
+        entry.edges    = 0;
+        entry.imported = false;
+        found = entries.insert(std::make_pair(key(remote), entry)).first;
+    }
+    found->second.edges++;
+}
+
+void GhostRegistry::removeEdge(const repast::AgentId& remote)
+{
+    EntryMap::iterator found = entries.find(key(remote));
+    if(found == entries.end() || found->second.edges == 0) return;
+    found->second.edges--;
+    if(found->second.edges == 0 && !found->second.imported) entries.erase(found); // requested and dropped before it was sent
+}
+
+void GhostRegistry::rebuild(const AgentStateStore& store, const AgentAdjacency& adjacency)
+{
+    for(EntryMap::iterator e = entries.begin(); e != entries.end(); ) // pending requests survive, imports are recounted
+    {
+        if(e->second.imported) e = entries.erase(e);
+        else ++e;
+    }
+    for(int row = store.localCount(); row < store.size(); row++)
+    {
+        Entry entry;
+        entry.id       = store.owner[row]->getId();
+        entry.edges    = 0;
+        entry.imported = true;
+        entries[key(entry.id)] = entry;
+    }
+    for(int row = 0; row < store.localCount(); row++)
+    {
+        entries.erase(key(store.owner[row]->getId())); // a pending request for an agent that has since migrated here
+        for(int k = adjacency.begin(row); k < adjacency.end(row); k++)
+        {
+            int other = adjacency.neighbour[k];
+            if(!store.isLocal(other)) entries[key(store.owner[other]->getId())].edges++;
+        }
+    }
+}
+
+int GhostRegistry::takeRequests(repast::AgentRequest& request)
+{
+    int count = 0;
+    for(EntryMap::iterator e = entries.begin(); e != entries.end(); ++e)
+    {
+        if(e->second.imported || e->second.edges == 0) continue;
+        request.addRequest(e->second.id);
+        e->second.imported = true;
+        count++;
+    }
+    return count;
+}
+
+int GhostRegistry::takeCancellations(repast::AgentRequest& request)
+{
+    int count = 0;
+    for(EntryMap::iterator e = entries.begin(); e != entries.end(); )
+    {
+        if(e->second.imported && e->second.edges == 0)
+        {
+            request.addCancellation(e->second.id);
+            e = entries.erase(e);
+            count++;
+        }
+        else ++e;
+    }
+    return count;
+}
+
+int GhostRegistry::importCount() const
+{
+    int count = 0;
+    for(EntryMap::const_iterator e = entries.begin(); e != entries.end(); ++e) if(e->second.imported) count++;
+    return count;
+}
+
+int GhostRegistry::edgeCount(const repast::AgentId& remote) const
+{
+    EntryMap::const_iterator found = entries.find(key(remote));
+    return found == entries.end() ? 0 : found->second.edges;
+}
@@ -0,0 +1,272 @@
+/* GraphPartitioner.cpp */
+
+#include <algorithm> // std::swap, std::max
+#include "GraphPartitioner.h"
+
+namespace {
+
+const int COARSEST_PER_PART = 20; // stop coarsening once the graph has about this many vertices per part
+const int REFINE_PASSES     = 8;
+
+unsigned int nextRandom(unsigned int& state) // xorshift, only used to order the matching
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+long totalWeight(const PartitionGraph& graph)
+{
+    long total = 0;
+    for(size_t v = 0; v < graph.vertexWeights.size(); v++) total += graph.vertexWeights[v];
+    return total;
+}
+
+}
+
+GraphPartitioner::GraphPartitioner(int parts, double imbalance, unsigned int seed): parts(parts), imbalance(imbalance), seed(seed == 0 ? 1 : seed){ }
+
+std::vector<int> GraphPartitioner::partition(const PartitionGraph& graph) const
+{
+    std::vector<int> part(graph.vertices(), 0);
+    if(parts <= 1 || graph.vertices() == 0) return part;
+
+    // Coarsening: keep every level and the fine to coarse vertex map
+    std::vector<PartitionGraph> levels(1, graph);
+    std::vector<std::vector<int> > maps;
+    int maxVertexWeight = (int)std::max(1L, (long)(1.5 * totalWeight(graph) / (COARSEST_PER_PART * parts)));
+    while(levels.back().vertices() > COARSEST_PER_PART * parts)
+    {
+        PartitionGraph coarse;
+        std::vector<int> coarseOf;
+        coarsen(levels.back(), coarse, coarseOf, maxVertexWeight);
+        if(coarse.vertices() > 0.9 * levels.back().vertices()) break; // matching has stalled
+        levels.push_back(coarse);
+        maps.push_back(coarseOf);
+    }
+
+    // Initial partition of the coarsest graph, then project and refine back up
+    std::vector<int> coarsePart;
+    initialPartition(levels.back(), coarsePart);
+    refine(levels.back(), coarsePart, REFINE_PASSES);
+    for(int level = (int)maps.size() - 1; level >= 0; level--)
+    {
+        std::vector<int> finePart(levels[level].vertices());
+        for(int v = 0; v < levels[level].vertices(); v++) finePart[v] = coarsePart[maps[level][v]];
+        refine(levels[level], finePart, REFINE_PASSES);
+        coarsePart.swap(finePart);
+    }
+    return coarsePart;
+}
+
+void GraphPartitioner::coarsen(const PartitionGraph& fine, PartitionGraph& coarse, std::vector<int>& coarseOf, int maxVertexWeight) const
+{
+    int n = fine.vertices();
+
+    // Heavy edge matching in a shuffled vertex order
+    std::vector<int> order(n);
+    for(int v = 0; v < n; v++) order[v] = v;
+    unsigned int state = seed + (unsigned int)n;
+    for(int v = n - 1; v > 0; v--) std::swap(order[v], order[nextRandom(state) % (v + 1)]);
+
+    std::vector<int> match(n, -1);
+    for(int i = 0; i < n; i++)
+    {
+        int v = order[i];
+        if(match[v] != -1) continue;
+        int best = v;
+        int bestWeight = -1;
+        for(int k = fine.offsets[v]; k < fine.offsets[v + 1]; k++)
+        {
+            int u = fine.adjacency[k];
+            if(u == v || match[u] != -1) continue;
+            if(fine.vertexWeights[v] + fine.vertexWeights[u] > maxVertexWeight) continue;
+            if(fine.edgeWeights[k] > bestWeight)
+            {
+                best = u;
+                bestWeight = fine.edgeWeights[k];
+            }
+        }
+        match[v] = best;
+        match[best] = v;
+    }
+
+    // Number the coarse vertices
+    coarseOf.assign(n, -1);
+    int coarseCount = 0;
+    for(int v = 0; v < n; v++)
+    {
+        if(coarseOf[v] != -1) continue;
+        coarseOf[v] = coarseCount;
+        coarseOf[match[v]] = coarseCount;
+        coarseCount++;
+    }
+
+    // Merge the adjacency of each matched pair, summing parallel edges
+    coarse.offsets.assign(1, 0);
+    coarse.adjacency.clear();
+    coarse.edgeWeights.clear();
+    coarse.vertexWeights.assign(coarseCount, 0);
+    std::vector<int> position(coarseCount, -1); // where a coarse neighbour sits in the row being built
+    int next = 0;
+    for(int v = 0; v < n; v++)
+    {
+        if(coarseOf[v] != next) continue; // each coarse vertex is built once, from its lowest numbered member
+        int members[2] = { v, match[v] };
+        int memberCount = (match[v] == v) ? 1 : 2;
+        int rowStart = (int)coarse.adjacency.size();
+        for(int m = 0; m < memberCount; m++)
+        {
+            int f = members[m];
+            coarse.vertexWeights[next] += fine.vertexWeights[f];
+            for(int k = fine.offsets[f]; k < fine.offsets[f + 1]; k++)
+            {
+                int cu = coarseOf[fine.adjacency[k]];
+                if(cu == next) continue; // collapsed edge
+                if(position[cu] >= rowStart)
+                {
+                    coarse.edgeWeights[position[cu]] += fine.edgeWeights[k];
+                }
+                else
+                {
+                    position[cu] = (int)coarse.adjacency.size();
+                    coarse.adjacency.push_back(cu);
+                    coarse.edgeWeights.push_back(fine.edgeWeights[k]);
+                }
+            }
+        }
+        coarse.offsets.push_back((int)coarse.adjacency.size());
+        next++;
+    }
+}
+
+void GraphPartitioner::initialPartition(const PartitionGraph& graph, std::vector<int>& part) const
+{
+    // Breadth first order keeps neighbouring vertices together, then cut it into k runs of equal weight
+    int n = graph.vertices();
+    std::vector<int> order;
+    order.reserve(n);
+    std::vector<unsigned char> seen(n, 0);
+    for(int start = 0; start < n; start++)
+    {
+        if(seen[start]) continue;
+        seen[start] = 1;
+        size_t head = order.size();
+        order.push_back(start);
+        while(head < order.size())
+        {
+            int v = order[head++];
+            for(int k = graph.offsets[v]; k < graph.offsets[v + 1]; k++)
+            {
+                int u = graph.adjacency[k];
+                if(seen[u]) continue;
+                seen[u] = 1;
+                order.push_back(u);
+            }
+        }
+    }
+
+    long total = totalWeight(graph);
+    long cumulative = 0;
+    part.assign(n, 0);
+    for(int i = 0; i < n; i++)
+    {
+        int v = order[i];
+        part[v] = (int)std::min((long)parts - 1, (cumulative * parts) / std::max(1L, total));
+        cumulative += graph.vertexWeights[v];
+    }
+}
+
+void GraphPartitioner::refine(const PartitionGraph& graph, std::vector<int>& part, int passes) const
+{
+    int n = graph.vertices();
+    long maxPartWeight = (long)((1.0 + imbalance) * totalWeight(graph) / parts) + 1;
+    std::vector<long> partWeight(parts, 0);
+    for(int v = 0; v < n; v++) partWeight[part[v]] += graph.vertexWeights[v];
+
+    std::vector<int> connection(parts, 0); // edge weight from the current vertex into each part
+    std::vector<int> touched;
+    for(int pass = 0; pass < passes; pass++)
+    {
+        int moves = 0;
+        for(int v = 0; v < n; v++)
+        {
+            int from = part[v];
+            touched.clear();
+            for(int k = graph.offsets[v]; k < graph.offsets[v + 1]; k++)
+            {
+                int p = part[graph.adjacency[k]];
+                if(connection[p] == 0) touched.push_back(p);
+                connection[p] += graph.edgeWeights[k];
+            }
+
+            int internal = connection[from];
+            int best = from;
+            long bestGain = 0;
+            bool overweight = partWeight[from] > maxPartWeight; // allow losing moves to restore balance
+            for(size_t t = 0; t < touched.size(); t++)
+            {
+                int p = touched[t];
+                if(p == from || partWeight[p] + graph.vertexWeights[v] > maxPartWeight) continue;
+                long gain = connection[p] - internal;
+                bool better = (best == from) ? (gain > 0 || (gain == 0 && partWeight[p] + graph.vertexWeights[v] < partWeight[from]) || overweight)
+                                             : (gain > bestGain || (gain == bestGain && partWeight[p] < partWeight[best]));
+                if(better)
+                {
+                    best = p;
+                    bestGain = gain;
+                }
+            }
+            for(size_t t = 0; t < touched.size(); t++) connection[touched[t]] = 0;
+
+            if(best != from)
+            {
+                part[v] = best;
+                partWeight[from] -= graph.vertexWeights[v];
+                partWeight[best] += graph.vertexWeights[v];
+                moves++;
+            }
+        }
+        if(moves == 0) break;
+    }
+}
+
+long GraphPartitioner::edgeCut(const PartitionGraph& graph, const std::vector<int>& part)
+{
+    long cut = 0;
+    for(int v = 0; v < graph.vertices(); v++)
+    {
+        for(int k = graph.offsets[v]; k < graph.offsets[v + 1]; k++)
+        {
+            if(part[graph.adjacency[k]] != part[v]) cut += graph.edgeWeights[k];
+        }
+    }
+    return cut / 2; // each edge is listed from both ends
+}
+
+long GraphPartitioner::ghostCount(const PartitionGraph& graph, const std::vector<int>& part, int parts)
+{
+    long ghosts = 0;
+    std::vector<int> stamp(parts, -1); // last vertex that counted each part
+    for(int v = 0; v < graph.vertices(); v++)
+    {
+        for(int k = graph.offsets[v]; k < graph.offsets[v + 1]; k++)
+        {
+            int p = part[graph.adjacency[k]];
+            if(p == part[v] || stamp[p] == v) continue;
+            stamp[p] = v; // v is ghosted on part p
+            ghosts++;
+        }
+    }
+    return ghosts;
+}
+
+double GraphPartitioner::balance(const PartitionGraph& graph, const std::vector<int>& part, int parts)
+{
+    std::vector<long> partWeight(parts, 0);
+    for(int v = 0; v < graph.vertices(); v++) partWeight[part[v]] += graph.vertexWeights[v];
+    long heaviest = *std::max_element(partWeight.begin(), partWeight.end());
+    double mean = (double)totalWeight(graph) / parts;
+    return mean > 0 ? heaviest / mean : 1.0;
+}
@@ -0,0 +1,135 @@
+/* Instrumentation.cpp */
+
+#include "Instrumentation.h"
+
+#ifdef TRANSPORT_INSTRUMENTATION
+
+#include <algorithm> // std::min
+#include <fstream>
+#include <iostream>
+
+TickInstrumentation::TickInstrumentation(): ring(1), recorded(0), tickPhase(0), waitPhase(-1), startCycles(cycles()), startTime(std::chrono::steady_clock::now()){ }
+
+void TickInstrumentation::configure(int phases, int tick, int wait, size_t samples)
+{
+    ring.assign(samples > 0 ? samples : 1, PhaseSample());
+    recorded = 0;
+    phaseCycles.assign(phases, 0);
+    phaseCalls.assign(phases, 0);
+    phaseMessages.assign(phases, 0);
+    phaseBytes.assign(phases, 0);
+    tickPhase = tick;
+    waitPhase = wait;
+    startCycles = cycles();
+    startTime = std::chrono::steady_clock::now();
+}
+
+double TickInstrumentation::secondsPerCycle() const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    boost::uint64_t elapsed = cycles() - startCycles;
+    return elapsed > 0 ? seconds / elapsed : 0;
+}
+
+void TickInstrumentation::report(boost::mpi::communicator& comm, const std::vector<std::string>& phaseNames, const std::string& path) const
+{
+    int phases = (int)phaseCycles.size();
+    if(phases == 0) return;
+    double scale = secondsPerCycle();
+
+    // Per phase totals over the run
+    std::vector<double> seconds(phases), minSeconds(phases), maxSeconds(phases), sumSeconds(phases);
+    for(int p = 0; p < phases; p++) seconds[p] = phaseCycles[p] * scale;
+    boost::mpi::reduce(comm, &seconds[0], phases, &minSeconds[0], boost::mpi::minimum<double>(), 0);
+    boost::mpi::reduce(comm, &seconds[0], phases, &maxSeconds[0], boost::mpi::maximum<double>(), 0);
+    boost::mpi::reduce(comm, &seconds[0], phases, &sumSeconds[0], std::plus<double>(), 0);
+    std::vector<boost::uint64_t> traffic(2 * phases), sumTraffic(2 * phases);
+    for(int p = 0; p < phases; p++)
+    {
+        traffic[2 * p]     = phaseMessages[p];
+        traffic[2 * p + 1] = phaseBytes[p];
+    }
+    boost::mpi::reduce(comm, &traffic[0], 2 * phases, &sumTraffic[0], std::plus<boost::uint64_t>(), 0);
+
+    // Busy time of each tick still in the ring, oldest first
+    size_t kept = (size_t)std::min<boost::uint64_t>(recorded, ring.size());
+    bool partial = recorded > ring.size(); // the oldest tick may have lost its wait samples to the ring
+    std::vector<double> ticks, busy;
+    boost::uint64_t waiting = 0;
+    for(size_t k = 0; k < kept; k++)
+    {
+        const PhaseSample& sample = ring[(recorded - kept + k) % ring.size()];
+        if((int)sample.phase == waitPhase) waiting += sample.cycles;
+        if((int)sample.phase != tickPhase) continue; // a tick's inner phases finish before it does
+        if(!partial)
+        {
+            ticks.push_back(sample.tick);
+            busy.push_back((sample.cycles > waiting ? sample.cycles - waiting : 0) * scale);
+        }
+        waiting = 0;
+        partial = false;
+    }
+    int tickCount = (int)ticks.size(), commonTicks = 0; // ranks run the same schedule, but only compare what all of them hold
+    boost::mpi::all_reduce(comm, tickCount, commonTicks, boost::mpi::minimum<int>());
+    ticks.erase(ticks.begin(), ticks.begin() + (tickCount - commonTicks));
+    busy.erase(busy.begin(), busy.begin() + (tickCount - commonTicks));
+    std::vector<double> maxBusy(commonTicks), sumBusy(commonTicks);
+    if(commonTicks > 0)
+    {
+        boost::mpi::reduce(comm, &busy[0], commonTicks, &maxBusy[0], boost::mpi::maximum<double>(), 0);
+        boost::mpi::reduce(comm, &busy[0], commonTicks, &sumBusy[0], std::plus<double>(), 0);
+    }
+
+    // Agents and ghosts as of the last sample
+    int counts[2] = { 0, 0 };
+    if(recorded > 0)
+    {
+        const PhaseSample& last = ring[(recorded - 1) % ring.size()];
+        counts[0] = last.agents;
+        counts[1] = last.ghosts;
+    }
+    int minCounts[2], maxCounts[2], sumCounts[2];
+    boost::mpi::reduce(comm, counts, 2, minCounts, boost::mpi::minimum<int>(), 0);
+    boost::mpi::reduce(comm, counts, 2, maxCounts, boost::mpi::maximum<int>(), 0);
+    boost::mpi::reduce(comm, counts, 2, sumCounts, std::plus<int>(), 0);
+
+    if(comm.rank() != 0) return;
+    int ranks = comm.size();
+    std::cout << "INSTRUMENTATION: phase, calls, seconds min/mean/max over " << ranks << " ranks, messages, bytes" << std::endl;
+    for(int p = 0; p < phases; p++)
+    {
+        if(phaseCalls[p] == 0) continue;
+        std::cout << "  " << (p < (int)phaseNames.size() ? phaseNames[p] : "phase") << ", " << phaseCalls[p] << ", "
+                  << minSeconds[p] << "/" << sumSeconds[p] / ranks << "/" << maxSeconds[p] << ", "
+                  << sumTraffic[2 * p] << ", " << sumTraffic[2 * p + 1] << std::endl;
+    }
+    std::cout << "INSTRUMENTATION: agents min/mean/max " << minCounts[0] << "/" << (double)sumCounts[0] / ranks << "/" << maxCounts[0]
+              << ", ghosts " << minCounts[1] << "/" << (double)sumCounts[1] / ranks << "/" << maxCounts[1] << std::endl;
+
+    double meanImbalance = 0, worstImbalance = 0, worstTick = 0;
+    std::vector<double> imbalance(commonTicks, 1.0);
+    for(int t = 0; t < commonTicks; t++)
+    {
+        double mean = sumBusy[t] / ranks;
+        if(mean > 0) imbalance[t] = maxBusy[t] / mean;
+        meanImbalance += imbalance[t];
+        if(imbalance[t] > worstImbalance)
+        {
+            worstImbalance = imbalance[t];
+            worstTick = ticks[t];
+        }
+    }
+    if(commonTicks > 0)
+    {
+        std::cout << "INSTRUMENTATION: load imbalance (max/mean busy time) mean " << meanImbalance / commonTicks << ", worst "
+                  << worstImbalance << " at tick " << worstTick << ", over the last " << commonTicks << " ticks" << std::endl;
+    }
+
+    if(path.empty()) return;
+    std::ofstream out(path.c_str());
+    out << "tick,maxBusySeconds,meanBusySeconds,imbalance\n";
+    for(int t = 0; t < commonTicks; t++) out << ticks[t] << "," << maxBusy[t] << "," << sumBusy[t] / ranks << "," << imbalance[t] << "\n";
+    if(!out) std::cerr << "Cannot write " << path << std::endl;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/* LoadBalancer.cpp */
+
+#include <algorithm> // std::max, std::min, std::sort
+#include "LoadBalancer.h"
+
+namespace {
+
+struct Share // a rank's surplus or deficit in seconds per tick
+{
+    int rank;
+    double seconds;
+
+    bool operator<(const Share& other) const { return seconds != other.seconds ? seconds > other.seconds : rank < other.rank; } // largest first, ties by rank
+};
+
+}
+
+LoadBalancer::LoadBalancer(double threshold, double target, double smoothing, double maxFraction, int cooldown):
+    threshold(threshold), target(std::min(target, threshold)), smoothing(smoothing), maxFraction(maxFraction), cooldown(cooldown), waiting(0){ }
+
+double LoadBalancer::imbalanceOf(const std::vector<double>& seconds)
+{
+    if(seconds.empty()) return 1.0;
+    double sum = 0, heaviest = 0;
+    for(size_t r = 0; r < seconds.size(); r++)
+    {
+        sum += seconds[r];
+        heaviest = std::max(heaviest, seconds[r]);
+    }
+    return sum > 0 ? heaviest * seconds.size() / sum : 1.0;
+}
+
+bool LoadBalancer::observe(const std::vector<double>& seconds)
+{
+    if(smoothed.size() != seconds.size()) smoothed = seconds; // first measurement
+    else for(size_t r = 0; r < seconds.size(); r++) smoothed[r] = smoothing * seconds[r] + (1 - smoothing) * smoothed[r];
+    if(waiting > 0)
+    {
+        waiting--;
+        return false;
+    }
+    return imbalance() > threshold;
+}
+
+std::vector<std::vector<double> > LoadBalancer::plan(const std::vector<double>& units, std::vector<double>& predicted)
+{
+    int ranks = (int)smoothed.size();
+    std::vector<std::vector<double> > transfer(ranks, std::vector<double>(ranks, 0));
+    predicted = smoothed;
+    double mean = 0, totalUnits = 0;
+    for(int r = 0; r < ranks; r++)
+    {
+        mean += smoothed[r];
+        totalUnits += units[r];
+    }
+    mean /= std::max(1, ranks);
+    if(mean <= 0 || totalUnits <= 0) return transfer;
+
+    // Seconds per unit on each rank, which differ when ranks differ in speed or in their agents' mix
+    std::vector<double> cost(ranks);
+    for(int r = 0; r < ranks; r++) cost[r] = units[r] > 0 ? smoothed[r] / units[r] : mean * ranks / totalUnits;
+
+    std::vector<Share> sources, sinks;
+    for(int r = 0; r < ranks; r++)
+    {
+        Share share = { r, smoothed[r] - mean };
+        if(smoothed[r] > target * mean) sources.push_back(share);
+        else if(smoothed[r] < mean) { share.seconds = -share.seconds; sinks.push_back(share); }
+    }
+    std::sort(sources.begin(), sources.end());
+    std::sort(sinks.begin(), sinks.end());
+
+    // Heaviest source to neediest sink, until either runs out
+    std::vector<double> budget(ranks);
+    for(int r = 0; r < ranks; r++) budget[r] = maxFraction * units[r];
+    size_t s = 0, d = 0;
+    while(s < sources.size() && d < sinks.size())
+    {
+        Share& source = sources[s];
+        Share& sink = sinks[d];
+        double amount = std::min(std::min(source.seconds / cost[source.rank], sink.seconds / cost[sink.rank]), budget[source.rank]);
+        if(amount > 0)
+        {
+            transfer[source.rank][sink.rank] += amount;
+            budget[source.rank] -= amount;
+            source.seconds -= amount * cost[source.rank];
+            sink.seconds   -= amount * cost[sink.rank];
+            predicted[source.rank] -= amount * cost[source.rank];
+            predicted[sink.rank]   += amount * cost[sink.rank];
+        }
+        if(source.seconds <= 0 || budget[source.rank] <= 0) s++;
+        if(sink.seconds <= 0) d++;
+        if(amount <= 0 && s < sources.size() && d < sinks.size()) s++; // nothing left to give
+    }
+    return transfer;
+}
+
+void LoadBalancer::moved(const std::vector<double>& predicted)
+{
+    smoothed = predicted; // measurements from before the move would otherwise pull the next decision
+    waiting = cooldown;
+}
@@ -1,6 +1,11 @@
 /* Model.cpp */
 
 #include <stdio.h>// include standard c input output library
+#include <algorithm> // std::sort
+#include <cmath> // std::floor
+#include <stdexcept>
+#include <chrono> // phase timings
+#include <sstream> // data set column names
 #include <vector> // includes vector header file so can be used to store agents. Enables easy agent iteration
 #include <boost/mpi.hpp> //include boost mpi wrapper
 #include "repast_hpc/AgentId.h"
@@ -10,106 +15,399 @@
 #include "repast_hpc/initialize_random.h" // Provides methods for generating pseudo random numbers
 #include "repast_hpc/SVDataSetBuilder.h" // Used to build SVDataSets to record data in plain text tabular format
 
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp> // population file mapping in createAgents
+#include <boost/unordered_map.hpp>
+#include <boost/serialization/vector.hpp> // gather and scatter of the placement graph
+
 #include "Model.h"
+#include "GraphPartitioner.h"
+#include "RowOrdering.h"
+#include "NetworkGenerator.h"
+#include "Population.h"
+#include "Checkpoint.h"
+#include "BufferExchange.h"
 
 
 BOOST_CLASS_EXPORT_GUID(repast::SpecializedProjectionInfoPacket<ModelCustomEdgeContent<RepastHPCAgent> >, "SpecializedProjectionInfoPacket_CUSTOM_EDGE");
 
+namespace {
+
+boost::uint64_t placementKey(int id, int startingRank, int type) // packs an AgentId into one integer for the placement vertex map
+{
+    return ((boost::uint64_t)(boost::uint32_t)startingRank << 40) | ((boost::uint64_t)(type & 0xFF) << 32) | (boost::uint32_t)id;
+}
+
+/* Plays a chunk of a list of local rows on one worker; results go to the store's next buffers */
+class PlayTask : public ParallelTask
+{
+    AgentStateStore& store;
+    const std::vector<int>& rows;
+    const AgentAdjacency& adjacency;
+    const CounterRandom& random;
+    long tick;
+    std::vector<std::vector<double> >& draws;
+
+public:
+    PlayTask(AgentStateStore& s, const std::vector<int>& w, const AgentAdjacency& a, const CounterRandom& r, long t, std::vector<std::vector<double> >& d):
+        store(s), rows(w), adjacency(a), random(r), tick(t), draws(d){ }
+
+    void run(int first, int last, int worker)
+    {
+        for(int i = first; i < last; i++) store.owner[rows[i]]->play(adjacency, random, tick, draws[worker]);
+    }
+};
+
+/* Computes the cooperation probabilities of a chunk of rows, local and ghost */
+class ProbabilityTask : public ParallelTask
+{
+    const AgentStateStore& store;
+    ExpectedPlay& engine;
+
+public:
+    ProbabilityTask(const AgentStateStore& s, ExpectedPlay& e): store(s), engine(e){ }
+
+    void run(int first, int last, int worker)
+    {
+        engine.updateProbabilities(store, first, last);
+    }
+};
+
+/* Adds the expected payoffs of a chunk of a list of local agents into their next buffers */
+class ExpectedPlayTask : public ParallelTask
+{
+    AgentStateStore& store;
+    const std::vector<int>& rows;
+    const AgentAdjacency& adjacency;
+    const ExpectedPlay& engine;
+
+public:
+    ExpectedPlayTask(AgentStateStore& s, const std::vector<int>& w, const AgentAdjacency& a, const ExpectedPlay& e): store(s), rows(w), adjacency(a), engine(e){ }
+
+    void run(int first, int last, int worker)
+    {
+        engine.play(adjacency, store, &rows[first], last - first);
+    }
+};
+
+/* Copies a chunk of next buffers into the current state */
+class CommitTask : public ParallelTask
+{
+    AgentStateStore& store;
+
+public:
+    CommitTask(AgentStateStore& s): store(s){ }
+
+    void run(int first, int last, int worker)
+    {
+        store.commitLocal(first, last, worker);
+    }
+};
+
+/* Recomputes the perceived social norm of a chunk of local agents from their neighbours' cycles state */
+class NormTask : public ParallelTask
+{
+    AgentStateStore& store;
+    const AgentAdjacency& adjacency;
+    const DesireKernel& kernel;
+
+public:
+    NormTask(AgentStateStore& s, const AgentAdjacency& a, const DesireKernel& k): store(s), adjacency(a), kernel(k){ }
+
+    void run(int first, int last, int worker)
+    {
+        kernel.updateSocialNorms(adjacency, store, first, last);
+    }
+};
+
+/* Evaluates the desires and cycles decision of a chunk of local agents */
+class DesireTask : public ParallelTask
+{
+    AgentStateStore& store;
+    const DesireKernel& kernel;
+
+public:
+    DesireTask(AgentStateStore& s, const DesireKernel& k): store(s), kernel(k){ }
+
+    void run(int first, int last, int worker)
+    {
+        kernel.evaluate(store, first, last, worker);
+    }
+};
+
+/* Evaluates the desires and cycles decision of a chunk of a list of local agents */
+class DirtyDesireTask : public ParallelTask
+{
+    AgentStateStore& store;
+    const std::vector<int>& rows;
+    const DesireKernel& kernel;
+
+public:
+    DirtyDesireTask(AgentStateStore& s, const std::vector<int>& r, const DesireKernel& k): store(s), rows(r), kernel(k){ }
+
+    void run(int first, int last, int worker)
+    {
+        kernel.evaluateRows(store, &rows[first], last - first, worker);
+    }
+};
+
+/* Records the state of the sampled agents in a chunk of local rows */
+class TraceTask : public ParallelTask
+{
+    const AgentStateStore& store;
+    TraceWriter& trace;
+    int every;
+    double tick;
+
+public:
+    TraceTask(const AgentStateStore& s, TraceWriter& t, int e, double k): store(s), trace(t), every(e), tick(k){ }
+
+    void run(int first, int last, int worker)
+    {
+        for(int i = first; i < last; i++)
+        {
+            const repast::AgentId& id = store.owner[i]->getId();
+            if(id.id() % every != 0) continue;
+            trace.record(worker, TRACE_STATE, tick, id.id(), id.startingRank(), id.agentType(), store.c[i], store.total[i], store.cycles[i] != 0);
+        }
+    }
+};
+
+typedef ModelCustomEdge<RepastHPCAgent> AgentEdge;
+
+boost::shared_ptr<AgentEdge> newEdge(RepastHPCAgent* source, RepastHPCAgent* target, double weight, int confidence) // edge and count in one pooled block
+{
+    return boost::allocate_shared<AgentEdge>(SlabAllocator<AgentEdge>(), source, target, weight, confidence);
+}
+
+double scheduleTick() // tick stamped on binary output rows
+{
+    return repast::RepastProcess::instance()->getScheduleRunner().currentTick();
+}
+
+typedef std::chrono::steady_clock PhaseClock;
+
+double lap(PhaseClock::time_point& mark) // seconds since mark, and moves mark to now
+{
+    PhaseClock::time_point now = PhaseClock::now();
+    double seconds = std::chrono::duration<double>(now - mark).count();
+    mark = now;
+    return seconds;
+}
+
+/* Runs a scheduled functor and counts its time against one phase */
+class TimedFunctor : public repast::Functor
+{
+    repast::Schedule::FunctorPtr functor;
+    int phase;
+    PhaseTimes& times;
+    TickInstrumentation& instrumentation;
+    const AgentStateStore& store;
+
+public:
+    TimedFunctor(repast::Schedule::FunctorPtr f, int p, PhaseTimes& t, TickInstrumentation& i, const AgentStateStore& s):
+        functor(f), phase(p), times(t), instrumentation(i), store(s){ }
+
+    void operator()()
+    {
+        PhaseClock::time_point mark = PhaseClock::now();
+        PhaseCounters start = instrumentation.start();
+        PoolTraffic pool = poolTraffic();
+        (*functor)();
+        times.seconds[phase] += lap(mark);
+        times.addAllocations(phase, pool);
+        instrumentation.finish(phase, scheduleTick(), start, store.localCount(), store.size() - store.localCount());
+    }
+};
+
+/* Region of a network vertex, sent to the ranks holding edges to it */
+struct VertexRegion
+{
+    boost::int64_t vertex;
+    boost::int32_t region;
+    boost::int32_t padding;
+};
+
+const int VERTEX_REGION_TAG = 7301;
+
+const double REWIRE_OFFSET = 0.7; // queued edge changes are applied at tick + 0.7, after the update, recording and output
+const double BALANCE_OFFSET = 0.8; // balance checks run at tick + 0.8, after the update, recording and output
+const double CHECKPOINT_OFFSET = 0.9; // checkpoints are taken at tick + 0.9, after the update, recording and output
+
+const int PLAY_GRAIN = 256; // agents claimed per chunk by a worker, a multiple of the desire kernel's vector width
+
+}
+
 RepastHPCAgentPackageProvider::RepastHPCAgentPackageProvider(repast::SharedContext<RepastHPCAgent>* agentPtr): agents(agentPtr){ }
 
 void RepastHPCAgentPackageProvider::providePackage(RepastHPCAgent * agent, std::vector<RepastHPCAgentPackage>& out)
 {
     repast::AgentId id = agent->getId();
     RepastHPCAgentPackage package(id.id(), id.startingRank(), id.agentType(), id.currentRank(), agent->getC(), agent->getTotal());
+    package.age         = agent->getAge();
+    package.commuteDist = agent->getcommuteDist();
+    package.socNorm     = agent->getSocNorm();
+    package.regionId    = agent->getRegionId();
+    package.cycles      = agent->getCycles();
     out.push_back(package);
 }
 
-void RepastHPCAgentPackageProvider::provideContent(repast::AgentRequest req, std::vector<RepastHPCAgentPackage>& out)
+void RepastHPCAgentPackageProvider::provideContent(const repast::AgentRequest& req, std::vector<RepastHPCAgentPackage>& out)
 {
-    std::vector<repast::AgentId> ids = req.requestedAgents();
+    const std::vector<repast::AgentId>& ids = req.requestedAgents();
+    requested.clear(); // keeps its capacity from earlier requests
+    requested.reserve(ids.size());
     for(size_t i = 0; i < ids.size(); i++)
     {
-        providePackage(agents->getAgent(ids[i]), out);
+        RepastHPCAgent* agent = agents->getAgent(ids[i]);
+        requested.push_back(std::make_pair(agent->getStoreIndex(), agent));
+    }
+    std::sort(requested.begin(), requested.end());
+    out.reserve(out.size() + requested.size());
+    for(size_t i = 0; i < requested.size(); i++)
+    {
+        providePackage(requested[i].second, out);
     }
 }
 
 
-RepastHPCAgentPackageReceiver::RepastHPCAgentPackageReceiver(repast::SharedContext<RepastHPCAgent>* agentPtr): agents(agentPtr){}
+RepastHPCAgentPackageReceiver::RepastHPCAgentPackageReceiver(repast::SharedContext<RepastHPCAgent>* agentPtr, AgentStateStore* storePtr): agents(agentPtr), store(storePtr){}
 
-RepastHPCAgent * RepastHPCAgentPackageReceiver::createAgent(RepastHPCAgentPackage package)
+RepastHPCAgent * RepastHPCAgentPackageReceiver::createAgent(const RepastHPCAgentPackage& package)
 {
     repast::AgentId id(package.id, package.rank, package.type, package.currentRank);
-    return new RepastHPCAgent(id, package.c, package.total);
+    RepastHPCAgent * agent = new RepastHPCAgent(id, store, package.c, package.total);
+    applyPackage(agent, package);
+    return agent;
 }
 
-void RepastHPCAgentPackageReceiver::updateAgent(RepastHPCAgentPackage package)
+void RepastHPCAgentPackageReceiver::updateAgent(const RepastHPCAgentPackage& package)
 {
     repast::AgentId id(package.id, package.rank, package.type);
     RepastHPCAgent * agent = agents->getAgent(id);
     agent->set(package.currentRank, package.c, package.total);
+    applyPackage(agent, package);
+}
+
+void RepastHPCAgentPackageReceiver::applyPackage(RepastHPCAgent * agent, const RepastHPCAgentPackage& package)
+{
+    int row = agent->getStoreIndex();
+    store->aggregates.remove(*store, row);
+    store->age[row]         = package.age;
+    store->commuteDist[row] = package.commuteDist;
+    store->socNorm[row]     = package.socNorm;
+    store->regionId[row]    = package.regionId;
+    store->cycles[row]      = package.cycles ? 1 : 0;
+    store->aggregates.add(*store, row);
 }
 
 
 
-DataSource_AgentTotals::DataSource_AgentTotals(repast::SharedContext<RepastHPCAgent>* c) : context(c){ }
+DataSource_AgentTotals::DataSource_AgentTotals(AgentStateStore* s) : store(s){ }
 
-int DataSource_AgentTotals::getData()
+double DataSource_AgentTotals::getData()
 {
-	int sum = 0;
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iter    = context->localBegin();
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iterEnd = context->localEnd();
-	while( iter != iterEnd)
-    {
-		sum+= (*iter)->getTotal();
-		iter++;
-	}
-	return sum;
+	store->aggregates.settle();
+	return store->aggregates.sumTotal(); // maintained as agents update and migrate, no scan
 }
 
-DataSource_AgentCTotals::DataSource_AgentCTotals(repast::SharedContext<RepastHPCAgent>* c) : context(c){ }
+DataSource_AgentCTotals::DataSource_AgentCTotals(AgentStateStore* s) : store(s){ }
 
-int DataSource_AgentCTotals::getData()
+double DataSource_AgentCTotals::getData()
 {
-	int sum = 0;
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iter    = context->localBegin();
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iterEnd = context->localEnd();
-	while( iter != iterEnd)
-    {
-		sum+= (*iter)->getC();
-		iter++;
-	}
-	return sum;
+	store->aggregates.settle();
+	return store->aggregates.sumC();
 }
 
+DataSource_Cyclists::DataSource_Cyclists(AgentStateStore* s) : store(s){ }
 
-RepastHPCModel::RepastHPCModel(std::string propsFile, int argc, char** argv, boost::mpi::communicator* comm): context(comm) //argc argv added so that properties can be entered via command line if wanted.
+boost::int64_t DataSource_Cyclists::getData()
+{
+	store->aggregates.settle();
+	return store->aggregates.cyclists();
+}
+
+DataSource_RegionCyclists::DataSource_RegionCyclists(AgentStateStore* s, int r) : store(s), region(r){ }
+
+boost::int64_t DataSource_RegionCyclists::getData()
+{
+	store->aggregates.settle();
+	return store->aggregates.regionCyclists(region);
+}
+
+DataSource_AgeBandCyclists::DataSource_AgeBandCyclists(AgentStateStore* s, int b) : store(s), band(b){ }
+
+boost::int64_t DataSource_AgeBandCyclists::getData()
+{
+	store->aggregates.settle();
+	return store->aggregates.bandCyclists(band);
+}
+
+
+RepastHPCModel::RepastHPCModel(std::string propsFile, int argc, char** argv, boost::mpi::communicator* comm): agentStore(repast::RepastProcess::instance()->rank()), context(comm) //argc argv added so that properties can be entered via command line if wanted.
 {
 	props = new repast::Properties(propsFile, argc, argv, comm); // property object instantiated  with propsfile name, mpi communicator and main arguments. Mpi comm added so props file only has to be read once
 	stopAt = repast::strToInt(props->getProperty("stop.at")); // stopAt var initialised based on property file value.
 	countOfAgents = repast::strToInt(props->getProperty("count.of.agents"));
 	initializeRandom(*props, comm); //initialises random number generator and takes mpi communicator to pass random seed across processes.
-	if(repast::RepastProcess::instance()->rank() == 0) props->writeToSVFile("./output/record.csv"); // writes the properties from the props file to csv file each time simulation is run.
+	playRandom = CounterRandom(repast::strToUInt(props->getProperty("random.seed")), CounterRandom::PLAY_STREAM); // initializeRandom records the shared seed in random.seed
+	if(repast::RepastProcess::instance()->rank() == 0) props->writeToSVFile(stringProperty("output.record.file", "./output/record.csv")); // writes the properties from the props file to csv file each time simulation is run.
+	int threads = intProperty("threads.per.rank", 1);
+	threadPool = new TickThreadPool(threads); // hybrid mode: each rank updates its agents on this many threads
+	playDraws.resize(threadPool->size());
 	provider = new RepastHPCAgentPackageProvider(&context);
-	receiver = new RepastHPCAgentPackageReceiver(&context);
+	receiver = new RepastHPCAgentPackageReceiver(&context, &agentStore);
+	ghostExchange = new GhostExchange(comm);
+	agentStore.aggregates.configure(intProperty("data.age.band.width", 10), intProperty("data.age.bands", 10), threadPool->size());
+	trace = 0;
+	networkCache = 0;
+	traceEvery = intProperty("trace.sample.agents", 100) > 0 ? intProperty("trace.sample.agents", 100) : 1;
+	traceInterval = intProperty("trace.sample.ticks", 1) > 0 ? intProperty("trace.sample.ticks", 1) : 1;
+	loadBalancer = 0;
+	if(intProperty("balance.interval", 0) > 0)
+        {
+		loadBalancer = new LoadBalancer(doubleProperty("balance.threshold", 1.10), doubleProperty("balance.target", 1.03), doubleProperty("balance.smoothing", 0.5),
+		                                doubleProperty("balance.max.fraction", 0.1), intProperty("balance.cooldown", 2));
+	}
+	balancedSeconds = 0;
+	balancedTicks = 0;
+	balanceMoved = false;
+	edgeUpdates = 0;
+	rewireFraction = 0;
+	edgesAdded = 0;
+	edgesRemoved = 0;
+	rewireRandom = CounterRandom(repast::strToUInt(props->getProperty("random.seed")), CounterRandom::REWIRE_STREAM);
+	if(stringProperty("rewire.enabled", "false") == "true")
+        {
+		edgeUpdates = new EdgeUpdateBatch(comm->size());
+		rewireFraction = doubleProperty("rewire.fraction", 0);
+		adjacency.setSlack(intProperty("rewire.slack", 2)); // room in every row so most changes are made in place
+	}
+	if(stringProperty("trace.enabled", "false") == "true")
+        {
+		std::ostringstream path;
+		path << stringProperty("trace.file", "./output/trace") << "." << repast::RepastProcess::instance()->rank() << ".trc";
+		trace = new TraceWriter(path.str(), repast::RepastProcess::instance()->rank(), repast::RepastProcess::instance()->worldSize(),
+		                        threadPool->size(), intProperty("trace.ring.records", 65536), intProperty("trace.flush.ms", 50));
+	}
+	instrumentation.configure(PhaseTimes::PHASE_COUNT, PhaseTimes::TICK, PhaseTimes::EXCHANGE, intProperty("instrumentation.samples", 65536)); // ranks wait for each other in the exchange
 
     agentNetwork = new repast::SharedNetwork<RepastHPCAgent, ModelCustomEdge<RepastHPCAgent>, ModelCustomEdgeContent<RepastHPCAgent>, ModelCustomEdgeContentManager<RepastHPCAgent> >("agentNetwork", false, &edgeContentManager);
 	context.addProjection(agentNetwork);
-
-	// Data collection
-	// Create the data set builder
-	std::string fileOutputName("./output/agent_total_data.csv"); // string to hold file directory data should be written to
-	repast::SVDataSetBuilder builder(fileOutputName.c_str(), ",", repast::RepastProcess::instance()->getScheduleRunner().schedule()); // instantiate SVDataSetBuilder, specifying file to write to.
-
-	// Create the individual data sets to be added to the builder
-	DataSource_AgentTotals* agentTotals_DataSource = new DataSource_AgentTotals(&context);
-	builder.addDataSource(createSVDataSource("Total", agentTotals_DataSource, std::plus<int>()));
-
-	DataSource_AgentCTotals* agentCTotals_DataSource = new DataSource_AgentCTotals(&context);
-	builder.addDataSource(createSVDataSource("C", agentCTotals_DataSource, std::plus<int>()));
-
-	// Use the builder to create the data set
-	agentValues = builder.createDataSet();
-
+	agentValues = 0; // built by init() once the regions are known
+	binaryValues = 0;
+	resumeTick = 0;
+	classifiedBuild = 0;
+	classifiedRegistration = 0;
+	classifiedStale = false;
+	overlapExchange = (stringProperty("exchange.overlap", "true") != "false");
+	expectedPayoffs = (stringProperty("play.mode", "sampled") == "expected");
+	meanField = (stringProperty("meanfield.enabled", "false") == "true");
+	healthGain = doubleProperty("meanfield.health.gain", 0);
+	safetyGain = doubleProperty("meanfield.safety.gain", 0);
+	populationHealth = 0;
+	populationSafety = 0;
+	incrementalNorms = false; // decided with the desire weights
 }
 
 RepastHPCModel::~RepastHPCModel() // Model destructor to run on program completion to delete objects
@@ -118,21 +416,353 @@ RepastHPCModel::~RepastHPCModel() // Model destructor to run on program completi
 	delete provider;
 	delete receiver;
 	delete agentValues;
+	delete binaryValues;
+	delete threadPool;
+	delete ghostExchange;
+	delete loadBalancer;
+	delete edgeUpdates;
+	delete trace;
+}
+
+PhaseTimes::PhaseTimes(): ticks(0)
+{
+	for(int p = 0; p < PHASE_COUNT; p++)
+        {
+		seconds[p] = 0;
+		allocations[p] = 0;
+		slabs[p] = 0;
+	}
+}
+
+void PhaseTimes::addAllocations(int phase, const PoolTraffic& since)
+{
+	allocations[phase] += poolTraffic().allocations - since.allocations;
+	slabs[phase]       += poolTraffic().slabsAllocated - since.slabsAllocated;
+}
+
+const char* PhaseTimes::name(int phase)
+{
+	static const char* names[PHASE_COUNT] = { "init", "updateGhosts", "connectAgentNetwork", "placeAgents", "renumberAgents", "refreshAdjacency", "play", "commit", "exchange", "norms", "desires",
+	                                          "trace", "tick", "record", "output", "rewireAgentNetwork", "balanceAgents", "writeCheckpoint" };
+	return names[phase];
 }
 
 void RepastHPCModel::init() //initialise the repast model. Populates model with agents
+{
+	PhaseClock::time_point mark = PhaseClock::now();
+	PoolTraffic pool = poolTraffic();
+	std::string restart = stringProperty("checkpoint.restart", "");
+	if(!restart.empty()) restoreCheckpoint(checkpointPath(restart)); // continue a saved run instead of building one
+	else createAgents();
+	loadDesireWeights();
+	buildDataSet();
+	phaseTimes.seconds[PhaseTimes::INIT] += lap(mark);
+	phaseTimes.addAllocations(PhaseTimes::INIT, pool);
+}
+
+void RepastHPCModel::createAgents()
 {
 	int rank = repast::RepastProcess::instance()->rank(); //gets process rank
+	std::string populationPath = stringProperty("population.file", "");
+	boost::scoped_ptr<PopulationFile> population; // unmapped however this returns
+	boost::uint64_t firstRow = 0;
+	if(!populationPath.empty()) // each rank maps the population file and takes its own contiguous slice of rows
+        {
+		boost::uint64_t rows = 0;
+		population.reset(new PopulationFile(populationPath));
+		population->slice(rank, repast::RepastProcess::instance()->worldSize(), firstRow, rows);
+		population->prefetch(firstRow, rows);
+		countOfAgents = (int)rows;
+	}
+
+	std::vector<int> regionIds; // file region id to store region id, identical on every rank
+	for(int r = 0; population.get() != 0 && r < population->regionCount(); r++) regionIds.push_back(agentStore.internRegion(population->regionName(r)));
+
+	agentStore.reserve(countOfAgents); // avoid regrowing the store columns while populating
 	for(int i = 0; i < countOfAgents; i++) //iterates based on number of agents
     {
 		repast::AgentId id(i, rank, 0); // instantiates agent id with agent number, rank and type
 		id.currentRank(rank);
-		RepastHPCAgent* agent = new RepastHPCAgent(id); //instantiate agent objects with id
+		RepastHPCAgent* agent = new RepastHPCAgent(id, &agentStore); //instantiate agent objects with id, state is held in agentStore
+		if(population.get() != 0)
+		{
+			boost::uint64_t row = firstRow + i;
+			int region = population->region()[row];
+			agent->initAgent(population->age()[row], population->commuteDist()[row], population->socNorm()[row],
+			                 (region >= 0 && region < (int)regionIds.size()) ? regionIds[region] : -1, population->cycles()[row] != 0);
+		}
 		context.addAgent(agent); //adds agent to the context
     }
 }
 
-void RepastHPCModel::requestAgents()
+std::string RepastHPCModel::checkpointPath(const std::string& base)
+{
+	std::ostringstream path;
+	path << base << "." << repast::RepastProcess::instance()->rank() << ".ckpt";
+	return path.str();
+}
+
+void RepastHPCModel::restoreCheckpoint(const std::string& path)
+{
+	int rank = repast::RepastProcess::instance()->rank();
+	CheckpointFile checkpoint(path);
+	const CheckpointHeader& header = checkpoint.getHeader();
+	if((int)header.rank != rank || (int)header.worldSize != repast::RepastProcess::instance()->worldSize())
+        {
+		throw std::runtime_error(path + " was written by a different rank or number of ranks");
+	}
+	playRandom = CounterRandom(header.seed, CounterRandom::PLAY_STREAM); // the saved run's streams, whatever random.seed says
+	rewireRandom = CounterRandom(header.seed, CounterRandom::REWIRE_STREAM);
+
+	for(int r = 0; r < (int)header.regionCount; r++) agentStore.internRegion(checkpoint.regionName(r)); // same ids as when saved
+
+	// Local agents, in their saved store order
+	const CheckpointAgent* agents = checkpoint.agents();
+	int rows = (int)(header.localRows + header.ghostRows);
+	std::vector<RepastHPCAgent*> byRow(rows, (RepastHPCAgent*)0);
+	agentStore.reserve(rows);
+	for(int i = 0; i < (int)header.localRows; i++)
+        {
+		const CheckpointAgent& saved = agents[i];
+		repast::AgentId id(saved.id, saved.startingRank, saved.type);
+		id.currentRank(rank);
+		RepastHPCAgent* agent = new RepastHPCAgent(id, &agentStore, saved.c, saved.total);
+		agent->initAgent(saved.age, saved.commuteDist, saved.socNorm, saved.regionId, saved.cycles != 0);
+		context.addAgent(agent);
+		byRow[i] = agent;
+	}
+	countOfAgents = (int)header.localRows;
+
+	// Ghosts: replay the registrations in one request, the owners send their restored state
+	repast::AgentRequest req(rank);
+	for(int i = (int)header.localRows; i < rows; i++)
+        {
+		repast::AgentId id(agents[i].id, agents[i].startingRank, agents[i].type);
+		id.currentRank(agents[i].currentRank);
+		req.addRequest(id);
+	}
+	repast::RepastProcess::instance()->requestAgents<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, req, *provider, *receiver, *receiver);
+	ghostExchange->registerGhosts(context, agentStore);
+	for(int i = (int)header.localRows; i < rows; i++) byRow[i] = context.getAgent(repast::AgentId(agents[i].id, agents[i].startingRank, agents[i].type));
+
+	// Edges, with their weight and confidence
+	const CheckpointEdge* edges = checkpoint.edges();
+	for(boost::uint64_t e = 0; e < header.edgeCount; e++)
+        {
+		RepastHPCAgent* source = byRow[edges[e].source];
+		RepastHPCAgent* target = byRow[edges[e].target];
+		if(source == 0 || target == 0) continue;
+		agentNetwork->addEdge(newEdge(source, target, edges[e].weight, (int)edges[e].confidence));
+	}
+
+	AggregatePartial saved;
+	checkpoint.aggregates(saved);
+	agentStore.aggregates.restore(saved); // continue the compensated sums exactly rather than recounting
+	adjacency.invalidate();
+	refreshAdjacency();
+	ghostRegistry.rebuild(agentStore, adjacency); // every saved ghost is an edge endpoint
+	resumeTick = header.tick;
+	if(rank == 0) std::cout << "RESTARTED FROM TICK " << resumeTick << std::endl;
+}
+
+void RepastHPCModel::writeCheckpoint()
+{
+	agentStore.aggregates.settle();
+	refreshAdjacency();
+	CheckpointFile::write(checkpointPath(stringProperty("checkpoint.file", "./output/checkpoint")), repast::RepastProcess::instance()->rank(),
+	                      repast::RepastProcess::instance()->worldSize(), playRandom.getSeed(), (double)currentTick(), agentStore, adjacency);
+	if(incrementalNorms) normEngine.invalidate(); // a restart starts from fresh counts, so this run recounts on the same tick
+}
+
+double RepastHPCModel::firstEventTick(double start, double interval)
+{
+	if(resumeTick <= 0 || start > resumeTick + CHECKPOINT_OFFSET) return start;
+	return start + interval * (std::floor((resumeTick + CHECKPOINT_OFFSET - start) / interval) + 1); // first occurrence after the checkpoint was taken
+}
+
+void RepastHPCModel::buildDataSet()
+{
+	repast::SVDataSetBuilder* builder = 0;
+	if(stringProperty("output.format", "csv") == "binary") // one file per rank, written by a background thread; tools/OutputExport.cpp sums them into the csv
+        {
+		int rank = repast::RepastProcess::instance()->rank();
+		std::ostringstream path;
+		path << stringProperty("output.file", "./output/agent_total_data") << "." << rank << ".bin";
+		binaryValues = new BinaryDataSet(path.str(), rank, repast::RepastProcess::instance()->worldSize(), intProperty("output.block.rows", 256),
+		                                 intProperty("output.queue.blocks", 8), stringProperty("output.compress", "false") == "true", &scheduleTick);
+	}
+	else
+        {
+		// Create the data set builder
+		std::string fileOutputName("./output/agent_total_data.csv"); // string to hold file directory data should be written to
+		builder = new repast::SVDataSetBuilder(fileOutputName.c_str(), ",", repast::RepastProcess::instance()->getScheduleRunner().schedule()); // instantiate SVDataSetBuilder, specifying file to write to.
+	}
+
+	// Create the individual data sets to be added to the builder
+	DataSource_AgentTotals* agentTotals_DataSource = new DataSource_AgentTotals(&agentStore);
+	addDataColumn(builder, "Total", agentTotals_DataSource);
+
+	DataSource_AgentCTotals* agentCTotals_DataSource = new DataSource_AgentCTotals(&agentStore);
+	addDataColumn(builder, "C", agentCTotals_DataSource);
+
+	addDataColumn(builder, "Cyclists", new DataSource_Cyclists(&agentStore));
+	for(int r = 0; r < agentStore.regionCount(); r++) // region names are interned identically on every rank
+	{
+		addDataColumn(builder, "Cyclists." + agentStore.regionName(r), new DataSource_RegionCyclists(&agentStore, r));
+	}
+	for(int b = 0; b < agentStore.aggregates.bandCount(); b++)
+	{
+		std::ostringstream name;
+		name << "Cyclists.age" << agentStore.aggregates.bandFirstAge(b);
+		if(b + 1 < agentStore.aggregates.bandCount()) name << "-" << agentStore.aggregates.bandFirstAge(b + 1) - 1;
+		else name << "+";
+		addDataColumn(builder, name.str(), new DataSource_AgeBandCyclists(&agentStore, b));
+	}
+
+	// Use the builder to create the data set
+	if(builder != 0) agentValues = builder->createDataSet();
+	delete builder;
+}
+
+void RepastHPCModel::addDataColumn(repast::SVDataSetBuilder* builder, const std::string& name, repast::TDataSource<double>* source)
+{
+	if(binaryValues != 0) binaryValues->addDataSource(name, source);
+	else builder->addDataSource(createSVDataSource(name, source, std::plus<double>()));
+}
+
+void RepastHPCModel::addDataColumn(repast::SVDataSetBuilder* builder, const std::string& name, repast::TDataSource<boost::int64_t>* source)
+{
+	if(binaryValues != 0) binaryValues->addDataSource(name, source);
+	else builder->addDataSource(createSVDataSource(name, source, std::plus<boost::int64_t>()));
+}
+
+void RepastHPCModel::traceAgent(TraceEvent event, const repast::AgentId& id, int type)
+{
+	RepastHPCAgent* agent = context.getAgent(id);
+	trace->record(0, event, scheduleTick(), id.id(), id.startingRank(), type, agent != 0 ? agent->getC() : 0, agent != 0 ? agent->getTotal() : 0,
+	              agent != 0 && agent->getCycles());
+}
+
+void RepastHPCModel::closeTrace()
+{
+	trace->close();
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	boost::uint64_t records = 0;
+	unsigned long dropped = 0;
+	boost::mpi::reduce(*comm, trace->getWritten(), records, std::plus<boost::uint64_t>(), 0);
+	boost::mpi::reduce(*comm, trace->getDropped(), dropped, std::plus<unsigned long>(), 0);
+	if(repast::RepastProcess::instance()->rank() == 0) std::cout << "TRACE: " << records << " records, " << dropped << " dropped on full rings" << std::endl;
+}
+
+void RepastHPCModel::closeOutput()
+{
+	binaryValues->close(); // drains the queue
+	AsyncOutputWriter& writer = binaryValues->getWriter();
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	unsigned long peakBacklog = 0;
+	unsigned long stalls = 0;
+	boost::uint64_t bytes = 0;
+	boost::mpi::reduce(*comm, (unsigned long)writer.getPeakBacklog(), peakBacklog, boost::mpi::maximum<unsigned long>(), 0);
+	boost::mpi::reduce(*comm, writer.getStalls(), stalls, std::plus<unsigned long>(), 0);
+	boost::mpi::reduce(*comm, writer.getBytesWritten(), bytes, std::plus<boost::uint64_t>(), 0);
+	if(repast::RepastProcess::instance()->rank() == 0)
+        {
+		std::cout << "OUTPUT: " << bytes << " bytes" << (writer.isCompressed() ? " compressed" : "") << ", peak backlog " << peakBacklog
+		          << " of " << intProperty("output.queue.blocks", 8) << " blocks, " << stalls << " stalled writes" << std::endl;
+	}
+}
+
+void RepastHPCModel::loadDesireWeights()
+{
+	DesireWeights weights;
+	weights.age              = doubleProperty("desire.weight.age", weights.age);
+	weights.commuteDist      = doubleProperty("desire.weight.commuteDist", weights.commuteDist);
+	weights.socNorm          = doubleProperty("desire.weight.socNorm", weights.socNorm);
+	weights.region           = doubleProperty("desire.weight.region", weights.region);
+	weights.popHealth        = doubleProperty("desire.weight.popHealth", weights.popHealth);
+	weights.popSafety        = doubleProperty("desire.weight.popSafety", weights.popSafety);
+	weights.ageScale         = doubleProperty("desire.age.scale", weights.ageScale);
+	weights.distanceScale    = doubleProperty("desire.distance.scale", weights.distanceScale);
+	weights.threshold        = doubleProperty("desire.threshold", weights.threshold);
+	weights.populationHealth = doubleProperty("population.health", weights.populationHealth);
+	weights.populationSafety = doubleProperty("population.safety", weights.populationSafety);
+	weights.regionNorm       = meanField ? doubleProperty("meanfield.norm.weight", 0.5) : 0;
+	populationHealth         = weights.populationHealth;
+	populationSafety         = weights.populationSafety;
+	desireKernel.setWeights(weights);
+
+	double regionDefault = doubleProperty("desire.region.default", 0.5);
+	std::vector<double> regionDesire(agentStore.regionCount());
+	for(int r = 0; r < agentStore.regionCount(); r++) regionDesire[r] = doubleProperty("desire.region." + agentStore.regionName(r), regionDefault); // e.g. desire.region.Leeds
+	desireKernel.setRegionDesire(regionDesire, regionDefault);
+
+	// The mean field moves every agent's inputs each tick, so it leaves nothing for the event driven norms to skip
+	bool fieldMoves = meanField && (weights.regionNorm > 0 || healthGain != 0 || safetyGain != 0);
+	incrementalNorms = (stringProperty("norms.mode", "full") == "incremental") && !fieldMoves;
+	if(incrementalNorms)
+        {
+		normEngine.configure(threadPool->size(), intProperty("norms.resync.ticks", 100));
+		desireKernel.setFlipLog(normEngine.flipLog());
+	}
+	if(repast::RepastProcess::instance()->rank() == 0)
+        {
+		if(expectedPayoffs) std::cout << "PLAY: expected payoffs, " << ExpectedPlay::instructionSet() << std::endl;
+		std::cout << "DESIRE KERNEL: " << DesireKernel::instructionSet() << ", norms " << (incrementalNorms ? "incremental" : "full")
+		          << (fieldMoves && stringProperty("norms.mode", "full") == "incremental" ? " (the mean field changes every agent's inputs)" : "") << std::endl;
+	}
+}
+
+bool RepastHPCModel::requestAgents()
+{
+	int rank = repast::RepastProcess::instance()->rank();
+	repast::AgentRequest req(rank);
+	int requests = ghostRegistry.takeRequests(req), anyRequests = 0;
+	boost::mpi::all_reduce(*repast::RepastProcess::instance()->getCommunicator(), requests, anyRequests, boost::mpi::maximum<int>()); // the request round is collective, skip it when no rank needs anything
+	if(anyRequests == 0) return false;
+    repast::RepastProcess::instance()->requestAgents<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, req, *provider, *receiver, *receiver);
+	if(trace == 0) return true;
+	const std::vector<repast::AgentId>& requested = req.requestedAgents();
+	for(size_t i = 0; i < requested.size(); i++) if(traced(requested[i])) traceAgent(TRACE_IMPORT, requested[i], requested[i].agentType());
+	return true;
+}
+
+void RepastHPCModel::connectAgentNetwork()
+{
+	std::string generator = stringProperty("network.generator", "smallworld");
+	if(generator != "random" && generator != "smallworld" && generator != "scalefree" && generator != "spatial")
+        {
+		throw std::runtime_error("Unknown network generator " + generator + ", expected random, smallworld, scalefree or spatial");
+	}
+	if(generator != "random")
+        {
+		generateAgentNetwork(generator);
+	}
+	else // original construction: 5 random partners per agent from the context
+        {
+		importCandidates(); // partners may be on other ranks; the candidates left without an edge are cancelled below
+		repast::SharedContext<RepastHPCAgent>::const_local_iterator iter    = context.localBegin();
+		repast::SharedContext<RepastHPCAgent>::const_local_iterator iterEnd = context.localEnd();
+		while(iter != iterEnd)
+		{
+			RepastHPCAgent* ego = &**iter;
+			std::vector<RepastHPCAgent*> agents;
+			agents.push_back(ego);                          // Omit self
+			context.selectAgents(5, agents, true);          // Choose 5 other agents randomly
+			// Make an undirected connection
+			for(size_t i = 0; i < agents.size(); i++){
+				if(ego->getId().id() < agents[i]->getId().id()){
+					agentNetwork->addEdge(newEdge(ego, agents[i], i + 1, (int)(i * i)));
+				}
+			}
+			iter++;
+		}
+	}
+	adjacency.invalidate();
+	refreshAdjacency(); // snapshot the new edges once
+	if(generator == "random") updateGhosts();
+}
+
+void RepastHPCModel::importCandidates()
 {
 	int rank = repast::RepastProcess::instance()->rank();
 	int worldSize = repast::RepastProcess::instance()->worldSize();
@@ -155,149 +785,715 @@ void RepastHPCModel::requestAgents()
     repast::RepastProcess::instance()->requestAgents<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, req, *provider, *receiver, *receiver);
 }
 
-void RepastHPCModel::connectAgentNetwork()
+void RepastHPCModel::generateAgentNetwork(const std::string& generator)
 {
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iter    = context.localBegin();
-	repast::SharedContext<RepastHPCAgent>::const_local_iterator iterEnd = context.localEnd();
-	while(iter != iterEnd)
-    {
-		RepastHPCAgent* ego = &**iter;
-		std::vector<RepastHPCAgent*> agents;
-		agents.push_back(ego);                          // Omit self
-		context.selectAgents(5, agents, true);          // Choose 5 other agents randomly
-		// Make an undirected connection
-		for(size_t i = 0; i < agents.size(); i++){
-            if(ego->getId().id() < agents[i]->getId().id()){
-              std::cout << "CONNECTING: " << ego->getId() << " to " << agents[i]->getId() << std::endl;
-              boost::shared_ptr<ModelCustomEdge<RepastHPCAgent> > Edge(new ModelCustomEdge<RepastHPCAgent>(ego, agents[i], i + 1, i * i));
-  	  	      agentNetwork->addEdge(Edge);
-            }
+	int rank = repast::RepastProcess::instance()->rank();
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	boost::uint32_t networkSeed = repast::strToUInt(stringProperty("network.seed", props->getProperty("random.seed"))); // replicates that fix it share one topology
+	NetworkGenerator network(comm, agentStore.localCount(), CounterRandom(networkSeed, CounterRandom::NETWORK_STREAM),
+	                         doubleProperty("network.weight.min", 1), doubleProperty("network.weight.max", 5), intProperty("network.confidence.max", 4));
+
+	// Local agents by id; every agent is still on the rank that created it
+	std::vector<RepastHPCAgent*> localAgents(agentStore.localCount());
+	for(int i = 0; i < agentStore.localCount(); i++) localAgents[agentStore.owner[i]->getId().id()] = agentStore.owner[i];
+
+	// The same network, already distributed, if an earlier replicate in this process generated it
+	std::ostringstream cacheKey;
+	cacheKey << generator << "|" << networkSeed << "|" << comm->size() << "|" << network.vertexCount() << "|" << stringProperty("network.neighbours", "6")
+	         << "|" << stringProperty("network.rewire", "0.1") << "|" << stringProperty("network.edges.per.agent", "3") << "|" << stringProperty("network.same.region", "0.9")
+	         << "|" << stringProperty("network.distance.scale", "5") << "|" << stringProperty("network.weight.min", "1") << "|" << stringProperty("network.weight.max", "5")
+	         << "|" << stringProperty("network.confidence.max", "4") << "|" << stringProperty("population.file", ""); // spatial networks of different populations of one size differ
+	bool cacheable = networkCache != 0 && (generator != "spatial" || !stringProperty("population.file", "").empty()); // spatial edges follow the population
+	const std::vector<NetworkEdge>* cached = cacheable ? networkCache->find(cacheKey.str()) : 0;
+
+	std::vector<NetworkEdge> edges;
+	if(cached != 0)
+        {
+		edges = *cached;
+	}
+	else if(generator == "scalefree")
+        {
+		network.scaleFree(intProperty("network.edges.per.agent", 3), edges);
+	}
+	else if(generator == "spatial")
+        {
+		std::vector<int> region(localAgents.size());
+		std::vector<double> commuteDist(localAgents.size());
+		for(size_t i = 0; i < localAgents.size(); i++)
+		{
+			region[i]      = localAgents[i]->getRegionId();
+			commuteDist[i] = localAgents[i]->getcommuteDist();
 		}
-		iter++;
+		network.spatial(region, commuteDist, intProperty("network.edges.per.agent", 3),
+		                doubleProperty("network.same.region", 0.9), doubleProperty("network.distance.scale", 5), edges);
+	}
+	else
+        {
+		network.smallWorld(intProperty("network.neighbours", 6), doubleProperty("network.rewire", 0.1), edges);
+	}
+	if(cached == 0) network.distribute(edges); // every edge touching a local agent, once
+	if(cacheable && cached == 0) networkCache->store(cacheKey.str(), edges);
+	if(meanField && stringProperty("meanfield.drop.cross.region", "false") == "true") dropCrossRegionEdges(network, localAgents, edges); // before any ghost is imported for them
+
+	// Import exactly the remote endpoints, in a single request
+	std::vector<boost::int64_t> remote;
+	for(size_t e = 0; e < edges.size(); e++)
+        {
+		boost::int64_t vertices[2] = { edges[e].source, edges[e].target };
+		for(int k = 0; k < 2; k++)
+		{
+			if(network.owner(vertices[k]) == rank) continue;
+			repast::AgentId id = network.agentId(vertices[k]);
+			id.currentRank(network.owner(vertices[k]));
+			ghostRegistry.addEdge(id);
+			remote.push_back(vertices[k]);
+		}
+	}
+	std::sort(remote.begin(), remote.end());
+	remote.erase(std::unique(remote.begin(), remote.end()), remote.end());
+	updateGhosts();
+
+	std::vector<RepastHPCAgent*> remoteAgents(remote.size());
+	for(size_t i = 0; i < remote.size(); i++) remoteAgents[i] = context.getAgent(network.agentId(remote[i]));
+
+	// Bulk insert; endpoints are resolved by position rather than by lookups in the context
+	boost::int64_t first = network.localFirst();
+	for(size_t e = 0; e < edges.size(); e++)
+        {
+		RepastHPCAgent* ends[2];
+		boost::int64_t vertices[2] = { edges[e].source, edges[e].target };
+		for(int k = 0; k < 2; k++)
+		{
+			if(network.owner(vertices[k]) == rank) ends[k] = localAgents[vertices[k] - first];
+			else ends[k] = remoteAgents[std::lower_bound(remote.begin(), remote.end(), vertices[k]) - remote.begin()];
+		}
+		if(ends[0] == 0 || ends[1] == 0) continue;
+		agentNetwork->addEdge(newEdge(ends[0], ends[1], edges[e].weight, (int)edges[e].confidence));
 	}
 }
 
-void RepastHPCModel::cancelAgentRequests()
+void RepastHPCModel::dropCrossRegionEdges(const NetworkGenerator& network, const std::vector<RepastHPCAgent*>& localAgents, std::vector<NetworkEdge>& edges)
 {
 	int rank = repast::RepastProcess::instance()->rank();
-	if(rank == 0) std::cout << "CANCELING AGENT REQUESTS" << std::endl;
-	repast::AgentRequest req(rank);
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	boost::int64_t first = network.localFirst();
+
+	// Both ranks of a cross-rank edge hold it, so each tells the other the region of its own endpoint
+	std::vector<std::vector<char> > send(comm->size()), receive;
+	for(size_t e = 0; e < edges.size(); e++)
+        {
+		boost::int64_t vertices[2] = { edges[e].source, edges[e].target };
+		for(int k = 0; k < 2; k++)
+		{
+			int owner = network.owner(vertices[1 - k]);
+			if(network.owner(vertices[k]) != rank || owner == rank) continue;
+			VertexRegion record = { vertices[k], localAgents[vertices[k] - first]->getRegionId(), 0 };
+			appendRecord(send[owner], record);
+		}
+	}
+	exchangeBuffers(*comm, send, receive, VERTEX_REGION_TAG);
+	boost::unordered_map<boost::int64_t, int> remoteRegion;
+	for(size_t r = 0; r < receive.size(); r++)
+        {
+		for(size_t i = 0; i < recordCount<VertexRegion>(receive[r]); i++)
+		{
+			VertexRegion record = readRecord<VertexRegion>(receive[r], i);
+			remoteRegion[record.vertex] = record.region;
+		}
+	}
+
+	size_t kept = 0;
+	long dropped = 0, totalDropped = 0;
+	for(size_t e = 0; e < edges.size(); e++)
+        {
+		int regions[2];
+		boost::int64_t vertices[2] = { edges[e].source, edges[e].target };
+		for(int k = 0; k < 2; k++) regions[k] = (network.owner(vertices[k]) == rank) ? localAgents[vertices[k] - first]->getRegionId() : remoteRegion[vertices[k]];
+		if(regions[0] == regions[1]) edges[kept++] = edges[e];
+		else if(network.owner(edges[e].source) == rank) dropped++; // counted once, by the source's rank
+	}
+	edges.resize(kept);
+	boost::mpi::reduce(*comm, dropped, totalDropped, std::plus<long>(), 0);
+	if(rank == 0) std::cout << "MEANFIELD: dropped " << totalDropped << " edges between regions" << std::endl;
+}
+
+void RepastHPCModel::updateMeanField()
+{
+	// Agents and cyclists per region slot, slot 0 for agents without a region, summed over ranks in one allreduce
+	int slots = agentStore.regionCount() + 1;
+	agentStore.aggregates.settle(); // no sweep is running
+	regionCounts.resize(2 * slots);
+	regionTotals.resize(2 * slots);
+	for(int slot = 0; slot < slots; slot++)
+        {
+		regionCounts[slot]         = agentStore.aggregates.regionAgents(slot - 1);
+		regionCounts[slots + slot] = agentStore.aggregates.regionCyclists(slot - 1);
+	}
+	boost::mpi::all_reduce(*repast::RepastProcess::instance()->getCommunicator(), &regionCounts[0], 2 * slots, &regionTotals[0], std::plus<boost::int64_t>());
 
-	repast::SharedContext<RepastHPCAgent>::const_state_aware_iterator non_local_agents_iter  = context.begin(repast::SharedContext<RepastHPCAgent>::NON_LOCAL);
-	repast::SharedContext<RepastHPCAgent>::const_state_aware_iterator non_local_agents_end   = context.end(repast::SharedContext<RepastHPCAgent>::NON_LOCAL);
-	while(non_local_agents_iter != non_local_agents_end){
-		req.addCancellation((*non_local_agents_iter)->getId());
-		non_local_agents_iter++;
+	std::vector<double> share(slots, 0);
+	boost::int64_t agents = 0, cyclists = 0;
+	for(int slot = 0; slot < slots; slot++)
+        {
+		if(regionTotals[slot] > 0) share[slot] = (double)regionTotals[slots + slot] / regionTotals[slot];
+		agents   += regionTotals[slot];
+		cyclists += regionTotals[slots + slot];
 	}
+	double cycling = agents > 0 ? (double)cyclists / agents : 0;
+	desireKernel.setMeanField(share, std::min(1.0, std::max(0.0, populationHealth + healthGain * cycling)),
+	                          std::min(1.0, std::max(0.0, populationSafety + safetyGain * cycling)));
+}
+
+int RepastHPCModel::intProperty(const std::string& key, int fallback)
+{
+	std::string value = props->getProperty(key);
+	return value.empty() ? fallback : repast::strToInt(value);
+}
+
+double RepastHPCModel::doubleProperty(const std::string& key, double fallback)
+{
+	std::string value = props->getProperty(key);
+	return value.empty() ? fallback : repast::strToDouble(value);
+}
+
+std::string RepastHPCModel::stringProperty(const std::string& key, const std::string& fallback)
+{
+	std::string value = props->getProperty(key);
+	return value.empty() ? fallback : value;
+}
+
+long RepastHPCModel::currentTick()
+{
+	return (long)repast::RepastProcess::instance()->getScheduleRunner().currentTick();
+}
+
+void RepastHPCModel::refreshAdjacency()
+{
+	if(adjacency.isCurrent(agentStore)) return;
+	if(edgeUpdates == 0 || !adjacency.follow(agentStore)) adjacency.build(agentNetwork, agentStore); // ghosts imported or cancelled by rewiring are followed, anything else rebuilds
+	if(edgeUpdates != 0) agentStore.startJournal(std::max<size_t>(1024, agentStore.size() / 8));
+}
+
+bool RepastHPCModel::cancelAgentRequests()
+{
+	int rank = repast::RepastProcess::instance()->rank();
+	repast::AgentRequest req(rank);
+	int unreferenced = ghostRegistry.takeCancellations(req), anyCancellations = 0;
+	boost::mpi::all_reduce(*repast::RepastProcess::instance()->getCommunicator(), unreferenced, anyCancellations, boost::mpi::maximum<int>());
+	if(anyCancellations == 0) return false;
     repast::RepastProcess::instance()->requestAgents<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, req, *provider, *receiver, *receiver);
 
 	std::vector<repast::AgentId> cancellations = req.cancellations();
 	std::vector<repast::AgentId>::iterator idToRemove = cancellations.begin();
 	while(idToRemove != cancellations.end())
         {
+		if(traced(*idToRemove)) traceAgent(TRACE_CANCEL, *idToRemove, idToRemove->agentType());
 		context.importedAgentRemoved(*idToRemove);
 		idToRemove++;
 	}
+	return true;
+}
+
+void RepastHPCModel::updateGhosts()
+{
+	PhaseMark mark = startPhase();
+	refreshAdjacency();
+	ghostRegistry.rebuild(agentStore, adjacency); // only imports are recounted, requests queued by addEdge stay
+	cancelAgentRequests();
+	requestAgents();
+	ghostExchange->registerGhosts(context, agentStore);
+	SlabPool::trimAll(); // slabs emptied by migrated, removed and cancelled agents and their edges go back in one pass
+	endPhase(PhaseTimes::REQUEST, mark); // also counted in the enclosing event's phase, as the parts of a tick are in TICK
 }
 
 
 void RepastHPCModel::removeLocalAgents()
 {
 	int rank = repast::RepastProcess::instance()->rank();
-	if(rank == 0) std::cout << "REMOVING LOCAL AGENTS" << std::endl;
 	for(int i = 0; i < 5; i++)
         {
 		repast::AgentId id(i, rank, 0);
+		if(traced(id)) traceAgent(TRACE_REMOVE, id, id.agentType());
 		repast::RepastProcess::instance()->agentRemoved(id);
 		context.removeAgent(id);
 	}
   repast::RepastProcess::instance()->synchronizeAgentStatus<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, *provider, *receiver, *receiver);
+  agentStore.refreshLocality(); // migrated agents and their ghosts change store partition
+  updateGhosts(); // edges to the removed agents are gone
 }
 
 void RepastHPCModel::moveAgents()
 {
-	int rank = repast::RepastProcess::instance()->rank();
-	if(rank == 0)
+	for(size_t i = 0; i < pendingMoves.size(); i++)
         {
-		repast::AgentId agent0(0, 0, 0);
-		repast::AgentId agent1(1, 0, 0);
-		repast::AgentId agent2(2, 0, 0);
-		repast::AgentId agent3(3, 0, 0);
-		repast::AgentId agent4(4, 0, 0);
-
-		repast::RepastProcess::instance()->moveAgent(agent0, 1);
-		repast::RepastProcess::instance()->moveAgent(agent1, 2);
-		repast::RepastProcess::instance()->moveAgent(agent2, 3);
-		repast::RepastProcess::instance()->moveAgent(agent3, 3);
-		repast::RepastProcess::instance()->moveAgent(agent4, 1);
+		if(traced(pendingMoves[i].first)) traceAgent(TRACE_MIGRATE, pendingMoves[i].first, pendingMoves[i].second);
+		repast::RepastProcess::instance()->moveAgent(pendingMoves[i].first, pendingMoves[i].second);
 	}
+	pendingMoves.clear();
 
   repast::RepastProcess::instance()->synchronizeAgentStatus<RepastHPCAgent, RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(context, *provider, *receiver, *receiver);
+  agentStore.refreshLocality(); // migrated agents and their ghosts change store partition
+  updateGhosts(); // ghosts that are now local, or that no local agent is connected to any more, change by differences
 
 }
 
-void RepastHPCModel::doSomething() //method to run simulation time step functionality
+void RepastHPCModel::placeAgents()
 {
-	int whichRank = 0;
-	if(repast::RepastProcess::instance()->rank() == whichRank) std::cout << " TICK " << repast::RepastProcess::instance()->getScheduleRunner().currentTick() << std::endl; // if the process rank is the same as whichRank then output the current tick
+	int rank = repast::RepastProcess::instance()->rank();
+	int worldSize = repast::RepastProcess::instance()->worldSize();
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	refreshAdjacency();
+
+	// Describe the local part of the agent graph: id, starting rank, type, degree, then the neighbour keys
+	std::vector<int> localGraph;
+	localGraph.reserve(4 * agentStore.localCount() + 3 * getLocalEdgeEnds());
+	for(int i = 0; i < agentStore.localCount(); i++)
+        {
+		const repast::AgentId& id = agentStore.owner[i]->getId();
+		localGraph.push_back(id.id());
+		localGraph.push_back(id.startingRank());
+		localGraph.push_back(id.agentType());
+		localGraph.push_back(adjacency.end(i) - adjacency.begin(i));
+		for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+		{
+			const repast::AgentId& other = agentStore.owner[adjacency.neighbour[k]]->getId();
+			localGraph.push_back(other.id());
+			localGraph.push_back(other.startingRank());
+			localGraph.push_back(other.agentType());
+		}
+	}
+	std::vector<std::vector<int> > graphs;
+	boost::mpi::gather(*comm, localGraph, graphs, 0);
 
-	if(repast::RepastProcess::instance()->rank() == whichRank)
+	std::vector<std::vector<int> > assignment(worldSize); // new rank of each vertex, in the order each rank sent them
+	if(rank == 0)
         {
-		std::cout << "LOCAL AGENTS:" << std::endl;
-		for(int r = 0; r < 4; r++)
+		bool balanceEdges = (stringProperty("placement.balance", "agents") == "edges");
+		double imbalance = doubleProperty("placement.imbalance", 0.03);
+
+		// Number the vertices in rank order
+		boost::unordered_map<boost::uint64_t, int> vertexOf;
+		std::vector<int> currentPart;
+		for(int r = 0; r < worldSize; r++)
 		{
-			for(int i = 0; i < 10; i++)
+			const std::vector<int>& g = graphs[r];
+			for(size_t at = 0; at < g.size(); at += 4 + 3 * g[at + 3])
 			{
-				repast::AgentId toDisplay(i, r, 0); // instantiate 'toDisplay' AgentId object with number i, rank r and type 0
-				RepastHPCAgent* agent = context.getAgent(toDisplay); // get agent with current toDisplay id
-				if((agent != 0) && (agent->getId().currentRank() == whichRank)) // only prints agents that are on current process
+				vertexOf[placementKey(g[at], g[at + 1], g[at + 2])] = (int)currentPart.size();
+				currentPart.push_back(r);
+			}
+		}
+
+		PartitionGraph graph;
+		graph.offsets.push_back(0);
+		for(int r = 0; r < worldSize; r++)
+		{
+			const std::vector<int>& g = graphs[r];
+			for(size_t at = 0; at < g.size(); at += 4 + 3 * g[at + 3])
+			{
+				int degree = g[at + 3];
+				for(int k = 0; k < degree; k++)
 				{
-				    std::cout << agent->getId() << " " << agent->getC() << " " << agent->getTotal() << std::endl; // display associated agent information
+					const int* n = &g[at + 4 + 3 * k];
+					boost::unordered_map<boost::uint64_t, int>::const_iterator found = vertexOf.find(placementKey(n[0], n[1], n[2]));
+					if(found == vertexOf.end()) continue; // endpoint not held locally anywhere
+					graph.adjacency.push_back(found->second);
+					graph.edgeWeights.push_back(1);
 				}
-
+				graph.offsets.push_back((int)graph.adjacency.size());
+				graph.vertexWeights.push_back(balanceEdges ? 1 + degree : 1);
 			}
 		}
 
-		std::cout << "NON LOCAL AGENTS:" << std::endl;
-		for(int r = 0; r < 4; r++)
-                {
-			for(int i = 0; i < 10; i++)
+		GraphPartitioner partitioner(worldSize, imbalance, playRandom.getSeed());
+		std::vector<int> part = partitioner.partition(graph);
+
+		std::cout << "PLACEMENT: edge cut " << GraphPartitioner::edgeCut(graph, currentPart) << " -> " << GraphPartitioner::edgeCut(graph, part)
+		          << ", ghosts " << GraphPartitioner::ghostCount(graph, currentPart, worldSize) << " -> " << GraphPartitioner::ghostCount(graph, part, worldSize)
+		          << ", balance " << GraphPartitioner::balance(graph, currentPart, worldSize) << " -> " << GraphPartitioner::balance(graph, part, worldSize) << std::endl;
+
+		for(size_t v = 0; v < part.size(); v++) assignment[currentPart[v]].push_back(part[v]);
+	}
+	std::vector<int> destination;
+	boost::mpi::scatter(*comm, assignment, destination, 0);
+
+	for(int i = 0; i < agentStore.localCount(); i++) // rows have not moved since the graph was gathered
+        {
+		if(destination[i] != rank) pendingMoves.push_back(std::make_pair(agentStore.owner[i]->getId(), destination[i]));
+	}
+	moveAgents(); // one bulk migration
+}
+
+void RepastHPCModel::balanceAgents()
+{
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	int rank = comm->rank();
+
+	// Seconds per tick since the last check in the phases whose cost follows the agents a rank holds
+	double compute = phaseTimes.seconds[PhaseTimes::PLAY] + phaseTimes.seconds[PhaseTimes::COMMIT] + phaseTimes.seconds[PhaseTimes::NORMS] + phaseTimes.seconds[PhaseTimes::DESIRES];
+	long ticks = phaseTimes.ticks - balancedTicks;
+	double perTick = ticks > 0 ? (compute - balancedSeconds) / ticks : 0;
+	balancedSeconds = compute;
+	balancedTicks = phaseTimes.ticks;
+	refreshAdjacency();
+	double units = agentStore.localCount() + getLocalEdgeEnds(); // 1 + degree per agent
+	std::vector<double> seconds, allUnits;
+	boost::mpi::all_gather(*comm, perTick, seconds);
+	boost::mpi::all_gather(*comm, units, allUnits);
+	if(rank == 0 && balanceMoved) std::cout << "BALANCE: tick " << scheduleTick() << ", imbalance " << LoadBalancer::imbalanceOf(seconds) << " measured after the move" << std::endl;
+	balanceMoved = false;
+	if(!loadBalancer->observe(seconds)) return; // every rank has the same loads, so all agree
+
+	double before = loadBalancer->imbalance();
+	std::vector<double> predicted;
+	std::vector<std::vector<double> > transfer = loadBalancer->plan(allUnits, predicted);
+	selectMoves(transfer[rank]);
+	long moves = (long)pendingMoves.size(), totalMoves = 0;
+	boost::mpi::reduce(*comm, moves, totalMoves, std::plus<long>(), 0);
+	moveAgents(); // one batched migration for every rank's moves
+	loadBalancer->moved(predicted);
+	balanceMoved = true;
+	if(rank == 0) std::cout << "BALANCE: tick " << scheduleTick() << ", imbalance " << before << " -> " << LoadBalancer::imbalanceOf(predicted) << " predicted, moved " << totalMoves << " agents" << std::endl;
+}
+
+void RepastHPCModel::selectMoves(const std::vector<double>& quota)
+{
+	int local = agentStore.localCount();
+	std::vector<unsigned char> taken(local, 0);
+	std::vector<std::pair<int, int> > ranked; // (local neighbours - neighbours on the destination, row)
+	for(int destination = 0; destination < (int)quota.size(); destination++)
+        {
+		if(quota[destination] <= 0) continue;
+		ranked.clear();
+		for(int i = 0; i < local; i++)
+		{
+			if(taken[i]) continue;
+			int kept = 0, joined = 0;
+			for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
 			{
-				repast::AgentId toDisplay(i, r, 0);
-				RepastHPCAgent* agent = context.getAgent(toDisplay);
-				if((agent != 0) && (agent->getId().currentRank() != whichRank))
-				{
-                                    std::cout << agent->getId() << " " << agent->getC() << " " << agent->getTotal() << std::endl; // display associated agent information
-                                }
+				int j = adjacency.neighbour[k];
+				if(agentStore.isLocal(j)) kept++;
+				else if(agentStore.owner[j]->getId().currentRank() == destination) joined++;
 			}
+			ranked.push_back(std::make_pair(kept - joined, i)); // moving it cuts kept edges and saves joined ones
+		}
+		std::sort(ranked.begin(), ranked.end());
+		double moved = 0;
+		for(size_t n = 0; n < ranked.size() && moved < quota[destination]; n++)
+		{
+			int i = ranked[n].second;
+			taken[i] = 1;
+			moved += 1 + adjacency.end(i) - adjacency.begin(i);
+			pendingMoves.push_back(std::make_pair(agentStore.owner[i]->getId(), destination));
 		}
 	}
+}
 
-	std::vector<RepastHPCAgent*> agents;
-	context.selectAgents(repast::SharedContext<RepastHPCAgent>::LOCAL, countOfAgents, agents);
-	std::vector<RepastHPCAgent*>::iterator it = agents.begin(); //create vector iterator to hold agents
-	while(it != agents.end()) //iterate through each agent
+void RepastHPCModel::addEdge(const repast::AgentId& source, const repast::AgentId& target, double weight, int confidence)
+{
+	if(edgeUpdates == 0) throw std::runtime_error("addEdge needs rewire.enabled = true");
+	if(source.currentRank() != agentStore.getRank()) throw std::runtime_error("addEdge: the source agent must be local");
+	if(target.currentRank() < 0 || target.currentRank() >= repast::RepastProcess::instance()->worldSize()) throw std::runtime_error("addEdge: the target agent needs its current rank");
+	edgeUpdates->queue(EdgeUpdateBatch::make(source, target, weight, confidence, false), agentStore.getRank());
+}
+
+void RepastHPCModel::removeEdge(const repast::AgentId& source, const repast::AgentId& target)
+{
+	if(edgeUpdates == 0) throw std::runtime_error("removeEdge needs rewire.enabled = true");
+	if(source.currentRank() != agentStore.getRank()) throw std::runtime_error("removeEdge: the source agent must be local");
+	if(target.currentRank() < 0 || target.currentRank() >= repast::RepastProcess::instance()->worldSize()) throw std::runtime_error("removeEdge: the target agent needs its current rank");
+	edgeUpdates->queue(EdgeUpdateBatch::make(source, target, 0, 0, true), agentStore.getRank());
+}
+
+void RepastHPCModel::proposeRewiring()
+{
+	refreshAdjacency();
+	long tick = currentTick();
+	std::vector<int> queued; // targets given to i this tick, which the snapshot does not show yet
+	for(int i = 0; i < agentStore.localCount(); i++)
         {
-		(*it)->play(agentNetwork); // play the agent game with agentNetwork
-		it++;
-        }
+		const repast::AgentId& id = agentStore.owner[i]->getId();
+		queued.clear();
+		for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+		{
+			int j = adjacency.neighbour[k];
+			if(!agentStore.isLocal(j)) continue; // only part of a ghost's neighbours are held here, so edges across ranks are left as they are
+			const repast::AgentId& other = agentStore.owner[j]->getId();
+			if(other.startingRank() < id.startingRank() || (other.startingRank() == id.startingRank() && other.id() < id.id())) continue; // the edge is decided by its lower end
+			boost::uint32_t draw = 2 * (boost::uint32_t)(k - adjacency.begin(i));
+			if(rewireRandom.uniform(id, tick, draw) >= rewireFraction) continue;
+
+			// The edge moves to one of j's other neighbours, as when someone is introduced by a friend
+			int degree = adjacency.end(j) - adjacency.begin(j);
+			if(degree < 2) continue;
+			int t = adjacency.neighbour[adjacency.begin(j) + std::min(degree - 1, (int)(rewireRandom.uniform(id, tick, draw + 1) * degree))];
+			bool known = (t == i) || std::find(queued.begin(), queued.end(), t) != queued.end();
+			for(int m = adjacency.begin(i); m < adjacency.end(i) && !known; m++) known = (adjacency.neighbour[m] == t);
+			if(known) continue;
+			removeEdge(id, other);
+			addEdge(id, agentStore.owner[t]->getId(), adjacency.weight[k], adjacency.confidence[k]);
+			queued.push_back(t);
+		}
+	}
+}
+
+void RepastHPCModel::editAdjacency(RepastHPCAgent* source, RepastHPCAgent* target, const EdgeUpdate& update)
+{
+	int ends[2] = { source->getStoreIndex(), target->getStoreIndex() };
+	bool done = adjacency.isCurrent(agentStore);
+	for(int e = 0; e < 2 && done; e++)
+        {
+		done = update.remove ? adjacency.erase(ends[e], ends[1 - e]) : adjacency.insert(agentStore, ends[e], ends[1 - e], update.weight, update.confidence);
+		if(agentStore.isLocal(ends[e])) rewiredRows.push_back(ends[e]);
+	}
+	if(!done) adjacency.invalidate(); // a full row; the next refresh rebuilds the snapshot with fresh slack
+}
+
+void RepastHPCModel::rewireAgentNetwork()
+{
+	int rank = agentStore.getRank();
+	if(rewireFraction > 0) proposeRewiring();
+	std::vector<EdgeUpdate> updates;
+	edgeUpdates->exchange(*repast::RepastProcess::instance()->getCommunicator(), updates); // one message per rank pair with changes
+
+	// The remote ends of new edges are imported first, in one request round
+	std::vector<int> remote(updates.size(), -1); // which end is remote: 0 source, 1 target
+	for(size_t u = 0; u < updates.size(); u++)
+        {
+		if(updates[u].target[3] != rank) remote[u] = 1;
+		else if(updates[u].source[3] != rank) remote[u] = 0;
+		if(remote[u] >= 0 && !updates[u].remove) ghostRegistry.addEdge(EdgeUpdateBatch::agentId(remote[u] ? updates[u].target : updates[u].source));
+	}
+	bool ghostsChanged = requestAgents();
+	refreshAdjacency(); // follows the appended ghost rows
+
+	rewiredRows.clear();
+	for(size_t u = 0; u < updates.size(); u++)
+        {
+		const EdgeUpdate& update = updates[u];
+		RepastHPCAgent* source = context.getAgent(EdgeUpdateBatch::agentId(update.source));
+		RepastHPCAgent* target = context.getAgent(EdgeUpdateBatch::agentId(update.target));
+		bool exists = source != 0 && target != 0 && agentNetwork->findEdge(source, target) != 0;
+		bool applies = update.remove ? exists : (source != 0 && target != 0 && !exists);
+		if(remote[u] >= 0 && applies == (update.remove != 0)) ghostRegistry.removeEdge(EdgeUpdateBatch::agentId(remote[u] ? update.target : update.source)); // removed, or an addition that did not happen
+		if(!applies) continue;
+		if(update.remove) agentNetwork->removeEdge(source, target);
+		else agentNetwork->addEdge(newEdge(source, target, update.weight, update.confidence));
+		editAdjacency(source, target, update);
+		if(update.remove) edgesRemoved++;
+		else edgesAdded++;
+	}
+	ghostsChanged = cancelAgentRequests() || ghostsChanged;
+	refreshAdjacency(); // follows the released ghost rows
+	if(ghostsChanged) ghostExchange->registerChanges(context, agentStore); // collective, every rank agrees on ghostsChanged; only the added and cancelled keys move
 
-	repast::RepastProcess::instance()->synchronizeAgentStates<RepastHPCAgentPackage, RepastHPCAgentPackageProvider, RepastHPCAgentPackageReceiver>(*provider, *receiver);
+	// Per row data derived from the snapshot follows the changed rows; a rebuild has already made it stale
+	std::sort(rewiredRows.begin(), rewiredRows.end());
+	rewiredRows.erase(std::unique(rewiredRows.begin(), rewiredRows.end()), rewiredRows.end());
+	if(incrementalNorms) normEngine.edgesChanged(adjacency, agentStore, rewiredRows);
+	if(expectedPayoffs) expectedPlay.refreshRows(adjacency, rewiredRows);
+	for(size_t r = 0; r < rewiredRows.size() && !classifiedStale; r++)
+        {
+		int i = rewiredRows[r];
+		if(i >= (int)boundaryRow.size() || boundaryRow[i]) continue; // a boundary row may stay one
+		for(int k = adjacency.begin(i); k < adjacency.end(i); k++) if(!agentStore.isLocal(adjacency.neighbour[k])) classifiedStale = true; // it would read a ghost while the exchange writes it
+	}
+}
 
+void RepastHPCModel::renumberAgents()
+{
+	RowOrdering::Method method = RowOrdering::parse(stringProperty("renumber.order", "none"));
+	if(method == RowOrdering::NONE) return;
+	refreshAdjacency();
+	OrderingStats before = RowOrdering::measure(adjacency, agentStore.localCount());
+	agentStore.permute(RowOrdering::order(adjacency, agentStore.localCount(), agentStore.size(), method)); // ids stay, rows move
+	refreshAdjacency();
+	OrderingStats after = RowOrdering::measure(adjacency, agentStore.localCount());
+
+	// Worst bandwidth and the mean of the other measures over ranks
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	long bandwidth[2] = { before.bandwidth, after.bandwidth }, maxBandwidth[2];
+	double measures[6] = { before.meanDistance, after.meanDistance, before.linesPerRow, after.linesPerRow, before.farReads, after.farReads }, sums[6];
+	boost::mpi::reduce(*comm, bandwidth, 2, maxBandwidth, boost::mpi::maximum<long>(), 0);
+	boost::mpi::reduce(*comm, measures, 6, sums, std::plus<double>(), 0);
+	if(comm->rank() != 0) return;
+	int ranks = comm->size();
+	std::cout << "RENUMBER: " << stringProperty("renumber.order", "none") << ", bandwidth " << maxBandwidth[0] << " -> " << maxBandwidth[1]
+	          << ", mean neighbour distance " << sums[0] / ranks << " -> " << sums[1] / ranks << ", lines per row " << sums[2] / ranks << " -> " << sums[3] / ranks
+	          << ", far reads " << sums[4] / ranks << " -> " << sums[5] / ranks << std::endl;
+}
+
+void RepastHPCModel::classifyAgents()
+{
+	if(!classifiedStale && classifiedBuild == adjacency.buildCount() && classifiedRegistration == ghostExchange->registrationCount()) return;
+	boundaryRow.assign(agentStore.size(), 0);
+	ghostExchange->markExported(context, agentStore, boundaryRow); // what other ranks read must be final before it is packed
+	boundaryRows.clear();
+	interiorRows.clear();
+	for(int i = 0; i < agentStore.localCount(); i++)
+        {
+		for(int k = adjacency.begin(i); k < adjacency.end(i) && !boundaryRow[i]; k++) boundaryRow[i] = !agentStore.isLocal(adjacency.neighbour[k]);
+		if(boundaryRow[i]) boundaryRows.push_back(i);
+		else interiorRows.push_back(i);
+	}
+	classifiedBuild = adjacency.buildCount();
+	classifiedRegistration = ghostExchange->registrationCount();
+	classifiedStale = false;
+}
+
+void RepastHPCModel::doSomething() //method to run simulation time step functionality
+{
+	PhaseMark mark = startPhase();
+	refreshAdjacency(); // only rebuilds after migration or ghost changes
+	classifyAgents(); // likewise
+	endPhase(PhaseTimes::REFRESH, mark);
+	long tick = currentTick();
+	if(expectedPayoffs)
+        {
+		expectedPlay.refresh(adjacency, agentStore);
+		ProbabilityTask probabilities(agentStore, expectedPlay);
+		threadPool->parallelFor(0, agentStore.size(), PLAY_GRAIN * 16, probabilities); // ghosts too, before the exchange can overwrite them
+	}
+	PlayTask sampledBoundary(agentStore, boundaryRows, adjacency, playRandom, tick, playDraws);
+	ExpectedPlayTask expectedBoundary(agentStore, boundaryRows, adjacency, expectedPlay);
+	ParallelTask& boundary = expectedPayoffs ? (ParallelTask&)expectedBoundary : (ParallelTask&)sampledBoundary;
+	threadPool->parallelFor(0, (int)boundaryRows.size(), PLAY_GRAIN, boundary); // play the agent game over the agentNetwork snapshot, agents with remote partners first
+	endPhase(PhaseTimes::PLAY, mark);
+	if(overlapExchange)
+        {
+		ghostExchange->beginExchange(context, agentStore); // ships only the ghosted agents whose state changed, while the interior plays
+		endPhase(PhaseTimes::EXCHANGE, mark);
+	}
+	PlayTask sampledInterior(agentStore, interiorRows, adjacency, playRandom, tick, playDraws);
+	ExpectedPlayTask expectedInterior(agentStore, interiorRows, adjacency, expectedPlay);
+	ParallelTask& interior = expectedPayoffs ? (ParallelTask&)expectedInterior : (ParallelTask&)sampledInterior;
+	threadPool->parallelFor(0, (int)interiorRows.size(), PLAY_GRAIN, interior); // reads no ghost, so arriving ghost state cannot race with it
+	endPhase(PhaseTimes::PLAY, mark);
+	CommitTask commit(agentStore);
+	threadPool->parallelFor(0, agentStore.localCount(), PLAY_GRAIN * 16, commit); // every agent has played, publish the new state
+	endPhase(PhaseTimes::COMMIT, mark);
+
+	if(!overlapExchange) ghostExchange->beginExchange(context, agentStore);
+	ghostExchange->finishExchange(agentStore);
+	if(meanField) updateMeanField(); // one small allreduce instead of ghosts for the region and population terms
+	endPhase(PhaseTimes::EXCHANGE, mark);
+
+	if(incrementalNorms && !normEngine.refresh(adjacency, agentStore, currentTick()))
+        {
+		normEngine.propagate(adjacency, agentStore, ghostExchange->cyclesChanged()); // last tick's local flips and this exchange's ghost flips
+		endPhase(PhaseTimes::NORMS, mark);
+		const std::vector<int>& dirty = normEngine.dirtyList();
+		DirtyDesireTask desires(agentStore, dirty, desireKernel);
+		threadPool->parallelFor(0, (int)dirty.size(), PLAY_GRAIN * 16, desires); // only agents with a neighbour that flipped can decide differently
+		normEngine.countTick((int)dirty.size(), agentStore.localCount());
+		normEngine.clearDirty();
+		endPhase(PhaseTimes::DESIRES, mark);
+	}
+	else
+        {
+		NormTask norms(agentStore, adjacency, desireKernel);
+		threadPool->parallelFor(0, agentStore.localCount(), PLAY_GRAIN, norms); // reads neighbours' cycles, local and ghost
+		endPhase(PhaseTimes::NORMS, mark);
+		DesireTask desires(agentStore, desireKernel);
+		threadPool->parallelFor(0, agentStore.localCount(), PLAY_GRAIN * 16, desires); // then every local agent decides whether to cycle
+		if(incrementalNorms) normEngine.countTick(agentStore.localCount(), agentStore.localCount());
+		endPhase(PhaseTimes::DESIRES, mark);
+	}
+	if(trace != 0 && currentTick() % traceInterval == 0)
+        {
+		TraceTask sample(agentStore, *trace, traceEvery, scheduleTick());
+		threadPool->parallelFor(0, agentStore.localCount(), PLAY_GRAIN * 16, sample); // each worker records into its own ring
+		endPhase(PhaseTimes::TRACING, mark);
+	}
+	phaseTimes.ticks++;
+}
+
+PhaseMark RepastHPCModel::startPhase()
+{
+	PhaseMark mark;
+	mark.time = PhaseClock::now();
+	mark.counters = instrumentation.start();
+	mark.pool = poolTraffic();
+	return mark;
+}
+
+void RepastHPCModel::endPhase(int phase, PhaseMark& mark)
+{
+	phaseTimes.seconds[phase] += lap(mark.time);
+	phaseTimes.addAllocations(phase, mark.pool);
+	instrumentation.finish(phase, scheduleTick(), mark.counters, agentStore.localCount(), agentStore.size() - agentStore.localCount());
+	mark.counters = instrumentation.start();
+	mark.pool = poolTraffic();
+}
+
+repast::Schedule::FunctorPtr RepastHPCModel::timed(int phase, repast::Functor* functor)
+{
+	return repast::Schedule::FunctorPtr(new TimedFunctor(repast::Schedule::FunctorPtr(functor), phase, phaseTimes, instrumentation, agentStore));
+}
+
+void RepastHPCModel::reportInstrumentation()
+{
+	std::vector<std::string> names;
+	for(int p = 0; p < PhaseTimes::PHASE_COUNT; p++) names.push_back(PhaseTimes::name(p));
+	boost::mpi::communicator* comm = repast::RepastProcess::instance()->getCommunicator();
+	instrumentation.report(*comm, names, stringProperty("instrumentation.file", ""));
+
+	if(edgeUpdates != 0)
+        {
+		long long changes[2] = { edgesAdded, edgesRemoved }, totals[2] = { 0, 0 };
+		unsigned long builds = adjacency.buildCount(), maxBuilds = 0;
+		boost::mpi::reduce(*comm, changes, 2, totals, std::plus<long long>(), 0);
+		boost::mpi::reduce(*comm, builds, maxBuilds, boost::mpi::maximum<unsigned long>(), 0);
+		if(comm->rank() == 0) std::cout << "REWIRE: " << totals[0] << " edge ends added, " << totals[1] << " removed, adjacency built " << maxBuilds << " times at most on a rank" << std::endl;
+	}
+	if(incrementalNorms)
+        {
+		unsigned long long counts[2] = { normEngine.evaluatedCount(), normEngine.localCount() }, totals[2] = { 0, 0 };
+		boost::mpi::reduce(*comm, counts, 2, totals, std::plus<unsigned long long>(), 0);
+		if(comm->rank() == 0) std::cout << "NORMS: evaluated " << (totals[1] > 0 ? 100.0 * totals[0] / totals[1] : 0) << "% of agent ticks" << std::endl;
+	}
+
+	std::vector<boost::uint64_t> allocations(PhaseTimes::PHASE_COUNT), slabs(PhaseTimes::PHASE_COUNT);
+	boost::mpi::reduce(*comm, phaseTimes.allocations, PhaseTimes::PHASE_COUNT, &allocations[0], std::plus<boost::uint64_t>(), 0);
+	boost::mpi::reduce(*comm, phaseTimes.slabs, PhaseTimes::PHASE_COUNT, &slabs[0], std::plus<boost::uint64_t>(), 0);
+	if(comm->rank() != 0) return;
+	std::cout << "ALLOCATIONS: phase, pool allocations, slabs, summed over " << comm->size() << " ranks" << std::endl;
+	for(int p = 0; p < PhaseTimes::PHASE_COUNT; p++)
+        {
+		if(allocations[p] > 0 || slabs[p] > 0) std::cout << "  " << names[p] << ", " << allocations[p] << ", " << slabs[p] << std::endl;
+	}
 }
 
 void RepastHPCModel::initSchedule(repast::ScheduleRunner& runner) //runner object used to schedule events in the simulation
 {
-	runner.scheduleEvent(1, repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::requestAgents))); // event runs at timestep 1 of simulation and second parameter is a special class FunctorPtr that allows model instance method to be called.
-    runner.scheduleEvent(1.1, repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::connectAgentNetwork)));
-	runner.scheduleEvent(2, 1, repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::doSomething))); // second parameter indicates that doSomething() is run every tick
-	runner.scheduleEvent(3, repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::moveAgents)));
+	if(resumeTick <= 0) // a restarted run already has its ghosts, network and placement
+        {
+		runner.scheduleEvent(1.1, timed(PhaseTimes::CONNECT, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::connectAgentNetwork))); // imports the ghosts its edges need, second parameter is a special class FunctorPtr that allows model instance method to be called.
+		if(stringProperty("placement.enabled", "true") != "false") runner.scheduleEvent(1.2, timed(PhaseTimes::PLACE, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::placeAgents))); // partition once the network exists
+		runner.scheduleEvent(1.3, timed(PhaseTimes::RENUMBER, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::renumberAgents))); // once agents have settled on their ranks
+	}
+	runner.scheduleEvent(firstEventTick(2, 1), 1, timed(PhaseTimes::TICK, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::doSomething))); // second parameter indicates that doSomething() is run every tick
+	if(edgeUpdates != 0) runner.scheduleEvent(firstEventTick(2 + REWIRE_OFFSET, 1), 1, timed(PhaseTimes::REWIRE, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::rewireAgentNetwork))); // collective every tick, even with nothing queued
+	int balanceInterval = intProperty("balance.interval", 0);
+	if(balanceInterval > 0) runner.scheduleEvent(firstEventTick(balanceInterval + BALANCE_OFFSET, balanceInterval), balanceInterval, timed(PhaseTimes::BALANCE, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::balanceAgents))); // measures every interval, moves agents only when the ranks drift apart
+	int checkpointInterval = intProperty("checkpoint.interval", 0);
+	if(checkpointInterval > 0) runner.scheduleEvent(firstEventTick(checkpointInterval + CHECKPOINT_OFFSET, checkpointInterval), checkpointInterval, timed(PhaseTimes::SAVE, new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::writeCheckpoint))); // after the tick's update and recording
 	runner.scheduleEndEvent(repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::recordResults)));
+	runner.scheduleEndEvent(repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::reportInstrumentation)));
+	if(trace != 0) runner.scheduleEndEvent(repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel> (this, &RepastHPCModel::closeTrace)));
 	runner.scheduleStop(stopAt); // simulation stops at stopAt time specified in the properties file.
 
 	// Data collection
-	runner.scheduleEvent(1.5, 5, repast::Schedule::FunctorPtr(new repast::MethodFunctor<repast::DataSet>(agentValues, &repast::DataSet::record)));
-	runner.scheduleEvent(10.6, 10, repast::Schedule::FunctorPtr(new repast::MethodFunctor<repast::DataSet>(agentValues, &repast::DataSet::write)));
+	int recordInterval = intProperty("data.record.interval", 5);
+	if(binaryValues != 0)
+        {
+		runner.scheduleEvent(firstEventTick(1.5, recordInterval), recordInterval, timed(PhaseTimes::RECORD, new repast::MethodFunctor<BinaryDataSet>(binaryValues, &BinaryDataSet::record)));
+		runner.scheduleEvent(firstEventTick(10.6, 10), 10, timed(PhaseTimes::OUTPUT, new repast::MethodFunctor<BinaryDataSet>(binaryValues, &BinaryDataSet::write))); // queues the rows, the writer thread does the disk work
+		runner.scheduleEndEvent(repast::Schedule::FunctorPtr(new repast::MethodFunctor<RepastHPCModel>(this, &RepastHPCModel::closeOutput)));
+		return;
+	}
+	runner.scheduleEvent(firstEventTick(1.5, recordInterval), recordInterval, timed(PhaseTimes::RECORD, new repast::MethodFunctor<repast::DataSet>(agentValues, &repast::DataSet::record))); // recording reads maintained aggregates, so every tick is cheap
+	runner.scheduleEvent(firstEventTick(10.6, 10), 10, timed(PhaseTimes::OUTPUT, new repast::MethodFunctor<repast::DataSet>(agentValues, &repast::DataSet::write)));
 	runner.scheduleEndEvent(repast::Schedule::FunctorPtr(new repast::MethodFunctor<repast::DataSet>(agentValues, &repast::DataSet::write)));
 }
 
@@ -310,7 +1506,7 @@ void RepastHPCModel::recordResults() //scheduled to run as an end event. Writes
 		keyOrder.push_back("RunNumber"); //properties to be output added to vector
 		keyOrder.push_back("stop.at");
 		keyOrder.push_back("Result");
-		props->writeToSVFile("./output/results.csv", keyOrder); // keyOrder prop values output to file
+		props->writeToSVFile(stringProperty("output.results.file", "./output/results.csv"), keyOrder); // keyOrder prop values output to file
     }
 }
 
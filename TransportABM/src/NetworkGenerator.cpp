@@ -0,0 +1,283 @@
+/* NetworkGenerator.cpp */
+
+#include <algorithm> // std::sort, std::upper_bound
+#include <cmath> // std::exp, std::fabs
+#include "NetworkGenerator.h"
+#include "BufferExchange.h"
+
+namespace {
+
+const int NETWORK_EDGE_TAG    = 7201;
+const int SPATIAL_REQUEST_TAG = 7202;
+
+/* Draw indices within one (vertex, slot) stream */
+const boost::uint32_t DRAW_REWIRE     = 0;
+const boost::uint32_t DRAW_TARGET     = 1;
+const boost::uint32_t DRAW_WEIGHT     = 2;
+const boost::uint32_t DRAW_CONFIDENCE = 3;
+const boost::uint32_t DRAW_REGION     = 4;
+const boost::uint32_t DRAW_OTHER      = 5;
+const boost::uint32_t DRAW_ACCEPT     = 6; // spatial acceptance tests use DRAW_ACCEPT + attempt
+
+const boost::uint32_t SCALE_FREE_SLOT = 0x80000000u; // copy model draws are keyed by edge number, kept apart from vertex slots
+const int SPATIAL_ATTEMPTS = 8; // candidates tried before the last one is accepted unconditionally
+
+/* Request for a partner in a region, resolved by the rank holding the chosen candidate */
+struct SpatialRequest
+{
+    boost::int64_t source;
+    double         commuteDist;
+    boost::int64_t position; // candidate's position in the region's members, in global vertex order
+    boost::int32_t region;
+    boost::uint32_t slot;
+    boost::int32_t attempt;
+    boost::int32_t padding;
+};
+
+int memberRank(const std::vector<int>& counts, const std::vector<boost::int64_t>& regionBefore, int regions, int region, boost::int64_t position) // rank holding a region member
+{
+    int worldSize = (int)(regionBefore.size() / regions);
+    int r = 0;
+    while(r < worldSize - 1 && position >= regionBefore[r * regions + region] + counts[r * regions + region]) r++;
+    return r;
+}
+
+bool edgeLess(const NetworkEdge& a, const NetworkEdge& b) // by endpoints, then content so duplicates resolve alike on every rank
+{
+    if(a.source != b.source) return a.source < b.source;
+    if(a.target != b.target) return a.target < b.target;
+    if(a.weight != b.weight) return a.weight < b.weight;
+    return a.confidence < b.confidence;
+}
+
+bool edgeSame(const NetworkEdge& a, const NetworkEdge& b)
+{
+    return a.source == b.source && a.target == b.target;
+}
+
+}
+
+NetworkGenerator::NetworkGenerator(boost::mpi::communicator* comm, int localVertices, const CounterRandom& random, double minWeight, double maxWeight, int maxConfidence):
+    comm(comm), random(random), minWeight(minWeight), maxWeight(maxWeight), maxConfidence(maxConfidence)
+{
+    std::vector<int> counts;
+    boost::mpi::all_gather(*comm, localVertices, counts);
+    firstVertex.assign(1, 0);
+    for(size_t r = 0; r < counts.size(); r++) firstVertex.push_back(firstVertex.back() + counts[r]);
+}
+
+int NetworkGenerator::owner(boost::int64_t vertex) const
+{
+    return (int)(std::upper_bound(firstVertex.begin(), firstVertex.end(), vertex) - firstVertex.begin()) - 1;
+}
+
+repast::AgentId NetworkGenerator::agentId(boost::int64_t vertex) const
+{
+    int rank = owner(vertex);
+    return repast::AgentId((int)(vertex - firstVertex[rank]), rank, 0);
+}
+
+double NetworkGenerator::draw(boost::int64_t vertex, boost::uint32_t slot, boost::uint32_t index) const
+{
+    return random.uniform((boost::uint32_t)vertex, (boost::uint32_t)((boost::uint64_t)vertex >> 32), slot, index);
+}
+
+NetworkEdge NetworkGenerator::makeEdge(boost::int64_t source, boost::int64_t target, boost::uint32_t slot) const
+{
+    NetworkEdge edge;
+    edge.source     = source;
+    edge.target     = target;
+    edge.weight     = minWeight + (maxWeight - minWeight) * draw(source, slot, DRAW_WEIGHT);
+    edge.confidence = 1 + (int)(maxConfidence * draw(source, slot, DRAW_CONFIDENCE));
+    if(edge.confidence > maxConfidence) edge.confidence = maxConfidence;
+    edge.padding    = 0;
+    return edge;
+}
+
+void NetworkGenerator::smallWorld(int neighbours, double rewire, std::vector<NetworkEdge>& edges) const
+{
+    boost::int64_t n = vertexCount();
+    if(n < 2) return;
+    int half = neighbours / 2; // each vertex generates the lattice edges to its clockwise neighbours
+    boost::int64_t first = localFirst();
+    boost::int64_t last  = firstVertex[comm->rank() + 1];
+    edges.reserve(edges.size() + (last - first) * half);
+    for(boost::int64_t u = first; u < last; u++)
+    {
+        for(int j = 1; j <= half; j++)
+        {
+            boost::int64_t v = (u + j) % n;
+            if(draw(u, j, DRAW_REWIRE) < rewire)
+            {
+                v = (boost::int64_t)(draw(u, j, DRAW_TARGET) * n);
+                if(v >= n) v = n - 1;
+            }
+            if(v == u) continue;
+            edges.push_back(makeEdge(u, v, j));
+        }
+    }
+}
+
+boost::int64_t NetworkGenerator::scaleFreeTarget(boost::int64_t edge, int edgesPerVertex) const
+{
+    // Edge e picks a uniform position in the endpoint list of edges [0, e). Even positions are the source of an
+    // earlier edge, which is known directly; odd positions are the target of an earlier edge, resolved the same way.
+    while(edge > 0)
+    {
+        boost::int64_t position = (boost::int64_t)(draw(edge, SCALE_FREE_SLOT, 0) * (2 * edge));
+        if(position >= 2 * edge) position = 2 * edge - 1;
+        if(position % 2 == 0) return (position / 2) / edgesPerVertex;
+        edge = (position - 1) / 2;
+    }
+    return 0;
+}
+
+void NetworkGenerator::scaleFree(int edgesPerVertex, std::vector<NetworkEdge>& edges) const
+{
+    boost::int64_t first = localFirst();
+    boost::int64_t last  = firstVertex[comm->rank() + 1];
+    edges.reserve(edges.size() + (last - first) * edgesPerVertex);
+    for(boost::int64_t u = first; u < last; u++)
+    {
+        for(int j = 0; j < edgesPerVertex; j++)
+        {
+            boost::int64_t v = scaleFreeTarget(u * edgesPerVertex + j, edgesPerVertex);
+            if(v == u) continue;
+            edges.push_back(makeEdge(u, v, j));
+        }
+    }
+}
+
+void NetworkGenerator::spatial(const std::vector<int>& localRegion, const std::vector<double>& localCommuteDist, int edgesPerVertex,
+                               double sameRegion, double distanceScale, std::vector<NetworkEdge>& edges) const
+{
+    int worldSize = comm->size();
+    int localCount = (int)localRegion.size();
+    boost::int64_t first = localFirst();
+
+    // Regions known everywhere and how many members each rank holds; unset regions count as region 0
+    int localMax = 0;
+    for(int i = 0; i < localCount; i++) localMax = std::max(localMax, localRegion[i]);
+    int regions = 0;
+    boost::mpi::all_reduce(*comm, localMax + 1, regions, boost::mpi::maximum<int>());
+    std::vector<std::vector<int> > members(regions); // local vertex offsets per region, ascending
+    for(int i = 0; i < localCount; i++) members[std::max(0, localRegion[i])].push_back(i);
+    std::vector<int> localCounts(regions), counts(worldSize * regions);
+    for(int g = 0; g < regions; g++) localCounts[g] = (int)members[g].size();
+    boost::mpi::all_gather(*comm, localCounts.data(), regions, counts.data());
+    std::vector<boost::int64_t> regionTotal(regions, 0), regionBefore(worldSize * regions); // members per region, and on the ranks before each
+    for(int r = 0; r < worldSize; r++)
+    {
+        for(int g = 0; g < regions; g++)
+        {
+            regionBefore[r * regions + g] = regionTotal[g];
+            regionTotal[g] += counts[r * regions + g];
+        }
+    }
+
+    // Pick a region and a uniform member of it for every edge slot, and ask the member's rank to resolve it
+    std::vector<std::vector<char> > send(worldSize), received;
+    for(int i = 0; i < localCount; i++)
+    {
+        boost::int64_t u = first + i;
+        int home = std::max(0, localRegion[i]);
+        for(int j = 0; j < edgesPerVertex; j++)
+        {
+            int region = home;
+            if(regions > 1 && draw(u, j, DRAW_REGION) >= sameRegion)
+            {
+                int other = (int)(draw(u, j, DRAW_OTHER) * (regions - 1));
+                region = (other < home) ? other : other + 1;
+            }
+            if(regionTotal[region] == 0) region = home;
+
+            SpatialRequest request;
+            request.source      = u;
+            request.commuteDist = localCommuteDist[i];
+            request.position    = std::min(regionTotal[region] - 1, (boost::int64_t)(draw(u, j, DRAW_TARGET) * regionTotal[region]));
+            request.region      = region;
+            request.slot        = j;
+            request.attempt     = 0;
+            request.padding     = 0;
+            appendRecord(send[memberRank(counts, regionBefore, regions, region, request.position)], request);
+        }
+    }
+
+    // Resolve: walk the region's members in global order from the chosen one, accepting with a commute distance kernel.
+    // A request rejected at the last member a rank holds moves on to the rank holding the next one, so the walk and
+    // every edge it makes do not depend on where the rank boundaries fall.
+    int rank = comm->rank();
+    int moving = 1;
+    while(moving)
+    {
+        exchangeBuffers(*comm, send, received, SPATIAL_REQUEST_TAG);
+        for(int r = 0; r < worldSize; r++) send[r].clear();
+        for(int r = 0; r < worldSize; r++)
+        {
+            for(size_t k = 0; k < recordCount<SpatialRequest>(received[r]); k++)
+            {
+                SpatialRequest request = readRecord<SpatialRequest>(received[r], k);
+                while(true)
+                {
+                    int v = members[request.region][request.position - regionBefore[rank * regions + request.region]];
+                    if(first + v != request.source)
+                    {
+                        double affinity = std::exp(-std::fabs(request.commuteDist - localCommuteDist[v]) / distanceScale);
+                        if(request.attempt == SPATIAL_ATTEMPTS - 1 || draw(request.source, request.slot, DRAW_ACCEPT + request.attempt) < affinity)
+                        {
+                            edges.push_back(makeEdge(request.source, first + v, request.slot));
+                            break;
+                        }
+                    }
+                    if(request.attempt == SPATIAL_ATTEMPTS - 1) break;
+                    request.attempt++;
+                    request.position = (request.position + 1) % regionTotal[request.region];
+                    int next = memberRank(counts, regionBefore, regions, request.region, request.position);
+                    if(next == rank) continue;
+                    appendRecord(send[next], request);
+                    break;
+                }
+            }
+        }
+        int local = 0;
+        for(int r = 0; r < worldSize && !local; r++) local = send[r].empty() ? 0 : 1;
+        boost::mpi::all_reduce(*comm, local, moving, boost::mpi::maximum<int>()); // at most SPATIAL_ATTEMPTS rounds
+    }
+}
+
+void NetworkGenerator::distribute(std::vector<NetworkEdge>& edges) const
+{
+    int worldSize = comm->size();
+    int rank = comm->rank();
+
+    std::vector<std::vector<char> > send(worldSize), received;
+    std::vector<NetworkEdge> kept;
+    kept.reserve(edges.size());
+    for(size_t e = 0; e < edges.size(); e++)
+    {
+        NetworkEdge& edge = edges[e];
+        if(edge.source == edge.target) continue;
+        if(edge.source > edge.target) std::swap(edge.source, edge.target); // undirected, normalised for deduplication
+        int a = owner(edge.source);
+        int b = owner(edge.target);
+        if(a == rank || b == rank) kept.push_back(edge);
+        if(a != rank) appendRecord(send[a], edge);
+        if(b != rank && b != a) appendRecord(send[b], edge);
+    }
+    exchangeBuffers(*comm, send, received, NETWORK_EDGE_TAG);
+    for(int r = 0; r < worldSize; r++)
+    {
+        for(size_t k = 0; k < recordCount<NetworkEdge>(received[r]); k++) kept.push_back(readRecord<NetworkEdge>(received[r], k));
+    }
+
+    // Duplicate pairs can come from different slots with different weights; both endpoint ranks keep the same one
+    std::sort(kept.begin(), kept.end(), edgeLess);
+    kept.erase(std::unique(kept.begin(), kept.end(), edgeSame), kept.end());
+    edges.swap(kept);
+}
+
+const std::vector<NetworkEdge>* NetworkCache::find(const std::string& key) const
+{
+    std::map<std::string, std::vector<NetworkEdge> >::const_iterator found = networks.find(key);
+    return found == networks.end() ? 0 : &found->second;
+}
@@ -0,0 +1,111 @@
+/* NormEngine.cpp */
+
+#include "NormEngine.h"
+
+NormEngine::NormEngine(): builtFor(0), resyncInterval(100), built(false), evaluatedRows(0), localRows(0){ }
+
+void NormEngine::configure(int workers, int resync)
+{
+    flips.assign(workers > 0 ? workers : 1, std::vector<int>());
+    resyncInterval = resync;
+    built = false;
+}
+
+bool NormEngine::refresh(const AgentAdjacency& adjacency, AgentStateStore& store, long tick)
+{
+    bool due = resyncInterval > 0 && tick % resyncInterval == 0; // absolute ticks, so a restarted run resyncs on the same ones
+    if(built && builtFor == adjacency.buildCount() && !due) return false;
+
+    int local = store.localCount();
+    cycling.assign(local, 0);
+    weight.assign(local, 0);
+    for(int i = 0; i < local; i++) // in adjacency order, like DesireKernel::updateSocialNorms
+    {
+        double c = 0, all = 0;
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            double w = adjacency.weight[k];
+            c   += w * store.cycles[adjacency.neighbour[k]];
+            all += w;
+        }
+        cycling[i] = c;
+        weight[i]  = all;
+    }
+    propagated.assign(store.cycles.begin(), store.cycles.end());
+    dirty.assign(local, 0);
+    dirtyRows.clear();
+    for(size_t w = 0; w < flips.size(); w++) flips[w].clear(); // already in the counts
+    builtFor = adjacency.buildCount();
+    built = true;
+    return true;
+}
+
+void NormEngine::push(const AgentAdjacency& adjacency, const AgentStateStore& store, int row)
+{
+    int change = (int)store.cycles[row] - (int)propagated[row]; // zero for a row that flipped back, or was already pushed
+    if(change == 0) return;
+    propagated[row] = store.cycles[row];
+    int local = store.localCount();
+    for(int k = adjacency.begin(row); k < adjacency.end(row); k++) // an edge has the same weight from both ends
+    {
+        int target = adjacency.neighbour[k];
+        if(target >= local) continue;
+        cycling[target] += change * adjacency.weight[k];
+        if(dirty[target]) continue;
+        dirty[target] = 1;
+        dirtyRows.push_back(target);
+    }
+}
+
+void NormEngine::pushFlips(const AgentAdjacency& adjacency, const AgentStateStore& store)
+{
+    for(size_t w = 0; w < flips.size(); w++)
+    {
+        for(size_t f = 0; f < flips[w].size(); f++) push(adjacency, store, flips[w][f]);
+        flips[w].clear();
+    }
+}
+
+void NormEngine::propagate(const AgentAdjacency& adjacency, AgentStateStore& store, const std::vector<int>& changedGhosts)
+{
+    pushFlips(adjacency, store);
+    for(size_t g = 0; g < changedGhosts.size(); g++) push(adjacency, store, changedGhosts[g]);
+
+    for(size_t d = 0; d < dirtyRows.size(); d++)
+    {
+        int row = dirtyRows[d];
+        double share = (weight[row] > 0) ? cycling[row] / weight[row] : 0;
+        store.socNorm[row] = share < 0 ? 0 : share; // a running sum may dip just below zero
+    }
+}
+
+void NormEngine::edgesChanged(const AgentAdjacency& adjacency, const AgentStateStore& store, const std::vector<int>& rows)
+{
+    if(!built || builtFor != adjacency.buildCount()) return; // refresh() rebuilds everything anyway
+    int local = store.localCount();
+    propagated.resize(store.size());
+    pushFlips(adjacency, store); // so the recounts below are not pushed to again
+    for(int j = local; j < store.size(); j++) propagated[j] = store.cycles[j]; // ghost rows may have come, gone or moved; none has a push pending
+    for(size_t r = 0; r < rows.size(); r++)
+    {
+        int row = rows[r];
+        double c = 0, all = 0;
+        for(int k = adjacency.begin(row); k < adjacency.end(row); k++)
+        {
+            double w = adjacency.weight[k];
+            c   += w * store.cycles[adjacency.neighbour[k]];
+            all += w;
+        }
+        cycling[row] = c;
+        weight[row]  = all;
+        if(dirty[row]) continue;
+        dirty[row] = 1; // socNorm is recomputed by the next propagate()
+        dirtyRows.push_back(row);
+    }
+}
+
+void NormEngine::clearDirty()
+{
+    for(size_t d = 0; d < dirtyRows.size(); d++) dirty[dirtyRows[d]] = 0;
+    dirtyRows.clear();
+}
@@ -0,0 +1,303 @@
+/* OutputWriter.cpp */
+
+#include <cstddef> // offsetof
+#include <cstring> // std::memcmp, std::memcpy, std::memset, std::strncpy
+#include <fstream>
+#include <stdexcept>
+#ifdef TRANSPORT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "OutputWriter.h"
+
+namespace {
+
+const char OUTPUT_MAGIC[8] = { 'T', 'A', 'B', 'M', 'O', 'U', 'T', '1' };
+
+}
+
+AsyncOutputWriter::AsyncOutputWriter(const std::string& path, int rank, int worldSize, size_t rowsPerBlock, size_t queueBlocks, bool compressBlocks):
+    file(0), compress(compressBlocks && compressionAvailable()), capacity(queueBlocks > 0 ? queueBlocks : 1), closing(false), failed(false),
+    peakBacklog(0), stalls(0), blocksWritten(0), bytesWritten(0), current(0), blockRows(rowsPerBlock > 0 ? rowsPerBlock : 1)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if(file == 0) throw std::runtime_error("Cannot write " + path);
+
+    OutputFileHeader header; // column count is patched in when the writer starts
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, OUTPUT_MAGIC, sizeof(OUTPUT_MAGIC));
+    header.version   = 1;
+    header.rank      = (boost::uint32_t)rank;
+    header.worldSize = (boost::uint32_t)worldSize;
+    std::fwrite(&header, sizeof(header), 1, file);
+}
+
+AsyncOutputWriter::~AsyncOutputWriter()
+{
+    try
+    {
+        close();
+    }
+    catch(const std::exception&){ } // already reported by an explicit close()
+}
+
+bool AsyncOutputWriter::compressionAvailable()
+{
+#ifdef TRANSPORT_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+int AsyncOutputWriter::addColumn(const std::string& name, OutputColumnType type)
+{
+    if(writer.joinable() || current != 0) throw std::logic_error("Output columns must be added before the first row");
+    OutputColumn column;
+    std::memset(&column, 0, sizeof(column));
+    std::strncpy(column.name, name.c_str(), sizeof(column.name) - 1);
+    column.type = (boost::uint32_t)type;
+    columns.push_back(column);
+    return (int)columns.size() - 1;
+}
+
+void AsyncOutputWriter::appendRow(double tick, const std::vector<OutputValue>& row)
+{
+    if(!writer.joinable()) // columns are fixed from the first row on
+    {
+        boost::uint32_t count = (boost::uint32_t)columns.size();
+        std::fseek(file, (long)offsetof(OutputFileHeader, columns), SEEK_SET);
+        std::fwrite(&count, sizeof(count), 1, file);
+        std::fseek(file, (long)sizeof(OutputFileHeader), SEEK_SET);
+        if(!columns.empty()) std::fwrite(&columns[0], sizeof(OutputColumn), columns.size(), file);
+        writer = std::thread(&AsyncOutputWriter::writerLoop, this);
+    }
+    if(current == 0)
+    {
+        current = new Block();
+        current->firstTick = tick;
+        current->ticks.reserve(blockRows);
+        current->values.reserve(blockRows * columns.size());
+    }
+    current->ticks.push_back(tick);
+    current->values.insert(current->values.end(), row.begin(), row.begin() + columns.size());
+    if(current->ticks.size() >= blockRows) flush();
+}
+
+void AsyncOutputWriter::flush()
+{
+    if(current == 0) return;
+    std::unique_lock<std::mutex> guard(lock);
+    if(queue.size() >= capacity)
+    {
+        stalls++;
+        drained.wait(guard, [this]{ return queue.size() < capacity; });
+    }
+    queue.push_back(current);
+    current = 0;
+    if(queue.size() > peakBacklog) peakBacklog = queue.size();
+    queued.notify_one();
+}
+
+size_t AsyncOutputWriter::backlog()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return queue.size();
+}
+
+void AsyncOutputWriter::close()
+{
+    if(file == 0) return;
+    flush();
+    if(writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closing = true;
+        }
+        queued.notify_one();
+        writer.join();
+    }
+    else if(current == 0) // no rows at all: still leave a readable file with its columns
+    {
+        boost::uint32_t count = (boost::uint32_t)columns.size();
+        std::fseek(file, (long)offsetof(OutputFileHeader, columns), SEEK_SET);
+        std::fwrite(&count, sizeof(count), 1, file);
+        std::fseek(file, (long)sizeof(OutputFileHeader), SEEK_SET);
+        if(!columns.empty()) std::fwrite(&columns[0], sizeof(OutputColumn), columns.size(), file);
+    }
+    if(std::fclose(file) != 0) failed = true;
+    file = 0;
+    if(failed) throw std::runtime_error("Writing the binary output failed");
+}
+
+void AsyncOutputWriter::writerLoop()
+{
+    std::vector<char> raw; // reused between blocks
+    std::vector<char> packed;
+    while(true)
+    {
+        Block* block = 0;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            queued.wait(guard, [this]{ return closing || !queue.empty(); });
+            if(queue.empty()) return; // closing and drained
+            block = queue.front();
+            queue.pop_front();
+        }
+        drained.notify_one();
+        if(!writeBlock(*block, raw, packed)) failed = true;
+        delete block;
+    }
+}
+
+bool AsyncOutputWriter::writeBlock(const Block& block, std::vector<char>& raw, std::vector<char>& packed)
+{
+    size_t rows  = block.ticks.size();
+    size_t width = columns.size();
+    raw.resize((1 + width) * rows * sizeof(OutputValue));
+    char* out = &raw[0];
+    std::memcpy(out, &block.ticks[0], rows * sizeof(double));
+    out += rows * sizeof(double);
+    for(size_t c = 0; c < width; c++) // transpose into columns, which compress far better than rows
+    {
+        for(size_t r = 0; r < rows; r++, out += sizeof(OutputValue)) std::memcpy(out, &block.values[r * width + c], sizeof(OutputValue));
+    }
+
+    OutputBlockHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.rows        = (boost::uint32_t)rows;
+    header.rawBytes    = raw.size();
+    header.storedBytes = raw.size();
+    const char* payload = &raw[0];
+#ifdef TRANSPORT_HAVE_ZLIB
+    if(compress)
+    {
+        uLongf size = compressBound((uLong)raw.size());
+        packed.resize(size);
+        if(compress2((Bytef*)&packed[0], &size, (const Bytef*)&raw[0], (uLong)raw.size(), Z_BEST_SPEED) == Z_OK && size < raw.size())
+        {
+            header.compressed  = 1;
+            header.storedBytes = size;
+            payload = &packed[0];
+        }
+    }
+#endif
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fwrite(payload, 1, (size_t)header.storedBytes, file) == header.storedBytes;
+    blocksWritten++;
+    bytesWritten += sizeof(header) + header.storedBytes;
+    return ok;
+}
+
+
+BinaryDataSet::BinaryDataSet(const std::string& path, int rank, int worldSize, size_t rowsPerBlock, size_t queueBlocks, bool compressBlocks, double (*tick)()):
+    writer(path, rank, worldSize, rowsPerBlock, queueBlocks, compressBlocks), tickNow(tick){ }
+
+BinaryDataSet::~BinaryDataSet()
+{
+    for(size_t i = 0; i < doubleSources.size(); i++) delete doubleSources[i];
+    for(size_t i = 0; i < intSources.size(); i++) delete intSources[i];
+}
+
+void BinaryDataSet::addDataSource(const std::string& name, repast::TDataSource<double>* source)
+{
+    writer.addColumn(name, OUTPUT_DOUBLE);
+    order.push_back(std::make_pair(OUTPUT_DOUBLE, doubleSources.size()));
+    doubleSources.push_back(source);
+}
+
+void BinaryDataSet::addDataSource(const std::string& name, repast::TDataSource<boost::int64_t>* source)
+{
+    writer.addColumn(name, OUTPUT_INT64);
+    order.push_back(std::make_pair(OUTPUT_INT64, intSources.size()));
+    intSources.push_back(source);
+}
+
+void BinaryDataSet::record()
+{
+    row.resize(order.size());
+    for(size_t c = 0; c < order.size(); c++)
+    {
+        if(order[c].first == OUTPUT_DOUBLE) row[c].d = doubleSources[order[c].second]->getData();
+        else row[c].i = intSources[order[c].second]->getData();
+    }
+    writer.appendRow(tickNow(), row);
+}
+
+void BinaryDataSet::write()
+{
+    writer.flush();
+}
+
+void BinaryDataSet::close()
+{
+    writer.close();
+}
+
+void readBinaryOutput(const std::string& path, BinaryOutput& output)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in) throw std::runtime_error("Cannot open " + path);
+    OutputFileHeader header;
+    if(!in.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, OUTPUT_MAGIC, sizeof(OUTPUT_MAGIC)) != 0 || header.version != 1)
+    {
+        throw std::runtime_error(path + " is not a version 1 binary output file");
+    }
+    output.columns.resize(header.columns);
+    if(header.columns > 0) in.read((char*)&output.columns[0], header.columns * sizeof(OutputColumn));
+    size_t width = header.columns;
+
+    std::vector<char> stored;
+    std::vector<char> raw;
+    OutputBlockHeader block;
+    while(in.read((char*)&block, sizeof(block)))
+    {
+        stored.resize((size_t)block.storedBytes);
+        if(!stored.empty() && !in.read(&stored[0], stored.size())) throw std::runtime_error(path + " ends inside a block");
+        if(block.rawBytes != (1 + width) * block.rows * sizeof(OutputValue)) throw std::runtime_error(path + " has a malformed block");
+        if(block.compressed)
+        {
+#ifdef TRANSPORT_HAVE_ZLIB
+            raw.resize((size_t)block.rawBytes);
+            uLongf size = (uLongf)raw.size();
+            if(uncompress((Bytef*)&raw[0], &size, (const Bytef*)&stored[0], (uLong)stored.size()) != Z_OK || size != raw.size())
+            {
+                throw std::runtime_error(path + " has a corrupt compressed block");
+            }
+#else
+            throw std::runtime_error(path + " is compressed; rebuild with TRANSPORT_HAVE_ZLIB to read it");
+#endif
+        }
+        else
+        {
+            raw.swap(stored);
+        }
+
+        size_t rows = block.rows;
+        if(rows == 0) continue;
+        size_t first = output.ticks.size();
+        output.ticks.resize(first + rows);
+        output.values.resize((first + rows) * width);
+        std::memcpy(&output.ticks[first], &raw[0], rows * sizeof(double));
+        const char* column = &raw[0] + rows * sizeof(double);
+        for(size_t c = 0; c < width; c++) // blocks hold columns, rows are rebuilt here
+        {
+            for(size_t r = 0; r < rows; r++, column += sizeof(OutputValue)) std::memcpy(&output.values[(first + r) * width + c], column, sizeof(OutputValue));
+        }
+    }
+}
+
+void sumBinaryOutputs(const std::vector<BinaryOutput>& ranks, BinaryOutput& sum)
+{
+    if(ranks.empty()) throw std::runtime_error("No binary output to sum");
+    sum = ranks[0];
+    size_t width = sum.columns.size();
+    for(size_t r = 1; r < ranks.size(); r++)
+    {
+        if(ranks[r].columns.size() != width || ranks[r].ticks != sum.ticks) throw std::runtime_error("Binary outputs of different runs cannot be summed");
+        for(size_t at = 0; at < sum.values.size(); at++)
+        {
+            if(sum.columns[at % width].type == OUTPUT_INT64) sum.values[at].i += ranks[r].values[at].i;
+            else sum.values[at].d += ranks[r].values[at].d;
+        }
+    }
+}
@@ -0,0 +1,172 @@
+/* Population.cpp */
+
+#include <cstdlib> // std::atoi, std::atof
+#include <cstring> // std::memcmp, std::memcpy, std::strncpy
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <stdexcept>
+#include <sys/mman.h> // mmap, madvise
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Population.h"
+
+namespace {
+
+const char POPULATION_MAGIC[8] = { 'T', 'A', 'B', 'M', 'P', 'O', 'P', '1' };
+
+boost::uint64_t align8(boost::uint64_t offset)
+{
+    return (offset + 7) & ~(boost::uint64_t)7;
+}
+
+bool fits(boost::uint64_t offset, boost::uint64_t size, size_t length) // [offset, offset + size) lies in the file, without overflowing
+{
+    return offset <= length && size <= length - offset;
+}
+
+template<typename T>
+void writeColumn(std::ofstream& out, boost::uint64_t offset, const std::vector<T>& column)
+{
+    out.seekp(offset);
+    if(!column.empty()) out.write((const char*)&column[0], column.size() * sizeof(T));
+}
+
+}
+
+PopulationFile::PopulationFile(const std::string& path): fd(-1), length(0), base(0), header(0)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("Cannot open population file " + path);
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(PopulationHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Population file " + path + " is too short");
+    }
+    length = (size_t)info.st_size;
+    void* mapping = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot map population file " + path);
+    }
+    base = (const char*)mapping;
+    header = (const PopulationHeader*)base;
+
+    boost::uint64_t rows = header->rowCount;
+    if(std::memcmp(header->magic, POPULATION_MAGIC, sizeof(POPULATION_MAGIC)) != 0 || header->version != 1 || rows > length ||
+       !fits(header->regionTableOffset, (boost::uint64_t)header->regionCount * REGION_NAME_LENGTH, length) ||
+       !fits(header->cyclesOffset, rows, length) || !fits(header->regionOffset, 4 * rows, length) ||
+       !fits(header->commuteDistOffset, 8 * rows, length) || !fits(header->socNormOffset, 8 * rows, length) || !fits(header->ageOffset, 4 * rows, length))
+    {
+        munmap(mapping, length);
+        close(fd);
+        throw std::runtime_error(path + " is not a version 1 population file");
+    }
+}
+
+PopulationFile::~PopulationFile()
+{
+    munmap((void*)base, length);
+    close(fd);
+}
+
+std::string PopulationFile::regionName(int region) const
+{
+    const char* name = base + header->regionTableOffset + (size_t)region * REGION_NAME_LENGTH;
+    size_t size = 0;
+    while(size < (size_t)REGION_NAME_LENGTH && name[size] != 0) size++;
+    return std::string(name, size);
+}
+
+void PopulationFile::slice(int rank, int worldSize, boost::uint64_t& first, boost::uint64_t& count) const
+{
+    first = rows() * rank / worldSize;
+    count = rows() * (rank + 1) / worldSize - first;
+}
+
+void PopulationFile::prefetch(boost::uint64_t first, boost::uint64_t count) const
+{
+    long page = sysconf(_SC_PAGESIZE);
+    boost::uint64_t offsets[5] = { header->ageOffset + 4 * first, header->commuteDistOffset + 8 * first, header->socNormOffset + 8 * first,
+                                   header->regionOffset + 4 * first, header->cyclesOffset + first };
+    boost::uint64_t sizes[5] = { 4 * count, 8 * count, 8 * count, 4 * count, count };
+    for(int c = 0; c < 5; c++)
+    {
+        boost::uint64_t start = offsets[c] - offsets[c] % page; // madvise needs page aligned addresses
+        madvise((void*)(base + start), (size_t)(offsets[c] + sizes[c] - start), MADV_WILLNEED);
+    }
+}
+
+boost::uint64_t PopulationFile::convertCsv(const std::string& csvPath, const std::string& populationPath)
+{
+    std::ifstream in(csvPath.c_str());
+    if(!in) throw std::runtime_error("Cannot open " + csvPath);
+
+    std::vector<boost::int32_t> age;
+    std::vector<double> commuteDist;
+    std::vector<double> socNorm;
+    std::vector<boost::int32_t> region;
+    std::vector<boost::uint8_t> cycles;
+    std::vector<std::string> regionNames;
+
+    std::string line;
+    std::getline(in, line); // header
+    while(std::getline(in, line))
+    {
+        if(line.empty()) continue;
+        std::stringstream row(line);
+        std::string field[5];
+        int fields = 0;
+        while(fields < 5 && std::getline(row, field[fields], ',')) fields++;
+        if(fields < 4) throw std::runtime_error("Malformed population row: " + line);
+
+        age.push_back((boost::int32_t)std::atoi(field[0].c_str()));
+        commuteDist.push_back(std::atof(field[1].c_str()));
+        socNorm.push_back(std::atof(field[2].c_str()));
+        size_t id = 0;
+        while(id < regionNames.size() && regionNames[id] != field[3]) id++; // regions are interned in order of first appearance
+        if(id == regionNames.size()) regionNames.push_back(field[3]);
+        region.push_back((boost::int32_t)id);
+        cycles.push_back(fields > 4 && std::atoi(field[4].c_str()) != 0 ? 1 : 0);
+    }
+
+    PopulationHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, POPULATION_MAGIC, sizeof(POPULATION_MAGIC));
+    header.version           = 1;
+    header.regionCount       = (boost::uint32_t)regionNames.size();
+    header.rowCount          = age.size();
+    header.regionTableOffset = align8(sizeof(PopulationHeader));
+    header.ageOffset         = align8(header.regionTableOffset + regionNames.size() * REGION_NAME_LENGTH);
+    header.commuteDistOffset = align8(header.ageOffset + 4 * header.rowCount);
+    header.socNormOffset     = align8(header.commuteDistOffset + 8 * header.rowCount);
+    header.regionOffset      = align8(header.socNormOffset + 8 * header.rowCount);
+    header.cyclesOffset      = align8(header.regionOffset + 4 * header.rowCount);
+
+    for(size_t r = 0; r < regionNames.size(); r++) // a cut name could read back as another region
+    {
+        if(regionNames[r].size() > (size_t)REGION_NAME_LENGTH) throw std::runtime_error("Region name " + regionNames[r] + " is longer than the population file allows");
+    }
+
+    std::ofstream out(populationPath.c_str(), std::ios::binary | std::ios::trunc);
+    if(!out) throw std::runtime_error("Cannot write " + populationPath);
+    out.write((const char*)&header, sizeof(header));
+    for(size_t r = 0; r < regionNames.size(); r++)
+    {
+        char name[REGION_NAME_LENGTH];
+        std::memset(name, 0, sizeof(name));
+        std::strncpy(name, regionNames[r].c_str(), REGION_NAME_LENGTH);
+        out.seekp(header.regionTableOffset + r * REGION_NAME_LENGTH);
+        out.write(name, REGION_NAME_LENGTH);
+    }
+    writeColumn(out, header.ageOffset, age);
+    writeColumn(out, header.commuteDistOffset, commuteDist);
+    writeColumn(out, header.socNormOffset, socNorm);
+    writeColumn(out, header.regionOffset, region);
+    writeColumn(out, header.cyclesOffset, cycles);
+    if(!out) throw std::runtime_error("Failed writing " + populationPath);
+    return header.rowCount;
+}
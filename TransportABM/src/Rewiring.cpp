@@ -0,0 +1,62 @@
+/* Rewiring.cpp */
+
+#include <cstring> // std::memset
+#include <stdexcept>
+#include "Rewiring.h"
+#include "BufferExchange.h"
+
+namespace {
+
+const int EDGE_UPDATE_TAG = 7401;
+
+void packId(const repast::AgentId& id, boost::int32_t fields[4])
+{
+    fields[0] = id.id();
+    fields[1] = id.startingRank();
+    fields[2] = id.agentType();
+    fields[3] = id.currentRank();
+}
+
+}
+
+EdgeUpdateBatch::EdgeUpdateBatch(int ranks): outgoing(ranks){ }
+
+EdgeUpdate EdgeUpdateBatch::make(const repast::AgentId& source, const repast::AgentId& target, double weight, int confidence, bool remove)
+{
+    EdgeUpdate update;
+    std::memset(&update, 0, sizeof(update)); // no uninitialised padding on the wire
+    packId(source, update.source);
+    packId(target, update.target);
+    update.weight     = weight;
+    update.confidence = confidence;
+    update.remove     = remove ? 1 : 0;
+    return update;
+}
+
+repast::AgentId EdgeUpdateBatch::agentId(const boost::int32_t fields[4])
+{
+    repast::AgentId id(fields[0], fields[1], fields[2]);
+    id.currentRank(fields[3]);
+    return id;
+}
+
+void EdgeUpdateBatch::queue(const EdgeUpdate& update, int rank)
+{
+    if(update.target[3] < 0 || update.target[3] >= (int)outgoing.size()) throw std::runtime_error("Edge update target has no valid current rank");
+    own.push_back(update);
+    if(update.target[3] != rank) appendRecord(outgoing[update.target[3]], update);
+}
+
+void EdgeUpdateBatch::exchange(boost::mpi::communicator& comm, std::vector<EdgeUpdate>& updates)
+{
+    std::vector<std::vector<char> > received;
+    exchangeBuffers(comm, outgoing, received, EDGE_UPDATE_TAG);
+    updates.clear();
+    for(int r = 0; r < (int)received.size(); r++) // by queuing rank, this rank's own at its place, so both ranks of an edge apply its changes in one order
+    {
+        if(r == comm.rank()) updates.insert(updates.end(), own.begin(), own.end());
+        else for(size_t i = 0; i < recordCount<EdgeUpdate>(received[r]); i++) updates.push_back(readRecord<EdgeUpdate>(received[r], i));
+    }
+    own.clear();
+    for(size_t r = 0; r < outgoing.size(); r++) outgoing[r].clear();
+}
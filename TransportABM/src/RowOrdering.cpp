@@ -0,0 +1,149 @@
+/* RowOrdering.cpp */
+
+#include <algorithm> // std::sort, std::reverse
+#include <cstdlib> // std::labs
+#include <stdexcept>
+#include "RowOrdering.h"
+
+namespace {
+
+const int DOUBLES_PER_LINE = 64 / sizeof(double);
+const int DOUBLES_PER_PAGE = 4096 / sizeof(double);
+
+/* Degree of each local row counting only its local neighbours, the only edges the ordering follows */
+std::vector<int> localDegrees(const AgentAdjacency& adjacency, int localRows)
+{
+    std::vector<int> degree(localRows, 0);
+    for(int i = 0; i < localRows; i++)
+    {
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++) if(adjacency.neighbour[k] < localRows) degree[i]++;
+    }
+    return degree;
+}
+
+struct ByDegree
+{
+    const std::vector<int>& degree;
+    ByDegree(const std::vector<int>& d): degree(d){ }
+    bool operator()(int a, int b) const { return degree[a] != degree[b] ? degree[a] < degree[b] : a < b; }
+};
+
+/* Appends the component of start to queue in breadth first order, neighbours by increasing degree; returns where its last level begins */
+size_t sweep(const AgentAdjacency& adjacency, int localRows, const std::vector<int>& degree, int start, std::vector<int>& mark, int stamp,
+             std::vector<int>& queue, std::vector<int>& scratch)
+{
+    size_t first = queue.size(), lastLevel = first, levelEnd = first + 1;
+    queue.push_back(start);
+    mark[start] = stamp;
+    for(size_t at = first; at < queue.size(); at++)
+    {
+        if(at == levelEnd)
+        {
+            lastLevel = at;
+            levelEnd = queue.size();
+        }
+        int row = queue[at];
+        scratch.clear();
+        for(int k = adjacency.begin(row); k < adjacency.end(row); k++)
+        {
+            int next = adjacency.neighbour[k];
+            if(next >= localRows || mark[next] == stamp) continue;
+            mark[next] = stamp;
+            scratch.push_back(next);
+        }
+        std::sort(scratch.begin(), scratch.end(), ByDegree(degree));
+        queue.insert(queue.end(), scratch.begin(), scratch.end());
+    }
+    return lastLevel;
+}
+
+}
+
+RowOrdering::Method RowOrdering::parse(const std::string& name)
+{
+    if(name == "none") return NONE;
+    if(name == "bfs") return BFS;
+    if(name == "rcm") return RCM;
+    throw std::runtime_error("Unknown row ordering " + name + ", expected none, bfs or rcm");
+}
+
+std::vector<int> RowOrdering::order(const AgentAdjacency& adjacency, int localRows, int rows, Method method)
+{
+    std::vector<int> result;
+    result.reserve(rows);
+    if(method == NONE)
+    {
+        for(int i = 0; i < rows; i++) result.push_back(i);
+        return result;
+    }
+
+    std::vector<int> degree = localDegrees(adjacency, localRows);
+    std::vector<int> byDegree(localRows);
+    for(int i = 0; i < localRows; i++) byDegree[i] = i;
+    std::sort(byDegree.begin(), byDegree.end(), ByDegree(degree));
+
+    std::vector<int> placed(localRows, 0), probe(localRows, 0), queue, scratch;
+    int probes = 0;
+    for(int s = 0; s < localRows; s++)
+    {
+        int start = byDegree[s]; // lowest degree row of a component not yet placed
+        if(placed[start]) continue;
+
+        // One probe sweep: a lowest degree row of the farthest level is a pseudo peripheral start
+        queue.clear();
+        size_t lastLevel = sweep(adjacency, localRows, degree, start, probe, ++probes, queue, scratch);
+        start = queue[lastLevel];
+        for(size_t at = lastLevel + 1; at < queue.size(); at++) if(ByDegree(degree)(queue[at], start)) start = queue[at];
+
+        size_t component = result.size();
+        sweep(adjacency, localRows, degree, start, placed, 1, result, scratch);
+        if(method == RCM) std::reverse(result.begin() + component, result.end());
+    }
+
+    // Ghosts in the order of their first local reader
+    std::vector<char> seen(rows, 0);
+    for(int n = 0; n < localRows; n++)
+    {
+        int row = result[n];
+        for(int k = adjacency.begin(row); k < adjacency.end(row); k++)
+        {
+            int ghost = adjacency.neighbour[k];
+            if(ghost < localRows || seen[ghost]) continue;
+            seen[ghost] = 1;
+            result.push_back(ghost);
+        }
+    }
+    for(int ghost = localRows; ghost < rows; ghost++) if(!seen[ghost]) result.push_back(ghost); // imported but read by no local row
+    return result;
+}
+
+OrderingStats RowOrdering::measure(const AgentAdjacency& adjacency, int localRows)
+{
+    OrderingStats stats = { 0, 0, 0, 0 };
+    long reads = 0, far = 0, lines = 0;
+    double distance = 0;
+    std::vector<int> touched;
+    for(int i = 0; i < localRows; i++)
+    {
+        touched.clear();
+        for(int k = adjacency.begin(i); k < adjacency.end(i); k++)
+        {
+            touched.push_back(adjacency.neighbour[k] / DOUBLES_PER_LINE);
+            if(adjacency.neighbour[k] >= localRows) continue; // ghosts sit behind the local rows whatever the order
+            long gap = std::labs((long)adjacency.neighbour[k] - i);
+            if(gap > stats.bandwidth) stats.bandwidth = gap;
+            if(gap > DOUBLES_PER_PAGE) far++;
+            distance += gap;
+            reads++;
+        }
+        std::sort(touched.begin(), touched.end());
+        lines += std::unique(touched.begin(), touched.end()) - touched.begin();
+    }
+    if(reads > 0)
+    {
+        stats.meanDistance = distance / reads;
+        stats.farReads = (double)far / reads;
+    }
+    if(localRows > 0) stats.linesPerRow = (double)lines / localRows;
+    return stats;
+}
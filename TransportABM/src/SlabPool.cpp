@@ -0,0 +1,143 @@
+/* SlabPool.cpp */
+
+#include <stdlib.h> // posix_memalign
+#include <new> // std::bad_alloc
+#include "SlabPool.h"
+
+namespace {
+
+PoolTraffic traffic = { 0, 0, 0, 0 }; // main thread only, like the pools
+
+const size_t BLOCK_ALIGNMENT = 16;
+
+SlabPool* pools = 0; // every live pool
+
+}
+
+const PoolTraffic& poolTraffic()
+{
+    return traffic;
+}
+
+SlabPool::SlabPool(size_t objectSize): available(0), slabCount(0), liveBlocks(0)
+{
+    blockSize = (objectSize + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    if(blockSize < sizeof(void*)) blockSize = sizeof(void*);
+    size_t header = (sizeof(Slab) + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    blocksPerSlab = (int)((SLAB_BYTES - header) / blockSize);
+    if(blocksPerSlab < 8) blocksPerSlab = 0; // too large to be worth pooling
+    nextPool = pools;
+    pools = this;
+}
+
+SlabPool::~SlabPool()
+{
+    trim(); // every slab with live blocks is leaked on purpose, objects may outlive a static pool at exit
+    for(SlabPool** at = &pools; *at != 0; at = &(*at)->nextPool)
+    {
+        if(*at != this) continue;
+        *at = nextPool;
+        break;
+    }
+}
+
+SlabPool::Slab* SlabPool::newSlab()
+{
+    void* memory = 0;
+    if(posix_memalign(&memory, SLAB_BYTES, SLAB_BYTES) != 0) throw std::bad_alloc();
+    Slab* slab = static_cast<Slab*>(memory);
+    slab->next = 0;
+    slab->previous = 0;
+    slab->free = 0;
+    slab->unused = static_cast<char*>(memory) + (sizeof(Slab) + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    slab->live = 0;
+    slab->listed = false;
+    slabCount++;
+    traffic.slabsAllocated++;
+    return slab;
+}
+
+void SlabPool::link(Slab* slab)
+{
+    slab->previous = 0;
+    slab->next = available;
+    if(available != 0) available->previous = slab;
+    available = slab;
+    slab->listed = true;
+}
+
+void SlabPool::unlink(Slab* slab)
+{
+    if(slab->previous != 0) slab->previous->next = slab->next;
+    else available = slab->next;
+    if(slab->next != 0) slab->next->previous = slab->previous;
+    slab->listed = false;
+}
+
+SlabPool::Slab* SlabPool::slabOf(void* block) const
+{
+    return reinterpret_cast<Slab*>(reinterpret_cast<boost::uintptr_t>(block) & ~(boost::uintptr_t)(SLAB_BYTES - 1));
+}
+
+void* SlabPool::allocate()
+{
+    traffic.allocations++;
+    if(blocksPerSlab == 0) return ::operator new(blockSize);
+    if(available == 0) link(newSlab());
+    Slab* slab = available;
+    void* block;
+    if(slab->free != 0)
+    {
+        block = slab->free;
+        slab->free = *static_cast<void**>(block);
+    }
+    else
+    {
+        block = slab->unused;
+        slab->unused += blockSize;
+    }
+    slab->live++;
+    liveBlocks++;
+    bool full = slab->free == 0 && slab->unused + blockSize > reinterpret_cast<char*>(slab) + SLAB_BYTES;
+    if(full) unlink(slab);
+    return block;
+}
+
+void SlabPool::release(void* block)
+{
+    if(block == 0) return;
+    traffic.releases++;
+    if(blocksPerSlab == 0)
+    {
+        ::operator delete(block);
+        return;
+    }
+    Slab* slab = slabOf(block);
+    *static_cast<void**>(block) = slab->free;
+    slab->free = block;
+    slab->live--;
+    liveBlocks--;
+    if(!slab->listed) link(slab);
+}
+
+void SlabPool::trim()
+{
+    Slab* slab = available;
+    while(slab != 0)
+    {
+        Slab* next = slab->next;
+        if(slab->live == 0)
+        {
+            unlink(slab);
+            free(slab);
+            slabCount--;
+            traffic.slabsReleased++;
+        }
+        slab = next;
+    }
+}
+
+void SlabPool::trimAll()
+{
+    for(SlabPool* pool = pools; pool != 0; pool = pool->nextPool) pool->trim();
+}
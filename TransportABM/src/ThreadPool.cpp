@@ -0,0 +1,97 @@
+/* ThreadPool.cpp */
+
+#include <stdlib.h> // posix_memalign
+#include <new> // std::bad_alloc, placement new
+#include "ThreadPool.h"
+
+TickThreadPool::TickThreadPool(int threads): workers(threads < 1 ? 1 : threads), generation(0), running(0), stopping(false), task(0), grain(1)
+{
+    void* memory = 0;
+    if(posix_memalign(&memory, sizeof(Slice), workers * sizeof(Slice)) != 0) throw std::bad_alloc(); // new[] would not align the slices to cache lines
+    slices = (Slice*)memory;
+    for(int w = 0; w < workers; w++)
+    {
+        new (&slices[w]) Slice;
+        slices[w].next.store(0);
+        slices[w].end = 0;
+    }
+    for(int w = 1; w < workers; w++) helpers.push_back(std::thread(&TickThreadPool::helperLoop, this, w));
+}
+
+TickThreadPool::~TickThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(size_t i = 0; i < helpers.size(); i++) helpers[i].join();
+    for(int w = 0; w < workers; w++) slices[w].~Slice();
+    free(slices);
+}
+
+void TickThreadPool::parallelFor(int begin, int end, int grainSize, ParallelTask& body)
+{
+    if(end <= begin) return;
+    if(workers == 1) // no helpers, run inline
+    {
+        body.run(begin, end, 0);
+        return;
+    }
+
+    int count = end - begin;
+    for(int w = 0; w < workers; w++) // contiguous, evenly sized slices keep each worker streaming through memory
+    {
+        slices[w].next.store(begin + (int)((long)count * w / workers), std::memory_order_relaxed);
+        slices[w].end = begin + (int)((long)count * (w + 1) / workers);
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        task = &body;
+        grain = grainSize < 1 ? 1 : grainSize;
+        running = workers - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    while(running > 0) finished.wait(guard);
+    task = 0;
+}
+
+void TickThreadPool::helperLoop(int worker)
+{
+    unsigned long seen = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while(!stopping && generation == seen) wake.wait(guard);
+            if(stopping) return;
+            seen = generation;
+        }
+        work(worker);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running--;
+        }
+        finished.notify_one();
+    }
+}
+
+void TickThreadPool::work(int worker)
+{
+    for(int v = 0; v < workers; v++) // own slice first, then steal from the others in turn
+    {
+        Slice& slice = slices[(worker + v) % workers];
+        while(true)
+        {
+            int first = slice.next.fetch_add(grain, std::memory_order_relaxed);
+            if(first >= slice.end) break;
+            int last = first + grain < slice.end ? first + grain : slice.end;
+            task->run(first, last, worker);
+        }
+    }
+}
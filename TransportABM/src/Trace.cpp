@@ -0,0 +1,106 @@
+/* Trace.cpp */
+
+#include <cstring> // std::memcpy, std::memset
+#include <chrono>
+#include <stdexcept>
+#include "Trace.h"
+
+TraceRing::TraceRing(): records(1), mask(0), head(0), tail(0), dropped(0){ }
+
+void TraceRing::configure(size_t capacity)
+{
+    size_t size = 1;
+    while(size < capacity) size <<= 1;
+    records.assign(size, TraceRecord());
+    mask = size - 1;
+    head.store(0);
+    tail.store(0);
+}
+
+size_t TraceRing::drain(std::vector<TraceRecord>& out)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    for(size_t i = t; i != h; i++) out.push_back(records[i & mask]);
+    tail.store(h, std::memory_order_release);
+    return h - t;
+}
+
+TraceWriter::TraceWriter(const std::string& path, int rank, int worldSize, int workers, size_t ringRecords, int flushInterval):
+    file(0), rings(0), ringCount(workers > 0 ? workers : 1), flushMillis(flushInterval > 0 ? flushInterval : 1), closing(false), failed(false), written(0)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if(file == 0) throw std::runtime_error("Cannot open trace file " + path);
+    TraceFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TABMTRC1", 8);
+    header.version    = 1;
+    header.rank       = (boost::uint32_t)rank;
+    header.worldSize  = (boost::uint32_t)worldSize;
+    header.recordSize = sizeof(TraceRecord);
+    if(std::fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        std::fclose(file);
+        throw std::runtime_error("Cannot write trace file " + path);
+    }
+
+    rings = new TraceRing[ringCount];
+    for(int r = 0; r < ringCount; r++) rings[r].configure(ringRecords);
+    flusher = std::thread(&TraceWriter::flushLoop, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    try
+    {
+        close();
+    }
+    catch(const std::exception&)
+    {
+    }
+    delete [] rings;
+}
+
+bool TraceWriter::drainAll()
+{
+    batch.clear();
+    for(int r = 0; r < ringCount; r++) rings[r].drain(batch);
+    if(batch.empty()) return true;
+    if(std::fwrite(&batch[0], sizeof(TraceRecord), batch.size(), file) != batch.size()) return false;
+    written += batch.size();
+    return true;
+}
+
+void TraceWriter::flushLoop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while(!closing)
+    {
+        wake.wait_for(guard, std::chrono::milliseconds(flushMillis));
+        guard.unlock();
+        if(!drainAll()) failed = true;
+        guard.lock();
+    }
+}
+
+void TraceWriter::close()
+{
+    if(file == 0) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    wake.notify_one();
+    flusher.join();
+    if(!drainAll()) failed = true; // whatever was pushed after the flusher's last pass
+    if(std::fclose(file) != 0) failed = true;
+    file = 0;
+    if(failed) throw std::runtime_error("Writing the trace file failed");
+}
+
+unsigned long TraceWriter::getDropped() const
+{
+    unsigned long dropped = 0;
+    for(int r = 0; r < ringCount; r++) dropped += rings[r].droppedCount();
+    return dropped;
+}
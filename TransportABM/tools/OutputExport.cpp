@@ -0,0 +1,59 @@
+/* OutputExport.cpp */
+
+#include <cstring> // strnlen
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "OutputWriter.h"
+
+/* Sums the per rank binary output files of a run into the csv layout written by the SVDataSet */
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        std::cerr << "usage: output_export <agent_total_data.csv> <agent_total_data.0.bin> [<agent_total_data.1.bin> ...]" << std::endl;
+        return 1;
+    }
+    try
+    {
+        std::vector<BinaryOutput> ranks(argc - 2);
+        for(int f = 2; f < argc; f++) readBinaryOutput(argv[f], ranks[f - 2]);
+
+        const BinaryOutput& first = ranks[0];
+        size_t width = first.columns.size();
+        for(size_t r = 1; r < ranks.size(); r++)
+        {
+            if(ranks[r].columns.size() != width || ranks[r].ticks != first.ticks) throw std::runtime_error(std::string(argv[r + 2]) + " does not come from the same run as " + argv[2]);
+        }
+
+        BinaryOutput sum;
+        sumBinaryOutputs(ranks, sum);
+
+        std::ofstream out(argv[1]);
+        if(!out) throw std::runtime_error(std::string("Cannot write ") + argv[1]);
+        out.precision(std::numeric_limits<double>::digits10 + 2);
+        out << "tick";
+        for(size_t c = 0; c < width; c++) out << "," << std::string(first.columns[c].name, strnlen(first.columns[c].name, sizeof(first.columns[c].name)));
+        out << "\n";
+        for(size_t row = 0; row < sum.ticks.size(); row++)
+        {
+            out << sum.ticks[row];
+            for(size_t c = 0; c < width; c++)
+            {
+                if(sum.columns[c].type == OUTPUT_INT64) out << "," << (long long)sum.values[row * width + c].i;
+                else out << "," << sum.values[row * width + c].d;
+            }
+            out << "\n";
+        }
+        std::cout << "Wrote " << first.ticks.size() << " rows from " << ranks.size() << " ranks to " << argv[1] << std::endl;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+/* PopulationConvert.cpp */
+
+#include <iostream>
+#include <stdexcept>
+#include "Population.h"
+
+/* Converts a synthetic population CSV (age,commuteDist,socNorm,region[,cycles]) into the columnar file read by population.file */
+int main(int argc, char** argv)
+{
+    if(argc != 3)
+    {
+        std::cerr << "usage: population_convert <population.csv> <population.bin>" << std::endl;
+        return 1;
+    }
+    try
+    {
+        boost::uint64_t rows = PopulationFile::convertCsv(argv[1], argv[2]);
+        std::cout << "Wrote " << rows << " agents to " << argv[2] << std::endl;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/* TraceDecode.cpp */
+
+#include <cstring> // std::memcmp
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Trace.h"
+
+namespace {
+
+const char* EVENT_NAMES[] = { "state", "import", "cancel", "remove", "migrate" };
+const int EVENT_COUNT = sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]);
+
+const char* eventName(int event)
+{
+    return (event >= 0 && event < EVENT_COUNT) ? EVENT_NAMES[event] : "unknown";
+}
+
+int eventByName(const std::string& name)
+{
+    for(int e = 0; e < EVENT_COUNT; e++) if(name == EVENT_NAMES[e]) return e;
+    throw std::runtime_error("Unknown event " + name);
+}
+
+void decode(const std::string& path, int onlyEvent, long onlyAgent)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in) throw std::runtime_error("Cannot open " + path);
+    TraceFileHeader header;
+    if(!in.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "TABMTRC1", 8) != 0 || header.version != 1)
+    {
+        throw std::runtime_error(path + " is not a version 1 trace file");
+    }
+    if(header.recordSize != sizeof(TraceRecord)) throw std::runtime_error(path + " was written with a different record layout");
+
+    TraceRecord record;
+    while(in.read((char*)&record, sizeof(record)))
+    {
+        if(onlyEvent >= 0 && record.event != onlyEvent) continue;
+        if(onlyAgent >= 0 && record.id != onlyAgent) continue;
+        std::cout << header.rank << "," << record.tick << "," << eventName(record.event) << "," << record.id << "," << record.startingRank << ","
+                  << record.type << "," << record.c << "," << record.total << "," << (int)record.cycles << "\n";
+    }
+}
+
+}
+
+/* Prints the records of per rank binary trace files as csv, in the order each rank flushed them */
+int main(int argc, char** argv)
+{
+    int onlyEvent = -1;
+    long onlyAgent = -1;
+    std::vector<std::string> files;
+    try
+    {
+        for(int a = 1; a < argc; a++)
+        {
+            std::string arg = argv[a];
+            if(arg == "--event" && a + 1 < argc) onlyEvent = eventByName(argv[++a]);
+            else if(arg == "--agent" && a + 1 < argc) onlyAgent = std::stol(argv[++a]);
+            else files.push_back(arg);
+        }
+        if(files.empty())
+        {
+            std::cerr << "usage: trace_decode [--event state|import|cancel|remove|migrate] [--agent id] <trace.0.trc> [<trace.1.trc> ...]" << std::endl;
+            return 1;
+        }
+        std::cout.precision(std::numeric_limits<double>::digits10 + 2);
+        std::cout << "rank,tick,event,id,startingRank,type,c,total,cycles\n"; // type is the destination rank of migrate
+        for(size_t f = 0; f < files.size(); f++) decode(files[f], onlyEvent, onlyAgent);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}